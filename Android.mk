@@ -31,10 +31,14 @@ LOCAL_SRC_FILES := \
     roots.cpp \
     ui.cpp \
     screen_ui.cpp \
+    log_ring.cpp \
+    log_writer.cpp \
     messagesocket.cpp \
+    startup.cpp \
     asn1_decoder.cpp \
     verifier.cpp \
-    adb_install.cpp
+    adb_install.cpp \
+    updater/progress_channel.c
 
 # External tools
 LOCAL_SRC_FILES += \
@@ -68,8 +72,8 @@ LOCAL_STATIC_LIBRARIES := \
     libminzip \
     libz \
     libmtdutils \
-    libmincrypt \
     libminadbd \
+    libmincrypt \
     libbusybox \
     libminui \
     libpng \
@@ -145,6 +149,20 @@ $(RECOVERY_BUSYBOX_SYMLINKS): $(LOCAL_INSTALLED_MODULE)
 
 ALL_DEFAULT_INSTALLED_MODULES += $(RECOVERY_BUSYBOX_SYMLINKS)
 
+# Prepacked, already decoded copy of res/images (see minui/res_bundle.h).
+# Images a device overrides no longer match the size and CRC recorded in
+# the bundle, so minui falls back to decoding those PNGs.
+RECOVERY_RES_BUNDLE := $(TARGET_RECOVERY_ROOT_OUT)/res/images.bundle
+RECOVERY_RES_IMAGES := $(wildcard $(LOCAL_PATH)/res/images/*.png)
+MKRESBUNDLE := $(HOST_OUT_EXECUTABLES)/mkresbundle$(HOST_EXECUTABLE_SUFFIX)
+$(RECOVERY_RES_BUNDLE): IMAGE_DIR := $(LOCAL_PATH)/res/images
+$(RECOVERY_RES_BUNDLE): $(RECOVERY_RES_IMAGES) $(MKRESBUNDLE)
+	@echo "Resource bundle: $@"
+	@mkdir -p $(dir $@)
+	$(hide) $(MKRESBUNDLE) $(IMAGE_DIR) $@
+
+ALL_DEFAULT_INSTALLED_MODULES += $(RECOVERY_RES_BUNDLE)
+
 include $(CLEAR_VARS)
 LOCAL_MODULE := bu_recovery
 LOCAL_MODULE_STEM := bu
@@ -157,6 +175,7 @@ LOCAL_SRC_FILES := \
     backup.cpp \
     restore.cpp \
     messagesocket.cpp \
+    log_writer.cpp \
     roots.cpp
 LOCAL_CFLAGS += -DMINIVOLD
 ifeq ($(TARGET_USERIMAGES_USE_EXT4), true)
@@ -253,6 +272,22 @@ LOCAL_STATIC_LIBRARIES := \
     libc
 include $(BUILD_EXECUTABLE)
 
+# ScreenRecoveryUI's drawing, timed on the host (see screen_ui_bench.cpp).
+include $(CLEAR_VARS)
+LOCAL_MODULE := screen_ui_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := \
+    screen_ui_bench.cpp \
+    screen_ui.cpp \
+    ui.cpp \
+    log_ring.cpp \
+    log_writer.cpp \
+    messagesocket.cpp
+LOCAL_C_INCLUDES += system/core/include
+LOCAL_STATIC_LIBRARIES := libminui_host libpng libz
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
 
 include $(LOCAL_PATH)/minui/Android.mk \
     $(LOCAL_PATH)/minelf/Android.mk \
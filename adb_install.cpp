@@ -29,9 +29,11 @@
 #include "cutils/properties.h"
 #include "install.h"
 #include "common.h"
+#include "log_writer.h"
 #include "adb_install.h"
 extern "C" {
 #include "minadbd/adb.h"
+#include "minadbd/fuse_sideload.h"
 }
 
 static RecoveryUI* ui = NULL;
@@ -72,20 +74,42 @@ maybe_restart_adbd() {
 
 struct sideload_waiter_data {
     pid_t child;
+    volatile bool stop;  // apply_from_adb() is done waiting
+    bool fuse;           // the host is serving the package on demand
+    bool exited;         // the child has been reaped
 };
 
 static struct sideload_waiter_data waiter;
 
+// How often to look for the package the host serves with FUSE (inotify
+// doesn't see it appear).
+#define FUSE_POLL_MS 250
+
 void *adb_sideload_thread(void* v) {
     struct sideload_waiter_data* data = (struct sideload_waiter_data*)v;
 
-    int status;
-    waitpid(data->child, &status, 0);
-    LOGI("sideload process finished\n");
+    // A host that serves blocks on demand leaves adbd running while the
+    // package is installed; an older one copies it and adbd exits.
+    // Either ends the wait, as does apply_from_adb() giving up on it.
+    int status = 0;
+    struct stat st;
+    while (!data->stop) {
+        if (waitpid(data->child, &status, WNOHANG) != 0) {
+            LOGI("sideload process finished\n");
+            data->exited = true;
+            break;
+        }
+        if (stat(FUSE_SIDELOAD_HOST_PATHNAME, &st) == 0) {
+            LOGI("sideload package available\n");
+            data->fuse = true;
+            break;
+        }
+        usleep(FUSE_POLL_MS * 1000);
+    }
 
     ui->CancelWaitKey();
 
-    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    if (data->exited && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
         LOGI("status %d\n", WEXITSTATUS(status));
     }
 
@@ -103,11 +127,15 @@ start_sideload(RecoveryUI* ui_) {
     ui->Print("\n\nNow send the package you want to apply\n"
               "to the device with \"adb sideload <filename>\"...\n");
 
+    log_flush();
     if ((waiter.child = fork()) == 0) {
         execl("/sbin/recovery", "recovery", "--adbd", NULL);
         _exit(-1);
     }
 
+    waiter.stop = false;
+    waiter.fuse = false;
+    waiter.exited = false;
     pthread_create(&sideload_thread, NULL, &adb_sideload_thread, &waiter);
 }
 
@@ -115,6 +143,21 @@ int
 apply_from_adb(int* wipe_cache, const char* install_file) {
 
     int ret = INSTALL_ERROR;
+    struct stat st;
+
+    // Once the waiter is gone nothing changes what it found, so the
+    // FUSE install and the cleanup after it agree.
+    waiter.stop = true;
+    pthread_join(sideload_thread, NULL);
+    bool fuse = waiter.fuse;
+
+    if (fuse) {
+        // /sideload isn't in the fstab; it's mounted by the child.
+        ret = install_package(FUSE_SIDELOAD_HOST_PATHNAME, wipe_cache, install_file, false);
+
+        // Unmounts the package and lets the host know we're done.
+        stat(FUSE_SIDELOAD_HOST_EXIT_PATHNAME, &st);
+    }
 
     set_perf_mode(true);
 
@@ -122,13 +165,18 @@ apply_from_adb(int* wipe_cache, const char* install_file) {
     maybe_restart_adbd();
 
     // kill the child
-    kill(waiter.child, SIGTERM);
-    pthread_join(sideload_thread, NULL);
+    if (!waiter.exited) {
+        kill(waiter.child, SIGTERM);
+        waitpid(waiter.child, NULL, 0);
+    }
     ui->FlushKeys();
 
     set_perf_mode(false);
 
-    struct stat st;
+    if (fuse) {
+        return ret;
+    }
+
     if (stat(ADB_SIDELOAD_FILENAME, &st) != 0) {
         if (errno == ENOENT) {
             ui->Print("No package received.\n");
@@ -18,19 +18,23 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "common.h"
 #include "install.h"
+#include "log_writer.h"
 #include "mincrypt/rsa.h"
+#include "mincrypt/sha256.h"
 #include "minui/minui.h"
 #include "minzip/SysUtil.h"
 #include "minzip/Zip.h"
 #include "mtdutils/mounts.h"
 #include "mtdutils/mtdutils.h"
 #include "roots.h"
+#include "updater/progress_channel.h"
 #include "verifier.h"
 #include "ui.h"
 
@@ -47,9 +51,176 @@ static const float VERIFICATION_PROGRESS_FRACTION = 0.25;
 static const float DEFAULT_FILES_PROGRESS_FRACTION = 0.4;
 static const float DEFAULT_IMAGE_PROGRESS_FRACTION = 0.1;
 
+// What /tmp/update_binary was extracted from, so the packages of one
+// queue that share an updater only extract it once: the SHA-256 of the
+// entry's bytes as stored in its package, and how they were stored.
+static bool binary_extracted = false;
+static uint8_t binary_sha256[SHA256_DIGEST_SIZE];
+static int binary_compression;
+static long binary_length;
+
+// The package has been verified by now, so the entry's bytes are the
+// signed ones; hashing them from the mapped archive needs no inflating.
+static void
+hash_zip_entry(const ZipArchive* zip, const ZipEntry* entry, uint8_t* sha256)
+{
+    SHA256_hash((const unsigned char*)zip->map.addr + entry->offset, entry->compLen, sha256);
+}
+
+// One line of the update binary's text commands.
+static void
+handle_text_command(char* buffer, int* wipe_cache, float share) {
+    char* command = strtok(buffer, " \n");
+    if (command == NULL) {
+        return;
+    } else if (strcmp(command, "progress") == 0) {
+        char* fraction_s = strtok(NULL, " \n");
+        char* seconds_s = strtok(NULL, " \n");
+
+        float fraction = strtof(fraction_s, NULL);
+        int seconds = strtol(seconds_s, NULL, 10);
+
+        ui->ShowProgress(fraction * share, seconds);
+    } else if (strcmp(command, "set_progress") == 0) {
+        char* fraction_s = strtok(NULL, " \n");
+        float fraction = strtof(fraction_s, NULL);
+        ui->SetProgress(fraction);
+    } else if (strcmp(command, "ui_print") == 0) {
+        char* str = strtok(NULL, "\n");
+        if (str) {
+            ui->Print("%s", str);
+        } else {
+            ui->Print("\n");
+        }
+        fflush(stdout);
+    } else if (strcmp(command, "wipe_cache") == 0) {
+        *wipe_cache = 1;
+    } else if (strcmp(command, "clear_display") == 0) {
+        ui->SetBackground(RecoveryUI::NONE);
+    } else {
+        LOGE("unknown command [%s]\n", command);
+    }
+}
+
+// What's left to apply of the records read from the binary channel.
+// Prints are joined, and only the last set_progress counts, until
+// something else comes along or the read is used up.
+struct progress_state {
+    int* wipe_cache;
+    float share;
+    char print[256];        // what ui->Print() takes at once
+    size_t print_len;
+    bool set_pending;
+    float set_fraction;
+    char line[1024];        // text commands, up to a newline
+    size_t line_len;
+};
+
+static void
+apply_pending(progress_state* s) {
+    if (s->print_len > 0) {
+        s->print[s->print_len] = '\0';
+        ui->Print("%s", s->print);
+        s->print_len = 0;
+    }
+    if (s->set_pending) {
+        ui->SetProgress(s->set_fraction);
+        s->set_pending = false;
+    }
+}
+
+static void
+handle_progress_record(int type, const unsigned char* payload, size_t len, void* cookie) {
+    progress_state* s = (progress_state*)cookie;
+
+    if (type == PROGRESS_PRINT) {
+        while (len > 0) {
+            size_t n = sizeof(s->print) - 1 - s->print_len;
+            if (n > len) n = len;
+            memcpy(s->print + s->print_len, payload, n);
+            s->print_len += n;
+            payload += n;
+            len -= n;
+            if (s->print_len == sizeof(s->print) - 1) apply_pending(s);
+        }
+        return;
+    }
+    if (type == PROGRESS_SET) {
+        s->set_pending = true;
+        s->set_fraction = (float)progress_get_u32(payload) / PROGRESS_FRACTION_ONE;
+        return;
+    }
+
+    apply_pending(s);
+    switch (type) {
+        case PROGRESS_SHOW:
+            ui->ShowProgress((float)progress_get_u32(payload) / PROGRESS_FRACTION_ONE *
+                             s->share, progress_get_u32(payload + 4));
+            break;
+        case PROGRESS_WIPE_CACHE:
+            *s->wipe_cache = 1;
+            break;
+        case PROGRESS_CLEAR_DISPLAY:
+            ui->SetBackground(RecoveryUI::NONE);
+            break;
+        case PROGRESS_TEXT:
+            // Cut into lines the way fgets() would.
+            for (size_t i = 0; i < len; ++i) {
+                s->line[s->line_len++] = payload[i];
+                if (payload[i] == '\n' || s->line_len == sizeof(s->line) - 1) {
+                    s->line[s->line_len] = '\0';
+                    handle_text_command(s->line, s->wipe_cache, s->share);
+                    s->line_len = 0;
+                }
+            }
+            break;
+    }
+}
+
+// Read the update binary's records until it closes the pipe.
+static void
+read_progress_channel(int fd, const unsigned char* first, int* wipe_cache, float share) {
+    progress_state state;
+    state.wipe_cache = wipe_cache;
+    state.share = share;
+    state.print_len = 0;
+    state.set_pending = false;
+    state.line_len = 0;
+
+    ProgressParser parser;
+    progress_parser_init(&parser);
+    progress_parser_feed(&parser, first, 1, handle_progress_record, &state);
+
+    unsigned char buffer[4096];
+    bool reported = false;
+    ssize_t n;
+    while ((n = TEMP_FAILURE_RETRY(read(fd, buffer, sizeof(buffer)))) > 0) {
+        // Once the stream is malformed the rest is drained unread, so
+        // the update binary isn't left blocked on the pipe.
+        if (progress_parser_feed(&parser, buffer, n, handle_progress_record, &state) != 0 &&
+            !reported) {
+            LOGE("malformed command stream from update binary\n");
+            reported = true;
+        }
+        apply_pending(&state);
+    }
+    if (state.line_len > 0) {
+        state.line[state.line_len] = '\0';
+        handle_text_command(state.line, wipe_cache, share);
+    }
+    if (progress_parser_finish(&parser) != 0 && !reported) {
+        LOGE("command stream from update binary cut short\n");
+    }
+    close(fd);
+}
+
 // If the package contains an update binary, extract it and run it.
+// 'share' is how much of the progress bar its progress commands fill;
+// with reuse_binary, an update binary identical to the one extracted
+// last is run without extracting it again.
 static int
-try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
+try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache,
+                  float share, bool reuse_binary) {
     const ZipEntry* binary_entry =
             mzFindZipEntry(zip, ASSUMED_UPDATE_BINARY_NAME);
     if (binary_entry == NULL) {
@@ -58,20 +229,36 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
     }
 
     const char* binary = "/tmp/update_binary";
-    unlink(binary);
-    int fd = creat(binary, 0755);
-    if (fd < 0) {
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+    if (reuse_binary) hash_zip_entry(zip, binary_entry, sha256);
+    if (reuse_binary && binary_extracted &&
+        binary_entry->compression == binary_compression &&
+        binary_entry->uncompLen == binary_length &&
+        memcmp(sha256, binary_sha256, SHA256_DIGEST_SIZE) == 0) {
+        LOGI("%s unchanged; not extracting it again\n", ASSUMED_UPDATE_BINARY_NAME);
+        mzCloseZipArchive(zip);
+    } else {
+        binary_extracted = false;
+        unlink(binary);
+        int fd = creat(binary, 0755);
+        if (fd < 0) {
+            mzCloseZipArchive(zip);
+            LOGE("Can't make %s\n", binary);
+            return INSTALL_ERROR;
+        }
+        bool ok = mzExtractZipEntryToFile(zip, binary_entry, fd);
+        close(fd);
+        binary_compression = binary_entry->compression;
+        binary_length = binary_entry->uncompLen;
+        if (reuse_binary) memcpy(binary_sha256, sha256, SHA256_DIGEST_SIZE);
         mzCloseZipArchive(zip);
-        LOGE("Can't make %s\n", binary);
-        return INSTALL_ERROR;
-    }
-    bool ok = mzExtractZipEntryToFile(zip, binary_entry, fd);
-    close(fd);
-    mzCloseZipArchive(zip);
 
-    if (!ok) {
-        LOGE("Can't copy %s\n", ASSUMED_UPDATE_BINARY_NAME);
-        return INSTALL_ERROR;
+        if (!ok) {
+            LOGE("Can't copy %s\n", ASSUMED_UPDATE_BINARY_NAME);
+            return INSTALL_ERROR;
+        }
+        // Only a binary whose hash was taken can be matched later.
+        binary_extracted = reuse_binary;
     }
 
     int pipefd[2];
@@ -110,6 +297,9 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
     //
     //   - the name of the package zip file.
     //
+    // PROGRESS_CHANNEL_ENV in its environment offers the binary form of
+    // those commands (see updater/progress_channel.h) instead.
+    //
 
     const char** args = (const char**)malloc(sizeof(char*) * 5);
     args[0] = binary;
@@ -120,52 +310,44 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
     args[3] = (char*)path;
     args[4] = NULL;
 
+    // Built before forking: this process has other threads, so the
+    // child shouldn't touch the heap before exec.
+    int envc = 0;
+    while (environ[envc] != NULL) ++envc;
+    const char** envp = (const char**)malloc(sizeof(char*) * (envc + 2));
+    memcpy(envp, environ, sizeof(char*) * envc);
+    envp[envc] = PROGRESS_CHANNEL_ENV "=" EXPAND(PROGRESS_CHANNEL_VERSION);
+    envp[envc + 1] = NULL;
+
+    log_flush();
     pid_t pid = fork();
     if (pid == 0) {
         close(pipefd[0]);
-        execv(binary, (char* const*)args);
+        execve(binary, (char* const*)args, (char* const*)envp);
         fprintf(stdout, "E:Can't run %s (%s)\n", binary, strerror(errno));
+        fflush(stdout);
         _exit(-1);
     }
     close(pipefd[1]);
+    free(envp);
 
     *wipe_cache = 0;
 
-    char buffer[1024];
-    FILE* from_child = fdopen(pipefd[0], "r");
-    while (fgets(buffer, sizeof(buffer), from_child) != NULL) {
-        char* command = strtok(buffer, " \n");
-        if (command == NULL) {
-            continue;
-        } else if (strcmp(command, "progress") == 0) {
-            char* fraction_s = strtok(NULL, " \n");
-            char* seconds_s = strtok(NULL, " \n");
-
-            float fraction = strtof(fraction_s, NULL);
-            int seconds = strtol(seconds_s, NULL, 10);
-
-            ui->ShowProgress(fraction * (1-VERIFICATION_PROGRESS_FRACTION), seconds);
-        } else if (strcmp(command, "set_progress") == 0) {
-            char* fraction_s = strtok(NULL, " \n");
-            float fraction = strtof(fraction_s, NULL);
-            ui->SetProgress(fraction);
-        } else if (strcmp(command, "ui_print") == 0) {
-            char* str = strtok(NULL, "\n");
-            if (str) {
-                ui->Print("%s", str);
-            } else {
-                ui->Print("\n");
-            }
-            fflush(stdout);
-        } else if (strcmp(command, "wipe_cache") == 0) {
-            *wipe_cache = 1;
-        } else if (strcmp(command, "clear_display") == 0) {
-            ui->SetBackground(RecoveryUI::NONE);
-        } else {
-            LOGE("unknown command [%s]\n", command);
+    // An update binary that took up the binary channel starts with its
+    // preamble; anything else is the text commands.
+    unsigned char first;
+    ssize_t got = TEMP_FAILURE_RETRY(read(pipefd[0], &first, 1));
+    if (got == 1 && first == (unsigned char)PROGRESS_MAGIC[0]) {
+        read_progress_channel(pipefd[0], &first, wipe_cache, share);
+    } else {
+        char buffer[1024];
+        FILE* from_child = fdopen(pipefd[0], "r");
+        if (got == 1) ungetc(first, from_child);
+        while (fgets(buffer, sizeof(buffer), from_child) != NULL) {
+            handle_text_command(buffer, wipe_cache, share);
         }
+        fclose(from_child);
     }
-    fclose(from_child);
 
     int status;
     waitpid(pid, &status, 0);
@@ -177,22 +359,32 @@ try_update_binary(const char *path, ZipArchive *zip, int* wipe_cache) {
     return INSTALL_SUCCESS;
 }
 
-static int
-really_install_package(const char *path, int* wipe_cache)
-{
-    int ret = 0;
+// Parsed once, by whichever of preload_keys() or the first install
+// gets there first.
+static pthread_mutex_t keys_lock = PTHREAD_MUTEX_INITIALIZER;
+static Certificate* loaded_keys = NULL;
+static int num_loaded_keys = 0;
 
-    ui->SetBackground(RecoveryUI::INSTALLING_UPDATE);
-    ui->Print("Finding update package...\n");
-    // Give verification half the progress bar...
-    ui->SetProgressType(RecoveryUI::DETERMINATE);
-    ui->ShowProgress(VERIFICATION_PROGRESS_FRACTION, VERIFICATION_PROGRESS_TIME);
+void
+preload_keys()
+{
+    pthread_mutex_lock(&keys_lock);
+    if (loaded_keys == NULL) {
+        loaded_keys = load_keys(PUBLIC_KEYS_FILE, &num_loaded_keys);
+        if (loaded_keys != NULL) {
+            LOGI("%d key(s) loaded from %s\n", num_loaded_keys, PUBLIC_KEYS_FILE);
+        }
+    }
+    pthread_mutex_unlock(&keys_lock);
+}
 
-    // Resolve symlink in case legacy /sdcard path is used
-    // Requires: symlink uses absolute path
-    char new_path[PATH_MAX];
+// Resolve symlink in case legacy /sdcard path is used
+// Requires: symlink uses absolute path
+static const char*
+resolve_package_path(const char* path, char* new_path)
+{
     if (strlen(path) > 1) {
-        char *rest = strchr(path + 1, '/');
+        const char *rest = strchr(path + 1, '/');
         if (rest != NULL) {
             int readlink_length;
             int root_length = rest - path;
@@ -207,31 +399,45 @@ really_install_package(const char *path, int* wipe_cache)
             free(root);
         }
     }
+    return path;
+}
+
+static int
+really_install_package(const char *path, int* wipe_cache, const PackageDigest* digest,
+                       bool needs_mount)
+{
+    int ret = 0;
+
+    ui->SetBackground(RecoveryUI::INSTALLING_UPDATE);
+    ui->Print("Finding update package...\n");
+    // Give verification half the progress bar...
+    ui->SetProgressType(RecoveryUI::DETERMINATE);
+    ui->ShowProgress(VERIFICATION_PROGRESS_FRACTION, VERIFICATION_PROGRESS_TIME);
+
+    char new_path[PATH_MAX];
+    path = resolve_package_path(path, new_path);
 
     LOGI("Update location: %s\n", path);
 
-    if (ensure_path_mounted(path) != 0) {
+    if (needs_mount && ensure_path_mounted(path) != 0) {
         LOGE("Can't mount %s\n", path);
         return INSTALL_CORRUPT;
     }
 
     ui->Print("Opening update package...\n");
 
-    int numKeys;
-    Certificate* loadedKeys = load_keys(PUBLIC_KEYS_FILE, &numKeys);
-    if (loadedKeys == NULL) {
+    preload_keys();
+    if (loaded_keys == NULL) {
         LOGE("Failed to load keys\n");
         return INSTALL_CORRUPT;
     }
-    LOGI("%d key(s) loaded from %s\n", numKeys, PUBLIC_KEYS_FILE);
 
     set_perf_mode(true);
 
     ui->Print("Verifying update package...\n");
 
     int err;
-    err = verify_file(path, loadedKeys, numKeys);
-    free(loadedKeys);
+    err = verify_file(path, loaded_keys, num_loaded_keys, digest);
     LOGI("verify_file returned %d\n", err);
     if (err != VERIFY_SUCCESS) {
         LOGE("signature verification failed\n");
@@ -252,7 +458,8 @@ really_install_package(const char *path, int* wipe_cache)
     /* Verify and install the contents of the package.
      */
     ui->Print("Installing update...\n");
-    ret = try_update_binary(path, &zip, wipe_cache);
+    ret = try_update_binary(path, &zip, wipe_cache,
+                            1 - VERIFICATION_PROGRESS_FRACTION, false);
 
 out:
     set_perf_mode(false);
@@ -260,7 +467,15 @@ out:
 }
 
 int
-install_package(const char* path, int* wipe_cache, const char* install_file)
+install_package(const char* path, int* wipe_cache, const char* install_file,
+                bool needs_mount)
+{
+    return install_package_with_digest(path, wipe_cache, install_file, NULL, needs_mount);
+}
+
+int
+install_package_with_digest(const char* path, int* wipe_cache, const char* install_file,
+                            const PackageDigest* digest, bool needs_mount)
 {
     FILE* install_log = fopen_path(install_file, "w");
     if (install_log) {
@@ -274,7 +489,7 @@ install_package(const char* path, int* wipe_cache, const char* install_file)
         LOGE("failed to set up expected mounts for install; aborting\n");
         result = INSTALL_ERROR;
     } else {
-        result = really_install_package(path, wipe_cache);
+        result = really_install_package(path, wipe_cache, digest, needs_mount);
     }
     if (install_log) {
         fputc(result == INSTALL_SUCCESS ? '1' : '0', install_log);
@@ -284,6 +499,187 @@ install_package(const char* path, int* wipe_cache, const char* install_file)
     return result;
 }
 
+// A package in a queue; they are all hashed at once, one per thread.
+struct queued_package {
+    char path[PATH_MAX];
+    off_t size;
+    PackageDigest digest;
+    pthread_t thread;
+    bool started;
+};
+
+#define QUEUE_HASH_BUFFER_SIZE (1024 * 1024)
+
+static off_t queue_total_bytes;
+static off_t queue_hashed_bytes;
+
+static void*
+hash_package_thread(void* cookie)
+{
+    queued_package* pkg = (queued_package*)cookie;
+    memset(&pkg->digest, 0, sizeof(pkg->digest));
+
+    // Anything that goes wrong here just leaves verify_file to hash
+    // the package itself.
+    int fd = open(pkg->path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    unsigned char footer[6];
+    char* buffer = (char*)malloc(QUEUE_HASH_BUFFER_SIZE);
+    if (buffer == NULL || pkg->size < (off_t)sizeof(footer) ||
+        pread(fd, footer, sizeof(footer), pkg->size - sizeof(footer)) != sizeof(footer) ||
+        package_digest_init(&pkg->digest, pkg->size, footer) != 0) {
+        free(buffer);
+        close(fd);
+        return NULL;
+    }
+
+    ssize_t n;
+    while ((n = TEMP_FAILURE_RETRY(read(fd, buffer, QUEUE_HASH_BUFFER_SIZE))) > 0) {
+        package_digest_update(&pkg->digest, buffer, n);
+        off_t done = __atomic_add_fetch(&queue_hashed_bytes, n, __ATOMIC_RELAXED);
+        ui->SetProgress(done / (double)queue_total_bytes);
+    }
+    package_digest_final(&pkg->digest);
+
+    free(buffer);
+    close(fd);
+    return NULL;
+}
+
+static void
+log_install_result(FILE* install_log, const char* path, int result)
+{
+    if (install_log) {
+        fputs(path, install_log);
+        fputc('\n', install_log);
+        fputc(result == INSTALL_SUCCESS ? '1' : '0', install_log);
+        fputc('\n', install_log);
+    }
+}
+
+int
+install_packages(const char** paths, int count, int* wipe_cache, const char* install_file,
+                 const PackageDigest* digests)
+{
+    if (count == 1) {
+        return install_package_with_digest(paths[0], wipe_cache, install_file,
+                                           digests, true);
+    }
+
+    FILE* install_log = fopen_path(install_file, "w");
+    if (!install_log) {
+        LOGE("failed to open last_install: %s\n", strerror(errno));
+    }
+
+    *wipe_cache = 0;
+    int result = INSTALL_SUCCESS;
+    int i;
+    queued_package* pkgs = (queued_package*)calloc(count, sizeof(queued_package));
+
+    if (setup_install_mounts() != 0) {
+        LOGE("failed to set up expected mounts for install; aborting\n");
+        result = INSTALL_ERROR;
+        goto done;
+    }
+
+    ui->SetBackground(RecoveryUI::INSTALLING_UPDATE);
+    ui->SetProgressType(RecoveryUI::DETERMINATE);
+    ui->ShowProgress(VERIFICATION_PROGRESS_FRACTION, 0);
+
+    preload_keys();
+    if (loaded_keys == NULL) {
+        LOGE("Failed to load keys\n");
+        result = INSTALL_CORRUPT;
+        goto done;
+    }
+
+    set_perf_mode(true);
+
+    queue_total_bytes = 0;
+    queue_hashed_bytes = 0;
+    for (i = 0; i < count; ++i) {
+        char new_path[PATH_MAX];
+        strlcpy(pkgs[i].path, resolve_package_path(paths[i], new_path), PATH_MAX);
+        LOGI("Update location: %s\n", pkgs[i].path);
+
+        struct stat st;
+        if (ensure_path_mounted(pkgs[i].path) != 0 || stat(pkgs[i].path, &st) != 0) {
+            LOGE("Can't open %s\n", pkgs[i].path);
+            result = INSTALL_CORRUPT;
+            goto done;
+        }
+        pkgs[i].size = st.st_size;
+        queue_total_bytes += st.st_size;
+    }
+
+    // Every package is checked before any is installed.
+    ui->Print("Verifying %d update packages...\n", count);
+    for (i = 0; i < count; ++i) {
+        if (digests) {
+            pkgs[i].digest = digests[i];
+            continue;
+        }
+        pkgs[i].started =
+            pthread_create(&pkgs[i].thread, NULL, hash_package_thread, &pkgs[i]) == 0;
+        if (!pkgs[i].started) hash_package_thread(&pkgs[i]);
+    }
+    for (i = 0; i < count; ++i) {
+        if (pkgs[i].started) pthread_join(pkgs[i].thread, NULL);
+    }
+    for (i = 0; i < count; ++i) {
+        int err = verify_file(pkgs[i].path, loaded_keys, num_loaded_keys, &pkgs[i].digest);
+        LOGI("verify_file returned %d for %s\n", err, pkgs[i].path);
+        if (err != VERIFY_SUCCESS) {
+            LOGE("signature verification failed\n(%s)\n", pkgs[i].path);
+            result = INSTALL_CORRUPT;
+            goto done;
+        }
+    }
+
+    // The mounts are set up once for the whole queue; only the volume
+    // each package is on needs checking, in case the last one's script
+    // unmounted it.
+    binary_extracted = false;
+    for (i = 0; i < count && result == INSTALL_SUCCESS; ++i) {
+        ui->Print("Installing update %d of %d...\n", i + 1, count);
+
+        ZipArchive zip;
+        int err;
+        if (ensure_path_mounted(pkgs[i].path) != 0) {
+            LOGE("Can't mount %s\n", pkgs[i].path);
+            result = INSTALL_CORRUPT;
+        } else if (!digests && i > 0 &&
+                   (err = verify_file(pkgs[i].path, loaded_keys, num_loaded_keys)) !=
+                           VERIFY_SUCCESS) {
+            // The packages ahead of it have run since it was checked.
+            LOGE("signature verification failed\n(%s)\n", pkgs[i].path);
+            result = INSTALL_CORRUPT;
+        } else if ((err = mzOpenZipArchive(pkgs[i].path, &zip)) != 0) {
+            LOGE("Can't open %s\n(%s)\n", pkgs[i].path, err != -1 ? strerror(err) : "bad");
+            result = INSTALL_CORRUPT;
+        } else {
+            int wipe = 0;
+            result = try_update_binary(pkgs[i].path, &zip, &wipe,
+                                       (1 - VERIFICATION_PROGRESS_FRACTION) / count, true);
+            if (wipe) *wipe_cache = 1;
+        }
+        log_install_result(install_log, paths[i], result);
+    }
+    binary_extracted = false;
+
+done:
+    set_perf_mode(false);
+    free(pkgs);
+    if (install_log) {
+        if (result != INSTALL_SUCCESS && ftell(install_log) == 0) {
+            log_install_result(install_log, paths[0], result);
+        }
+        fclose(install_log);
+    }
+    return result;
+}
+
 void
 set_perf_mode(bool enable) {
     property_set("recovery.perf.mode", enable ? "1" : "0");
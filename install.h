@@ -26,12 +26,43 @@ extern "C" {
 enum { INSTALL_SUCCESS, INSTALL_ERROR, INSTALL_CORRUPT, INSTALL_NONE };
 // Install the package specified by root_path.  If INSTALL_SUCCESS is
 // returned and *wipe_cache is true on exit, caller should wipe the
-// cache partition.
+// cache partition.  needs_mount is false for a package on something
+// that isn't in the fstab (the sideload FUSE mount).
 int install_package(const char *root_path, int* wipe_cache,
-                    const char* install_file);
+                    const char* install_file, bool needs_mount = true);
+
+// Most packages one queued install takes.
+#define MAX_QUEUED_PACKAGES 16
+
+struct PackageDigest;
+
+// Install several packages in order, stopping at the first failure.
+// All of them are verified (in parallel) before any is installed, the
+// mounts are set up once, and an update binary identical to the
+// previous package's is not extracted again.  *wipe_cache is set if
+// any package asked for it.
+//
+// 'digests', if given, has one per package, taken while copying it
+// somewhere private (see verifier.h); otherwise a package could change
+// while the ones ahead of it install, so each is verified again right
+// before its own install.
+int install_packages(const char** paths, int count, int* wipe_cache,
+                     const char* install_file,
+                     const struct PackageDigest* digests = NULL);
+
+// As install_package, for a package already hashed on its way in (see
+// verifier.h), which verification then needn't read again.
+int install_package_with_digest(const char *root_path, int* wipe_cache,
+                                const char* install_file,
+                                const struct PackageDigest* digest,
+                                bool needs_mount = true);
 
 void set_perf_mode(bool enable);
 
+// Parse the keys packages are verified against, ahead of the first
+// install.  Safe to call from any thread.
+void preload_keys();
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log_ring.h"
+
+// Slot i is free for the producer claiming position pos when its seq
+// equals pos, and holds a message for the consumer at position pos when
+// seq equals pos+1.  Consuming hands the slot to position pos+capacity.
+
+LogRing::LogRing(int capacity) :
+    head(0),
+    tail(0),
+    dropped(0) {
+
+    unsigned int n = 1;
+    while (n < (unsigned int) capacity) n <<= 1;
+    mask = n - 1;
+    slots = (Slot*) malloc(n * sizeof(Slot));
+    for (unsigned int i = 0; i < n; ++i) {
+        slots[i].seq = i;
+    }
+}
+
+LogRing::~LogRing() {
+    free(slots);
+}
+
+bool LogRing::Push(const char* msg) {
+    unsigned int pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+    Slot* slot;
+    for (;;) {
+        slot = &slots[pos & mask];
+        unsigned int seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int diff = (int) (seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            // pos now holds the current tail; try again.
+        } else if (diff < 0) {
+            // The consumer hasn't freed this slot yet: the ring is full.
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    strncpy(slot->msg, msg, kMessageSize - 1);
+    slot->msg[kMessageSize - 1] = '\0';
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool LogRing::Pop(char* buf) {
+    Slot* slot = &slots[head & mask];
+    unsigned int seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq != head + 1) return false;
+
+    memcpy(buf, slot->msg, kMessageSize);
+    __atomic_store_n(&slot->seq, head + mask + 1, __ATOMIC_RELEASE);
+    ++head;
+    return true;
+}
+
+unsigned int LogRing::TakeDropped() {
+    return __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+}
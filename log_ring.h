@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RECOVERY_LOG_RING_H
+#define RECOVERY_LOG_RING_H
+
+// Bounded queue of log messages with any number of producers and a
+// single consumer.  Neither side ever takes a lock or blocks: each slot
+// carries a sequence number that tells producers when it's free and the
+// consumer when it's been filled.  When the ring is full new messages
+// are dropped and counted instead of waiting for the consumer.
+class LogRing {
+  public:
+    static const int kMessageSize = 256;
+
+    // 'capacity' is rounded up to a power of two.
+    explicit LogRing(int capacity);
+    ~LogRing();
+
+    // Append a copy of 'msg' (truncated to kMessageSize-1 bytes).
+    // Safe to call from any thread.  Returns false if the ring was full.
+    bool Push(const char* msg);
+
+    // Copy the oldest message into 'buf' (kMessageSize bytes) and
+    // remove it.  Only one thread may consume.  Returns false if empty.
+    bool Pop(char* buf);
+
+    // Messages dropped since the last call.
+    unsigned int TakeDropped();
+
+  private:
+    struct Slot {
+        unsigned int seq;
+        char msg[kMessageSize];
+    };
+
+    Slot* slots;
+    unsigned int mask;
+    unsigned int head;      // next slot to consume (consumer only)
+    unsigned int tail;      // next slot to claim (producers)
+    unsigned int dropped;
+
+    // Disallow copying.
+    LogRing(const LogRing&);
+    LogRing& operator=(const LogRing&);
+};
+
+#endif  // RECOVERY_LOG_RING_H
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log_writer.h"
+
+// Big enough for the update binary's chattiest bursts to go out in a
+// handful of writes.
+static const size_t kLogBufferSize = 16 * 1024;
+
+// How long a message may sit in the buffer before it's written.
+static const int kLogFlushIntervalMs = 200;
+
+static char stdout_buffer[kLogBufferSize];
+
+// The log's descriptor, for the fatal signal handler.
+static int log_fd = -1;
+
+static const int kFatalSignals[] = { SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV };
+static struct sigaction old_actions[sizeof(kFatalSignals) / sizeof(kFatalSignals[0])];
+
+void log_flush() {
+    fflush(stdout);
+}
+
+// stdio may not be used here: the crash may have happened inside it.
+// Whatever is pending sits at the start of our buffer, so it goes out
+// with a plain write().  A line half-formatted at the time of the crash
+// may be cut short.
+static void fatal_signal_handler(int sig) {
+    size_t pending = __fpending(stdout);
+    if (log_fd >= 0 && pending > 0 && pending <= kLogBufferSize) {
+        write(log_fd, stdout_buffer, pending);
+    }
+
+    for (size_t i = 0; i < sizeof(kFatalSignals) / sizeof(kFatalSignals[0]); ++i) {
+        if (kFatalSignals[i] == sig) {
+            sigaction(sig, &old_actions[i], NULL);
+            break;
+        }
+    }
+    raise(sig);
+}
+
+static void* log_writer_thread(void* cookie) {
+    for (;;) {
+        usleep(kLogFlushIntervalMs * 1000);
+        log_flush();
+    }
+    return NULL;
+}
+
+void log_writer_start() {
+    // stderr shares the file with stdout.  With a buffer of its own its
+    // lines would land a whole buffer away from stdout's; unbuffered they
+    // are at most one flush interval ahead.  It carries little anyway.
+    setvbuf(stderr, NULL, _IONBF, 0);
+
+    log_fd = fileno(stdout);
+    setvbuf(stdout, stdout_buffer, _IOFBF, kLogBufferSize);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = fatal_signal_handler;
+    for (size_t i = 0; i < sizeof(kFatalSignals) / sizeof(kFatalSignals[0]); ++i) {
+        sigaction(kFatalSignals[i], &sa, &old_actions[i]);
+    }
+
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, log_writer_thread, NULL) == 0) {
+        pthread_detach(writer);
+    } else {
+        // Without the thread nothing would write a quiet log out.
+        setvbuf(stdout, NULL, _IONBF, 0);
+    }
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RECOVERY_LOG_WRITER_H
+#define RECOVERY_LOG_WRITER_H
+
+// stdout is fully buffered once the log writer is started: messages
+// collect in a fixed buffer, which is written out when it fills, by a
+// background thread a short while after anything was logged, and on
+// fatal signals.  stderr is left unbuffered.  Anything that needs the
+// log to be in the file -- copying it, forking, rebooting -- calls
+// log_flush() first.
+
+// Buffer stdout (already pointed at the log, as is stderr) and start
+// the writer thread.
+void log_writer_start();
+
+// Write out everything logged so far.  Safe from any thread.
+void log_flush();
+
+#endif  // RECOVERY_LOG_WRITER_H
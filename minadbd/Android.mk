@@ -13,6 +13,7 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
 	adb.c \
 	fdevent.c \
+	fuse_sideload.c \
 	transport.c \
 	transport_usb.c \
 	sockets.c \
@@ -23,6 +24,11 @@ LOCAL_SRC_FILES := \
 LOCAL_CFLAGS := -O2 -g -DADB_HOST=0 -Wall -Wno-unused-parameter
 LOCAL_CFLAGS += -D_XOPEN_SOURCE -D_GNU_SOURCE
 
+# Asynchronous FunctionFS I/O; off until it has been run on devices.
+ifeq ($(RECOVERY_USB_FFS_AIO), true)
+    LOCAL_CFLAGS += -DUSB_FFS_AIO
+endif
+
 LOCAL_MODULE := libminadbd
 
 LOCAL_STATIC_LIBRARIES := libcutils libc
@@ -29,7 +29,6 @@
 #include "adb.h"
 #include "../common.h"
 
-#include <private/android_filesystem_config.h>
 
 #if ADB_TRACE
 ADB_MUTEX_DEFINE( D_lock );
@@ -127,19 +126,70 @@ void  adb_trace_init(void)
 }
 
 
+/* Packets are big (MAX_PAYLOAD bytes of data each), so up to
+** APACKET_POOL_SIZE freed ones are kept for reuse instead of going back
+** to malloc for every message.
+*/
+#define APACKET_POOL_SIZE 16
+
+ADB_MUTEX_DEFINE( packet_pool_lock );
+static apacket *packet_pool = NULL;
+static int packet_pool_count = 0;
+
 apacket *get_apacket(void)
 {
-    apacket *p = malloc(sizeof(apacket));
-    if(p == 0) fatal("failed to allocate an apacket");
+    adb_mutex_lock(&packet_pool_lock);
+    apacket *p = packet_pool;
+    if (p != NULL) {
+        packet_pool = p->next;
+        packet_pool_count--;
+    }
+    adb_mutex_unlock(&packet_pool_lock);
+
+    if (p == NULL) {
+        p = malloc(sizeof(apacket));
+        if(p == 0) fatal("failed to allocate an apacket");
+    }
     memset(p, 0, sizeof(apacket) - MAX_PAYLOAD);
     return p;
 }
 
 void put_apacket(apacket *p)
 {
+    adb_mutex_lock(&packet_pool_lock);
+    if (packet_pool_count < APACKET_POOL_SIZE) {
+        p->next = packet_pool;
+        packet_pool = p;
+        packet_pool_count++;
+        p = NULL;
+    }
+    adb_mutex_unlock(&packet_pool_lock);
     free(p);
 }
 
+void negotiate_connection(atransport *t, unsigned version, unsigned maxdata)
+{
+    t->protocol_version = version < A_VERSION ? version : A_VERSION;
+    if (t->protocol_version < A_VERSION_MIN) t->protocol_version = A_VERSION_MIN;
+
+    t->max_payload = maxdata < MAX_PAYLOAD ? maxdata : MAX_PAYLOAD;
+    if (t->max_payload < MAX_PAYLOAD_V1) t->max_payload = MAX_PAYLOAD_V1;
+    D("negotiated version %08x, max payload %zu\n", t->protocol_version, t->max_payload);
+}
+
+size_t get_max_payload(atransport *t)
+{
+    return (t != NULL && t->max_payload) ? t->max_payload : MAX_PAYLOAD_V1;
+}
+
+size_t asocket_max_payload(asocket *s)
+{
+    if (s->peer != NULL && s->peer->transport != NULL) {
+        return get_max_payload(s->peer->transport);
+    }
+    return MAX_PAYLOAD_V1;
+}
+
 void handle_online(void)
 {
     D("adb: online\n");
@@ -219,7 +269,7 @@ static void send_connect(atransport *t)
     cp->msg.command = A_CNXN;
     cp->msg.arg0 = A_VERSION;
     cp->msg.arg1 = MAX_PAYLOAD;
-    snprintf((char*) cp->data, sizeof cp->data, "%s::",
+    snprintf((char*) cp->data, MAX_PAYLOAD_V1, "%s::",
             HOST ? "host" : adb_device_banner);
     cp->msg.data_length = strlen((char*) cp->data) + 1;
     send_packet(cp, t);
@@ -309,6 +359,7 @@ void handle_packet(apacket *p, atransport *t)
             t->connection_state = CS_OFFLINE;
             handle_offline(t);
         }
+        negotiate_connection(t, p->msg.arg0, p->msg.arg1);
         parse_banner((char*) p->data, t);
         handle_online();
         if(!HOST) send_connect(t);
@@ -394,14 +445,7 @@ int adb_main()
         usb_init();
     }
 
-    if (setgid(AID_SHELL) != 0) {
-        LOGE("failed to setgid to shell\n");
-        exit(1);
-    }
-    if (setuid(AID_SHELL) != 0) {
-        LOGE("failed to setuid to shell\n");
-        exit(1);
-    }
+    // Stays root: serving a sideloaded package means mounting it with FUSE.
     LOGE("userid is %d\n", getuid());
 
     LOGE("Event loop starting\n");
@@ -22,7 +22,10 @@
 #include "transport.h"  /* readx(), writex() */
 #include "fdevent.h"
 
-#define MAX_PAYLOAD 4096
+// Hosts that predate A_VERSION_SKIP_CHECKSUM can't take more than
+// MAX_PAYLOAD_V1 per packet; newer ones say how much they take in CNXN.
+#define MAX_PAYLOAD_V1 (4 * 1024)
+#define MAX_PAYLOAD (256 * 1024)
 
 #define A_SYNC 0x434e5953
 #define A_CNXN 0x4e584e43
@@ -31,7 +34,9 @@
 #define A_CLSE 0x45534c43
 #define A_WRTE 0x45545257
 
-#define A_VERSION 0x01000000        // ADB protocol version
+#define A_VERSION_MIN 0x01000000    // ADB protocol version of old hosts
+#define A_VERSION_SKIP_CHECKSUM 0x01000001  // No data_check from here on
+#define A_VERSION 0x01000001        // ADB protocol version
 
 #define ADB_VERSION_MAJOR 1         // Used for help/version information
 #define ADB_VERSION_MINOR 0         // Used for help/version information
@@ -178,6 +183,12 @@ struct atransport
     int connection_state;
     transport_type type;
 
+        /* negotiated in the CNXN handshake; A_VERSION_MIN and
+        ** MAX_PAYLOAD_V1 until then
+        */
+    unsigned protocol_version;
+    size_t max_payload;
+
         /* usb handle or socket fd as needed */
     usb_handle *usb;
     int sfd;
@@ -284,8 +295,17 @@ char * get_log_file_path(const char * log_name);
 apacket *get_apacket(void);
 void put_apacket(apacket *p);
 
+/* protocol version and payload size to use with a host that sent
+** CNXN(version, maxdata)
+*/
+void negotiate_connection(atransport *t, unsigned version, unsigned maxdata);
+
+/* the most data a packet to t (or to s's peer) may carry */
+size_t get_max_payload(atransport *t);
+size_t asocket_max_payload(asocket *s);
+
 int check_header(apacket *p);
-int check_data(apacket *p);
+int check_data(apacket *p, atransport *t);
 
 /* define ADB_TRACE to 1 to enable tracing support, or 0 to disable it */
 
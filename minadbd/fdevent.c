@@ -89,6 +89,9 @@ static void dump_fde(fdevent *fde, const char *info)
 #define FDE_PENDING    0x0200
 #define FDE_CREATED    0x0400
 
+/* the events a backend is asked to watch for */
+#define FDE_WATCHMASK  (FDE_READ | FDE_WRITE | FDE_ERROR)
+
 static void fdevent_plist_enqueue(fdevent *node);
 static void fdevent_plist_remove(fdevent *node);
 static fdevent *fdevent_plist_dequeue(void);
@@ -102,132 +105,118 @@ static fdevent list_pending = {
 static fdevent **fd_table = 0;
 static int fd_table_max = 0;
 
-#ifdef CRAPTASTIC
-//HAVE_EPOLL
+#ifdef __linux__
+#define HAVE_EPOLL 1
+#endif
+
+/* The pieces that differ between the ways of waiting for events. */
+typedef struct {
+    const char *name;
+    int  (*init)(void);
+    void (*connect)(fdevent *fde);
+    void (*disconnect)(fdevent *fde);
+    void (*update)(fdevent *fde, unsigned events);
+    void (*process)(int timeout_ms);
+} fdevent_backend;
+
+static const fdevent_backend *backend = 0;
+static int backend_wanted = FDE_BACKEND_DEFAULT;
+
+#if HAVE_EPOLL
 
 #include <sys/epoll.h>
 
 static int epoll_fd = -1;
 
-static void fdevent_init()
+static int epoll_init(void)
 {
-        /* XXX: what's a good size for the passed in hint? */
-    epoll_fd = epoll_create(256);
-
+    if(epoll_fd >= 0) {
+        adb_close(epoll_fd);
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
     if(epoll_fd < 0) {
-        perror("epoll_create() failed");
-        exit(1);
+        D("epoll_create1() failed: errno=%d\n", errno);
+        return -1;
     }
-
-        /* mark for close-on-exec */
-    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+    return 0;
 }
 
-static void fdevent_connect(fdevent *fde)
+static void epoll_connect(fdevent *fde)
 {
-    struct epoll_event ev;
-
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
-
-#if 0
-    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-        perror("epoll_ctl() failed\n");
-        exit(1);
-    }
-#endif
+    /* added to the epoll set once there are events to watch */
 }
 
-static void fdevent_disconnect(fdevent *fde)
+static void epoll_disconnect(fdevent *fde)
 {
     struct epoll_event ev;
 
-    memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
-    ev.data.ptr = fde;
+    if(!(fde->state & FDE_WATCHMASK)) return;
 
-        /* technically we only need to delete if we
-        ** were actively monitoring events, but let's
-        ** be aggressive and do it anyway, just in case
-        ** something's out of sync
-        */
+    memset(&ev, 0, sizeof(ev));
     epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, &ev);
 }
 
-static void fdevent_update(fdevent *fde, unsigned events)
+static void epoll_update(fdevent *fde, unsigned events)
 {
     struct epoll_event ev;
-    int active;
+    int active, op;
 
-    active = (fde->state & FDE_EVENTMASK) != 0;
+    active = (fde->state & FDE_WATCHMASK) != 0;
 
     memset(&ev, 0, sizeof(ev));
-    ev.events = 0;
     ev.data.ptr = fde;
 
     if(events & FDE_READ) ev.events |= EPOLLIN;
     if(events & FDE_WRITE) ev.events |= EPOLLOUT;
-    if(events & FDE_ERROR) ev.events |= (EPOLLERR | EPOLLHUP);
+    if(events & FDE_ERROR) ev.events |= EPOLLPRI;
 
     fde->state = (fde->state & FDE_STATEMASK) | events;
 
     if(active) {
-            /* we're already active. if we're changing to *no*
-            ** events being monitored, we need to delete, otherwise
-            ** we need to just modify
-            */
-        if(ev.events) {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        } else {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        }
+        op = ev.events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+    } else if(ev.events) {
+        op = EPOLL_CTL_ADD;
     } else {
-            /* we're not active.  if we're watching events, we need
-            ** to add, otherwise we can just do nothing
-            */
-        if(ev.events) {
-            if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fde->fd, &ev)) {
-                perror("epoll_ctl() failed\n");
-                exit(1);
-            }
-        }
+        return;
+    }
+    if(epoll_ctl(epoll_fd, op, fde->fd, &ev)) {
+        FATAL("epoll_ctl(%d) failed on fd %d: errno=%d\n", op, fde->fd, errno);
     }
 }
 
-static void fdevent_process()
+static void epoll_process(int timeout_ms)
 {
     struct epoll_event events[256];
     fdevent *fde;
+    unsigned wanted;
     int i, n;
 
-    n = epoll_wait(epoll_fd, events, 256, -1);
-
+    n = epoll_wait(epoll_fd, events, 256, timeout_ms);
     if(n < 0) {
-        if(errno == EINTR) return;
-        perror("epoll_wait");
-        exit(1);
+        if(errno != EINTR) D("Unexpected epoll_wait() error=%d\n", errno);
+        return;
     }
 
     for(i = 0; i < n; i++) {
         struct epoll_event *ev = events + i;
         fde = ev->data.ptr;
+        wanted = fde->state & FDE_EVENTMASK;
 
-        if(ev->events & EPOLLIN) {
-            fde->events |= FDE_READ;
+        /* Report what select() would have: a hangup or error makes the
+        ** fd readable and writable, and FDE_ERROR is exceptional data.
+        */
+        if(ev->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            fde->events |= wanted & FDE_READ;
         }
-        if(ev->events & EPOLLOUT) {
-            fde->events |= FDE_WRITE;
+        if(ev->events & (EPOLLOUT | EPOLLERR)) {
+            fde->events |= wanted & FDE_WRITE;
         }
-        if(ev->events & (EPOLLERR | EPOLLHUP)) {
-            fde->events |= FDE_ERROR;
+        if(ev->events & EPOLLPRI) {
+            fde->events |= wanted & FDE_ERROR;
         }
+
+        D("got events fde->fd=%d events=%04x, state=%04x\n",
+            fde->fd, fde->events, fde->state);
         if(fde->events) {
             if(fde->state & FDE_PENDING) continue;
             fde->state |= FDE_PENDING;
@@ -236,7 +225,17 @@ static void fdevent_process()
     }
 }
 
-#else /* USE_SELECT */
+static const fdevent_backend epoll_backend = {
+    "epoll",
+    epoll_init,
+    epoll_connect,
+    epoll_disconnect,
+    epoll_update,
+    epoll_process,
+};
+
+#endif /* HAVE_EPOLL */
+
 
 #ifdef HAVE_WINSOCK
 #include <winsock2.h>
@@ -250,21 +249,23 @@ static fd_set error_fds;
 
 static int select_n = 0;
 
-static void fdevent_init(void)
+static int select_init(void)
 {
+    select_n = 0;
     FD_ZERO(&read_fds);
     FD_ZERO(&write_fds);
     FD_ZERO(&error_fds);
+    return 0;
 }
 
-static void fdevent_connect(fdevent *fde)
+static void select_connect(fdevent *fde)
 {
     if(fde->fd >= select_n) {
         select_n = fde->fd + 1;
     }
 }
 
-static void fdevent_disconnect(fdevent *fde)
+static void select_disconnect(fdevent *fde)
 {
     int i, n;
 
@@ -278,7 +279,7 @@ static void fdevent_disconnect(fdevent *fde)
     select_n = n + 1;
 }
 
-static void fdevent_update(fdevent *fde, unsigned events)
+static void select_update(fdevent *fde, unsigned events)
 {
     if(events & FDE_READ) {
         FD_SET(fde->fd, &read_fds);
@@ -362,7 +363,7 @@ int i;
 }
 #endif
 
-static void fdevent_process()
+static void select_process(int timeout_ms)
 {
     int i, n;
     fdevent *fde;
@@ -375,7 +376,14 @@ static void fdevent_process()
 
     dump_all_fds("pre select()");
 
-    n = select(select_n, &rfd, &wfd, &efd, NULL);
+    struct timeval tv, *ptv = NULL;
+    if(timeout_ms >= 0) {
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        ptv = &tv;
+    }
+
+    n = select(select_n, &rfd, &wfd, &efd, ptv);
     int saved_errno = errno;
     D("select() returned n=%d, errno=%d\n", n, n<0?saved_errno:0);
 
@@ -423,7 +431,43 @@ static void fdevent_process()
     }
 }
 
+static const fdevent_backend select_backend = {
+    "select",
+    select_init,
+    select_connect,
+    select_disconnect,
+    select_update,
+    select_process,
+};
+
+static void fdevent_init(void)
+{
+#if HAVE_EPOLL
+    if(backend_wanted != FDE_BACKEND_SELECT && epoll_backend.init() == 0) {
+        backend = &epoll_backend;
+        return;
+    }
+#endif
+    backend = &select_backend;
+    backend->init();
+}
+
+int fdevent_set_backend(int which)
+{
+    int i;
+
+    for(i = 0; i < fd_table_max; i++) {
+        if(fd_table[i] != 0) return -1;
+    }
+#if !HAVE_EPOLL
+    if(which == FDE_BACKEND_EPOLL) return -1;
 #endif
+    backend_wanted = which;
+    fdevent_init();
+    if(which == FDE_BACKEND_EPOLL && backend != &epoll_backend) return -1;
+    D("using the %s backend\n", backend->name);
+    return 0;
+}
 
 static void fdevent_register(fdevent *fde)
 {
@@ -437,7 +481,6 @@ static void fdevent_register(fdevent *fde)
             FATAL("bogus huuuuge fd (%d)\n", fde->fd);
         }
         if(fd_table_max == 0) {
-            fdevent_init();
             fd_table_max = 256;
         }
         while(fd_table_max <= fde->fd) {
@@ -447,7 +490,11 @@ static void fdevent_register(fdevent *fde)
         if(fd_table == 0) {
             FATAL("could not expand fd_table to %d entries\n", fd_table_max);
         }
-        memset(fd_table + oldmax, 0, sizeof(int) * (fd_table_max - oldmax));
+        memset(fd_table + oldmax, 0, sizeof(fdevent*) * (fd_table_max - oldmax));
+    }
+
+    if(backend == 0) {
+        fdevent_init();
     }
 
     fd_table[fde->fd] = fde;
@@ -604,7 +651,7 @@ void fdevent_install(fdevent *fde, int fd, fd_func func, void *arg)
 #endif
     fdevent_register(fde);
     dump_fde(fde, "connect");
-    fdevent_connect(fde);
+    backend->connect(fde);
     fde->state |= FDE_ACTIVE;
 }
 
@@ -615,7 +662,7 @@ void fdevent_remove(fdevent *fde)
     }
 
     if(fde->state & FDE_ACTIVE) {
-        fdevent_disconnect(fde);
+        backend->disconnect(fde);
         dump_fde(fde, "disconnect");
         fdevent_unregister(fde);
     }
@@ -632,7 +679,7 @@ void fdevent_set(fdevent *fde, unsigned events)
     if((fde->state & FDE_EVENTMASK) == events) return;
 
     if(fde->state & FDE_ACTIVE) {
-        fdevent_update(fde, events);
+        backend->update(fde, events);
         dump_fde(fde, "update");
     }
 
@@ -643,7 +690,7 @@ void fdevent_set(fdevent *fde, unsigned events)
             ** we don't signal an event that
             ** is no longer wanted.
             */
-        fde->events &= (~events);
+        fde->events &= events;
         if(fde->events == 0) {
             fdevent_plist_remove(fde);
             fde->state &= (~FDE_PENDING);
@@ -678,18 +725,27 @@ void fdevent_subproc_setup()
     fdevent_add(fde, FDE_READ);
 }
 
-void fdevent_loop()
+void fdevent_loop_once(int timeout_ms)
 {
     fdevent *fde;
-    fdevent_subproc_setup();
 
-    for(;;) {
-        D("--- ---- waiting for events\n");
+    D("--- ---- waiting for events\n");
 
-        fdevent_process();
+    if(backend == 0) {
+        fdevent_init();
+    }
+    backend->process(timeout_ms);
 
-        while((fde = fdevent_plist_dequeue())) {
-            fdevent_call_fdfunc(fde);
-        }
+    while((fde = fdevent_plist_dequeue())) {
+        fdevent_call_fdfunc(fde);
+    }
+}
+
+void fdevent_loop()
+{
+    fdevent_subproc_setup();
+
+    for(;;) {
+        fdevent_loop_once(-1);
     }
 }
@@ -64,6 +64,21 @@ void fdevent_set_timeout(fdevent *fde, int64_t  timeout_ms);
 */
 void fdevent_loop();
 
+/* Wait up to timeout_ms (-1 for no limit) for events, then dispatch
+** them once.
+*/
+void fdevent_loop_once(int timeout_ms);
+
+/* How the loop waits for events: epoll where the kernel has it,
+** otherwise select().  Can only change while no fdevent is installed;
+** returns -1 if it can't, or if the backend asked for is unavailable.
+*/
+#define FDE_BACKEND_DEFAULT   0
+#define FDE_BACKEND_EPOLL     1
+#define FDE_BACKEND_SELECT    2
+
+int fdevent_set_backend(int backend);
+
 struct fdevent 
 {
     fdevent *next;
@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* A minimal FUSE filesystem with two files in its root:
+**
+**   package.zip   the sideloaded package, read-only.  Reads are served
+**                 from a small cache of blocks, fetched from the
+**                 provider (for adb, the host) on a miss.
+**
+**   exit          stat()ing it unmounts the filesystem and returns from
+**                 run_fuse_sideload().
+**
+** The first copy of every block is hashed, and the hash kept for as long
+** as the package is mounted.  A block fetched again (after falling out
+** of the cache) must hash the same, so the host can't hand the installer
+** different data from what the signature check read.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/fuse.h>
+
+#include "mincrypt/sha256.h"
+#include "fuse_sideload.h"
+
+#define PACKAGE_FILE_ID   (FUSE_ROOT_ID + 1)
+#define EXIT_FLAG_ID      (FUSE_ROOT_ID + 2)
+
+#define NO_STATUS         1
+#define NO_STATUS_EXIT    2
+
+// Largest read the kernel will ask for, and the blocks kept in memory
+// to serve them (a block lives in slot block % SIDELOAD_CACHE_BLOCKS).
+#define SIDELOAD_MAX_READ       (128 * 1024)
+#define SIDELOAD_CACHE_BLOCKS   16
+
+#define NO_BLOCK                0xffffffffu
+
+#ifndef FUSE_MIN_READ_BUFFER
+#define FUSE_MIN_READ_BUFFER    8192
+#endif
+
+struct fuse_data {
+    int ffd;                    // /dev/fuse
+
+    struct provider_vtab *vtab;
+    void *cookie;
+
+    uint64_t file_size;
+    uint32_t block_size;
+    uint32_t file_blocks;
+
+    uid_t uid;
+    gid_t gid;
+
+    uint8_t *cache;
+    uint32_t cached[SIDELOAD_CACHE_BLOCKS];
+
+    uint8_t *hashes;            // SHA256_DIGEST_SIZE per block
+    uint8_t *hashed;            // bitmap of blocks with a hash
+
+    uint8_t *reply;             // SIDELOAD_MAX_READ bytes
+
+    uint32_t fetches;
+    uint32_t refetches;
+};
+
+static void fuse_reply(struct fuse_data *fd, uint64_t unique, const void *data, size_t len)
+{
+    struct fuse_out_header hdr;
+    struct iovec vec[2];
+
+    hdr.len = len + sizeof(hdr);
+    hdr.error = 0;
+    hdr.unique = unique;
+
+    vec[0].iov_base = &hdr;
+    vec[0].iov_len = sizeof(hdr);
+    vec[1].iov_base = (void *) data;
+    vec[1].iov_len = len;
+
+    if (writev(fd->ffd, vec, 2) < 0) {
+        fprintf(stderr, "fuse: reply to %llu failed: %s\n",
+                (unsigned long long) unique, strerror(errno));
+    }
+}
+
+static void fuse_status(struct fuse_data *fd, uint64_t unique, int err)
+{
+    struct fuse_out_header hdr;
+
+    hdr.len = sizeof(hdr);
+    hdr.error = err;
+    hdr.unique = unique;
+    if (write(fd->ffd, &hdr, sizeof(hdr)) < 0) {
+        fprintf(stderr, "fuse: status for %llu failed: %s\n",
+                (unsigned long long) unique, strerror(errno));
+    }
+}
+
+static void fill_attr(struct fuse_attr *attr, struct fuse_data *fd,
+                      uint64_t nodeid, uint64_t size, uint32_t mode)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->ino = nodeid;
+    attr->size = size;
+    attr->blocks = (size + 511) / 512;
+    attr->mode = mode;
+    attr->nlink = 1;
+    attr->uid = fd->uid;
+    attr->gid = fd->gid;
+    attr->blksize = fd->block_size;
+}
+
+static int attr_for(struct fuse_data *fd, uint64_t nodeid, struct fuse_attr *attr)
+{
+    switch (nodeid) {
+    case FUSE_ROOT_ID:
+        fill_attr(attr, fd, nodeid, 4096, S_IFDIR | 0555);
+        return 0;
+    case PACKAGE_FILE_ID:
+        fill_attr(attr, fd, nodeid, fd->file_size, S_IFREG | 0444);
+        return 0;
+    case EXIT_FLAG_ID:
+        fill_attr(attr, fd, nodeid, 0, S_IFREG);
+        return 0;
+    }
+    return -ENOENT;
+}
+
+static int handle_init(struct fuse_data *fd, const struct fuse_in_header *hdr, const void *data)
+{
+    const struct fuse_init_in *req = data;
+    struct fuse_init_out out;
+    size_t len;
+
+    // 7.9 is where fuse_attr reached its current size.
+    if (req->major != FUSE_KERNEL_VERSION || req->minor < 9) {
+        fprintf(stderr, "fuse: unsupported kernel protocol %u.%u\n", req->major, req->minor);
+        return -EPROTO;
+    }
+
+    memset(&out, 0, sizeof(out));
+    out.major = FUSE_KERNEL_VERSION;
+    out.minor = FUSE_KERNEL_MINOR_VERSION;
+    out.max_readahead = req->max_readahead;
+    out.max_background = 32;
+    out.congestion_threshold = 32;
+    out.max_write = 4096;
+
+    // Kernels before 7.23 expect the original 24 byte reply.
+    len = (req->minor < 23) ? 24 : sizeof(out);
+    fuse_reply(fd, hdr->unique, &out, len);
+    return NO_STATUS;
+}
+
+static int handle_getattr(struct fuse_data *fd, const struct fuse_in_header *hdr)
+{
+    struct fuse_attr_out out;
+    int result;
+
+    memset(&out, 0, sizeof(out));
+    out.attr_valid = 10;
+    result = attr_for(fd, hdr->nodeid, &out.attr);
+    if (result < 0) return result;
+
+    fuse_reply(fd, hdr->unique, &out, sizeof(out));
+    return NO_STATUS;
+}
+
+static int handle_lookup(struct fuse_data *fd, const struct fuse_in_header *hdr, const char *name)
+{
+    struct fuse_entry_out out;
+
+    if (hdr->nodeid != FUSE_ROOT_ID) return -ENOENT;
+
+    if (strcmp(name, FUSE_SIDELOAD_HOST_EXIT_FLAG) == 0) {
+        fuse_status(fd, hdr->unique, -ENOENT);
+        return NO_STATUS_EXIT;
+    }
+    if (strcmp(name, FUSE_SIDELOAD_HOST_FILENAME) != 0) return -ENOENT;
+
+    memset(&out, 0, sizeof(out));
+    out.nodeid = PACKAGE_FILE_ID;
+    out.generation = PACKAGE_FILE_ID;
+    out.entry_valid = 10;
+    out.attr_valid = 10;
+    attr_for(fd, PACKAGE_FILE_ID, &out.attr);
+
+    fuse_reply(fd, hdr->unique, &out, sizeof(out));
+    return NO_STATUS;
+}
+
+static int handle_open(struct fuse_data *fd, const struct fuse_in_header *hdr, const void *data)
+{
+    const struct fuse_open_in *req = data;
+    struct fuse_open_out out;
+
+    if (hdr->nodeid != PACKAGE_FILE_ID) return -ENOENT;
+    if ((req->flags & O_ACCMODE) != O_RDONLY) return -EROFS;
+
+    memset(&out, 0, sizeof(out));
+    out.fh = PACKAGE_FILE_ID;
+    fuse_reply(fd, hdr->unique, &out, sizeof(out));
+    return NO_STATUS;
+}
+
+static int set_bit(uint8_t *bits, uint32_t n)
+{
+    int was = (bits[n / 8] >> (n % 8)) & 1;
+    bits[n / 8] |= 1 << (n % 8);
+    return was;
+}
+
+/* Returns the contents of 'block', fetching it if it isn't cached, or
+** NULL if it can't be fetched or doesn't match its first copy.
+*/
+static const uint8_t *fetch_block(struct fuse_data *fd, uint32_t block)
+{
+    int slot = block % SIDELOAD_CACHE_BLOCKS;
+    uint8_t *buf = fd->cache + (size_t) slot * fd->block_size;
+    uint8_t *hash = fd->hashes + (size_t) block * SHA256_DIGEST_SIZE;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint32_t fetch_size;
+
+    if (fd->cached[slot] == block) return buf;
+    fd->cached[slot] = NO_BLOCK;
+
+    fetch_size = fd->block_size;
+    if ((uint64_t) block * fd->block_size + fetch_size > fd->file_size) {
+        fetch_size = fd->file_size - (uint64_t) block * fd->block_size;
+    }
+    if (fd->vtab->read_block(fd->cookie, block, buf, fetch_size) != 0) {
+        fprintf(stderr, "fuse: failed to fetch block %u\n", block);
+        return NULL;
+    }
+
+    SHA256_hash(buf, fetch_size, digest);
+    if (set_bit(fd->hashed, block)) {
+        fd->refetches++;
+        if (memcmp(hash, digest, SHA256_DIGEST_SIZE) != 0) {
+            fprintf(stderr, "fuse: block %u changed since it was first read\n", block);
+            return NULL;
+        }
+    } else {
+        fd->fetches++;
+        memcpy(hash, digest, SHA256_DIGEST_SIZE);
+    }
+
+    fd->cached[slot] = block;
+    return buf;
+}
+
+static int handle_read(struct fuse_data *fd, const struct fuse_in_header *hdr, const void *data)
+{
+    const struct fuse_read_in *req = data;
+    uint64_t offset = req->offset;
+    uint32_t size = req->size;
+    uint32_t done = 0;
+
+    if (hdr->nodeid != PACKAGE_FILE_ID) return -ENOENT;
+
+    if (offset >= fd->file_size) size = 0;
+    else if (size > fd->file_size - offset) size = fd->file_size - offset;
+    if (size > SIDELOAD_MAX_READ) size = SIDELOAD_MAX_READ;
+
+    while (done < size) {
+        uint32_t block = (offset + done) / fd->block_size;
+        uint32_t skip = (offset + done) % fd->block_size;
+        uint32_t n = fd->block_size - skip;
+        const uint8_t *buf = fetch_block(fd, block);
+
+        if (buf == NULL) return -EIO;
+        if (n > size - done) n = size - done;
+        memcpy(fd->reply + done, buf + skip, n);
+        done += n;
+    }
+
+    fuse_reply(fd, hdr->unique, fd->reply, size);
+    return NO_STATUS;
+}
+
+int run_fuse_sideload(struct provider_vtab *vtab, void *cookie,
+                      uint64_t file_size, uint32_t block_size)
+{
+    struct fuse_data fd;
+    uint8_t request[FUSE_MIN_READ_BUFFER + PATH_MAX];
+    char opts[256];
+    int result = -1;
+    int i;
+
+    if (block_size < 1024 || block_size > (1 << 22)) {
+        fprintf(stderr, "fuse: invalid block size %u\n", block_size);
+        return -1;
+    }
+    if (file_size == 0 || (file_size - 1) / block_size >= NO_BLOCK) {
+        fprintf(stderr, "fuse: invalid file size %llu\n", (unsigned long long) file_size);
+        return -1;
+    }
+
+    memset(&fd, 0, sizeof(fd));
+    fd.ffd = -1;
+    fd.vtab = vtab;
+    fd.cookie = cookie;
+    fd.file_size = file_size;
+    fd.block_size = block_size;
+    fd.file_blocks = (file_size - 1) / block_size + 1;
+    fd.uid = getuid();
+    fd.gid = getgid();
+    for (i = 0; i < SIDELOAD_CACHE_BLOCKS; ++i) {
+        fd.cached[i] = NO_BLOCK;
+    }
+
+    fd.cache = malloc((size_t) block_size * SIDELOAD_CACHE_BLOCKS);
+    fd.hashes = malloc((size_t) fd.file_blocks * SHA256_DIGEST_SIZE);
+    fd.hashed = calloc(1, fd.file_blocks / 8 + 1);
+    fd.reply = malloc(SIDELOAD_MAX_READ);
+    if (fd.cache == NULL || fd.hashes == NULL || fd.hashed == NULL || fd.reply == NULL) {
+        fprintf(stderr, "fuse: failed to allocate buffers for %u blocks\n", fd.file_blocks);
+        goto done;
+    }
+
+    if (mkdir(FUSE_SIDELOAD_HOST_MOUNTPOINT, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "fuse: can't create %s: %s\n", FUSE_SIDELOAD_HOST_MOUNTPOINT,
+                strerror(errno));
+        goto done;
+    }
+    fd.ffd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+    if (fd.ffd < 0) {
+        fprintf(stderr, "fuse: can't open /dev/fuse: %s\n", strerror(errno));
+        goto done;
+    }
+    snprintf(opts, sizeof(opts),
+             "fd=%d,user_id=%d,group_id=%d,max_read=%u,allow_other,rootmode=040000",
+             fd.ffd, fd.uid, fd.gid, SIDELOAD_MAX_READ);
+    if (mount("/dev/fuse", FUSE_SIDELOAD_HOST_MOUNTPOINT, "fuse",
+              MS_NOSUID | MS_NODEV | MS_RDONLY | MS_NOEXEC, opts) < 0) {
+        fprintf(stderr, "fuse: mount failed: %s\n", strerror(errno));
+        goto done;
+    }
+
+    for (;;) {
+        ssize_t len = read(fd.ffd, request, sizeof(request));
+        const struct fuse_in_header *hdr = (const struct fuse_in_header *) request;
+        const void *data = request + sizeof(*hdr);
+
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            if (errno != ENODEV) {
+                fprintf(stderr, "fuse: read failed: %s\n", strerror(errno));
+            }
+            result = -1;
+            break;
+        }
+        if ((size_t) len < sizeof(*hdr)) {
+            fprintf(stderr, "fuse: short request (%d bytes)\n", (int) len);
+            continue;
+        }
+
+        switch (hdr->opcode) {
+        case FUSE_INIT:    result = handle_init(&fd, hdr, data);               break;
+        case FUSE_LOOKUP:  result = handle_lookup(&fd, hdr, (const char *) data); break;
+        case FUSE_GETATTR: result = handle_getattr(&fd, hdr);                  break;
+        case FUSE_OPEN:    result = handle_open(&fd, hdr, data);               break;
+        case FUSE_READ:    result = handle_read(&fd, hdr, data);               break;
+        case FUSE_FLUSH:
+        case FUSE_RELEASE: result = 0;                                          break;
+        case FUSE_FORGET:
+        case FUSE_INTERRUPT: result = NO_STATUS;                               break;
+        default:           result = -ENOSYS;                                   break;
+        }
+
+        if (result == NO_STATUS_EXIT) {
+            result = 0;
+            break;
+        }
+        if (result != NO_STATUS) {
+            fuse_status(&fd, hdr->unique, result);
+        }
+    }
+
+    fprintf(stderr, "fuse: %u of %u blocks fetched, %u fetched again\n",
+            fd.fetches, fd.file_blocks, fd.refetches);
+
+done:
+    fd.vtab->close(fd.cookie);
+    if (fd.ffd >= 0) {
+        umount2(FUSE_SIDELOAD_HOST_MOUNTPOINT, MNT_DETACH);
+        close(fd.ffd);
+    }
+    free(fd.cache);
+    free(fd.hashes);
+    free(fd.hashed);
+    free(fd.reply);
+    return result;
+}
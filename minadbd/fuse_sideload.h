@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __FUSE_SIDELOAD_H
+#define __FUSE_SIDELOAD_H
+
+#include <stdint.h>
+
+/* A sideloaded package served a block at a time, as a read-only file on
+** a FUSE filesystem.  Only blocks being read are held in memory; each
+** one is hashed the first time it arrives, and later copies must match,
+** so what gets installed is what was verified.
+*/
+#define FUSE_SIDELOAD_HOST_MOUNTPOINT    "/sideload"
+#define FUSE_SIDELOAD_HOST_FILENAME      "package.zip"
+#define FUSE_SIDELOAD_HOST_PATHNAME      (FUSE_SIDELOAD_HOST_MOUNTPOINT "/" FUSE_SIDELOAD_HOST_FILENAME)
+
+/* stat()ing this tells the provider the package is no longer needed. */
+#define FUSE_SIDELOAD_HOST_EXIT_FLAG     "exit"
+#define FUSE_SIDELOAD_HOST_EXIT_PATHNAME (FUSE_SIDELOAD_HOST_MOUNTPOINT "/" FUSE_SIDELOAD_HOST_EXIT_FLAG)
+
+struct provider_vtab {
+    /* Fill 'buffer' with 'fetch_size' bytes of block 'block'.  Returns 0
+    ** on success.
+    */
+    int (*read_block)(void *cookie, uint32_t block, uint8_t *buffer, uint32_t fetch_size);
+
+    /* Called once the package has been released. */
+    void (*close)(void *cookie);
+};
+
+/* Mount the package and serve it until the exit flag is stat()ed or the
+** provider fails.  Returns 0 on a clean exit.
+*/
+int run_fuse_sideload(struct provider_vtab *vtab, void *cookie,
+                      uint64_t file_size, uint32_t block_size);
+
+#endif
@@ -16,12 +16,15 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 
 #include "sysdeps.h"
 #include "fdevent.h"
+#include "fuse_sideload.h"
 
 #define  TRACE_TAG  TRACE_SERVICES
 #include "adb.h"
@@ -43,10 +46,83 @@ void *service_bootstrap_func(void *x)
     return 0;
 }
 
+// Sideloaded packages can be gigabytes; move them in big pieces so the
+// copy isn't bound by syscalls.
+#define SIDELOAD_BUFFER_SIZE (1024 * 1024)
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// Move up to *count bytes from socket s to fd with splice() through a
+// pipe, without copying them through user space.  Returns 0 when done
+// or on error (with *count the bytes not moved), or -1 if the kernel
+// can't splice from s, before anything was read.
+static int sideload_splice(int s, int fd, unsigned *count)
+{
+    int p[2];
+    int result = 0;
+
+    if (pipe(p) < 0) return -1;
+    fcntl(p[1], F_SETPIPE_SZ, SIDELOAD_BUFFER_SIZE);
+
+    while (*count > 0) {
+        unsigned want = (*count > SIDELOAD_BUFFER_SIZE) ? SIDELOAD_BUFFER_SIZE : *count;
+        ssize_t in = splice(s, NULL, p[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in < 0 && errno == EINTR) continue;
+        if (in < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            // Only possible on the first call; nothing has been read.
+            result = -1;
+            break;
+        }
+        if (in <= 0) break;
+
+        while (in > 0) {
+            ssize_t out = splice(p[0], NULL, fd, NULL, in, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) goto done;
+            in -= out;
+            *count -= out;
+        }
+    }
+
+done:
+    adb_close(p[0]);
+    adb_close(p[1]);
+    return result;
+}
+
+static void sideload_copy(int s, int fd, unsigned *count)
+{
+    unsigned char *buf = malloc(SIDELOAD_BUFFER_SIZE);
+    if (buf == NULL) {
+        fprintf(stderr, "failed to allocate sideload buffer\n");
+        return;
+    }
+
+    while (*count > 0) {
+        unsigned want = (*count > SIDELOAD_BUFFER_SIZE) ? SIDELOAD_BUFFER_SIZE : *count;
+        int r = adb_read(s, buf, want);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        if (writex(fd, buf, r)) break;
+        *count -= r;
+    }
+    free(buf);
+}
+
 static void sideload_service(int s, void *cookie)
 {
-    unsigned char buf[4096];
-    unsigned count = (unsigned)(uintptr_t)cookie;
+    unsigned size = (unsigned)(uintptr_t)cookie;
+    unsigned count = size;
+    const char *method = "splice";
     int fd;
 
     fprintf(stderr, "sideload_service invoked\n");
@@ -58,12 +134,15 @@ static void sideload_service(int s, void *cookie)
         return;
     }
 
-    while(count > 0) {
-        unsigned xfer = (count > 4096) ? 4096 : count;
-        if(readx(s, buf, xfer)) break;
-        if(writex(fd, buf, xfer)) break;
-        count -= xfer;
+    double start = now_sec();
+    if (sideload_splice(s, fd, &count) < 0) {
+        method = "copy";
+        sideload_copy(s, fd, &count);
     }
+    double elapsed = now_sec() - start;
+    unsigned moved = size - count;
+    fprintf(stderr, "sideload: %u bytes in %.2f s (%.1f MB/s, %s)\n", moved, elapsed,
+            elapsed > 0 ? moved / elapsed / (1024 * 1024) : 0.0, method);
 
     if(count == 0) {
         writex(s, "OKAY", 4);
@@ -80,6 +159,64 @@ static void sideload_service(int s, void *cookie)
     }
 }
 
+// The host serves the package a block at a time: we send it the block
+// number as 8 decimal digits, and it replies with the block.
+struct adb_data {
+    int sfd;
+    uint32_t block_size;
+};
+
+static int read_block_adb(void *cookie, uint32_t block, uint8_t *buffer, uint32_t fetch_size)
+{
+    struct adb_data *ad = cookie;
+    char buf[10];
+
+    snprintf(buf, sizeof(buf), "%08u", block);
+    if (writex(ad->sfd, buf, 8)) {
+        fprintf(stderr, "failed to request block %u\n", block);
+        return -EIO;
+    }
+    if (readx(ad->sfd, buffer, fetch_size)) {
+        fprintf(stderr, "failed to read block %u\n", block);
+        return -EIO;
+    }
+    return 0;
+}
+
+static void close_adb(void *cookie)
+{
+    struct adb_data *ad = cookie;
+    writex(ad->sfd, "DONEDONE", 8);
+}
+
+static struct provider_vtab adb_vtab = {
+    read_block_adb,
+    close_adb,
+};
+
+static void sideload_host_service(int sfd, void *cookie)
+{
+    char *args = cookie;
+    char *saveptr;
+    char *size = strtok_r(args, ":", &saveptr);
+    char *block = strtok_r(NULL, ":", &saveptr);
+    struct adb_data ad;
+    int result;
+
+    ad.sfd = sfd;
+    ad.block_size = block ? strtoul(block, NULL, 10) : 0;
+    uint64_t file_size = size ? strtoull(size, NULL, 10) : 0;
+    free(args);
+
+    fprintf(stderr, "sideload-host: %llu bytes in blocks of %u\n",
+            (unsigned long long) file_size, ad.block_size);
+    result = run_fuse_sideload(&adb_vtab, &ad, file_size, ad.block_size);
+    adb_close(sfd);
+
+    fprintf(stderr, "sideload-host finished (%d)\n", result);
+    sleep(1);
+    exit(result == 0 ? 0 : 1);
+}
 
 #if 0
 static void echo_service(int fd, void *cookie)
@@ -148,7 +285,12 @@ int service_to_fd(const char *name)
 {
     int ret = -1;
 
-    if (!strncmp(name, "sideload:", 9)) {
+    if (!strncmp(name, "sideload-host:", 14)) {
+        char *args = strdup(name + 14);
+        if (args == NULL) fatal("cannot allocate sideload-host args");
+        ret = create_service_thread(sideload_host_service, args);
+        if (ret < 0) free(args);
+    } else if (!strncmp(name, "sideload:", 9)) {
         ret = create_service_thread(sideload_service, (void*)(uintptr_t)atoi(name + 9));
 #if 0
     } else if(!strncmp(name, "echo:", 5)){
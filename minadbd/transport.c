@@ -217,11 +217,16 @@ void send_packet(apacket *p, atransport *t)
 
     p->msg.magic = p->msg.command ^ 0xffffffff;
 
-    count = p->msg.data_length;
-    x = (unsigned char *) p->data;
+    // Hosts that know A_VERSION_SKIP_CHECKSUM ignore data_check, but
+    // CNXN goes out before the host knows which version we settled on.
     sum = 0;
-    while(count-- > 0){
-        sum += *x++;
+    if (t == NULL || t->protocol_version < A_VERSION_SKIP_CHECKSUM ||
+        p->msg.command == A_CNXN) {
+        count = p->msg.data_length;
+        x = (unsigned char *) p->data;
+        while(count-- > 0){
+            sum += *x++;
+        }
     }
     p->msg.data_check = sum;
 
@@ -681,6 +686,8 @@ retry:
 void register_usb_transport(usb_handle *usb, const char *serial, unsigned writeable)
 {
     atransport *t = calloc(1, sizeof(atransport));
+    t->protocol_version = A_VERSION_MIN;
+    t->max_payload = MAX_PAYLOAD_V1;
     D("transport: %p init'ing for usb_handle %p (sn='%s')\n", t, usb,
       serial ? serial : "");
     init_usb_transport(t, usb, (writeable ? CS_OFFLINE : CS_NOPERM));
@@ -783,11 +790,15 @@ int check_header(apacket *p)
     return 0;
 }
 
-int check_data(apacket *p)
+int check_data(apacket *p, atransport *t)
 {
     unsigned count, sum;
     unsigned char *x;
 
+    if (t->protocol_version >= A_VERSION_SKIP_CHECKSUM) {
+        return 0;
+    }
+
     count = p->msg.data_length;
     x = p->data;
     sum = 0;
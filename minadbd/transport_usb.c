@@ -67,7 +67,7 @@ static int remote_read(apacket *p, atransport *t)
         }
     }
 
-    if(check_data(p)) {
+    if(check_data(p, t)) {
         D("remote usb: check_data failed\n");
         return -1;
     }
@@ -19,9 +19,14 @@
 #include <unistd.h>
 #include <string.h>
 
+#include <linux/aio_abi.h>
 #include <linux/usb/ch9.h>
 #include <linux/usb/functionfs.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
@@ -34,6 +39,46 @@
 #define MAX_PACKET_SIZE_FS	64
 #define MAX_PACKET_SIZE_HS	512
 
+// The f_adb driver fails reads of more than 4 KB, and some FunctionFS
+// kernels can't allocate buffers for very large transfers, so packets
+// bigger than that are moved in pieces.
+#define USB_ADB_MAX_READ	4096
+#define USB_FFS_MAX_IO		16384
+
+// Bulk transfers kept in flight on each FunctionFS endpoint for a large
+// packet, so the host never finds the pipe idle between them.
+#define USB_FFS_NUM_AIO		4
+
+// Reads of one USB packet each kept queued on bulk-out between packets.
+#define USB_FFS_READ_AHEAD	4
+
+#define USB_FFS_NUM_SLOTS	(USB_FFS_NUM_AIO + USB_FFS_READ_AHEAD)
+
+// Asynchronous I/O on one FunctionFS endpoint (built with USB_FFS_AIO).
+// Completions are signalled on 'eventfd', which a kick also writes to so
+// a waiter gives up.  Only the thread doing the I/O touches the context:
+// it's the one that sees a kick and throws away what was queued for the
+// old connection.
+struct ffs_aio {
+    aio_context_t ctx;
+    int eventfd;
+    volatile int kicked;
+
+    struct iocb iocbs[USB_FFS_NUM_SLOTS];
+    int pending[USB_FFS_NUM_SLOTS];   // submitted, completion not reaped
+    long result[USB_FFS_NUM_SLOTS];   // once reaped: bytes, or -errno
+    int probed;                       // a submit has worked, so AIO does
+
+    // Reads only: a ring of transfers, 'queued' of them from 'head' in
+    // the order they were submitted, and how far the caller got into
+    // the first.
+    char *bufs[USB_FFS_NUM_SLOTS];
+    int head;
+    int queued;
+    long offset;
+    int maxpacket;                    // bulk-out's packet size, 0 if unknown
+};
+
 #define cpu_to_le16(x)  htole16(x)
 #define cpu_to_le32(x)  htole32(x)
 
@@ -50,6 +95,9 @@ struct usb_handle
     int control;
     int bulk_out; /* "out" from the host's perspective => source for adbd */
     int bulk_in;  /* "in" from the host's perspective => sink for adbd */
+
+    struct ffs_aio *read_aio;  /* NULL if not built with or no kernel AIO; */
+    struct ffs_aio *write_aio; /* kept, disabled, if the endpoints refuse it */
 };
 
 static const struct {
@@ -204,11 +252,16 @@ static int usb_adb_read(usb_handle *h, void *data, int len)
     int n;
 
     D("about to read (fd=%d, len=%d)\n", h->fd, len);
-    n = adb_read(h->fd, data, len);
-    if(n != len) {
-        D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
-            h->fd, n, errno, strerror(errno));
-        return -1;
+    while (len > 0) {
+        int xfer = (len > USB_ADB_MAX_READ) ? USB_ADB_MAX_READ : len;
+        n = adb_read(h->fd, data, xfer);
+        if(n != xfer) {
+            D("ERROR: fd = %d, n = %d, errno = %d (%s)\n",
+                h->fd, n, errno, strerror(errno));
+            return -1;
+        }
+        data = (char *) data + xfer;
+        len -= xfer;
     }
     D("[ done fd=%d ]\n", h->fd);
     return 0;
@@ -351,7 +404,9 @@ static int bulk_write(int bulk_in, const char *buf, size_t length)
     int ret;
 
     do {
-        ret = adb_write(bulk_in, buf + count, length - count);
+        size_t xfer = length - count;
+        if (xfer > USB_FFS_MAX_IO) xfer = USB_FFS_MAX_IO;
+        ret = adb_write(bulk_in, buf + count, xfer);
         if (ret < 0) {
             if (errno != EINTR)
                 return ret;
@@ -385,7 +440,9 @@ static int bulk_read(int bulk_out, char *buf, size_t length)
     int ret;
 
     do {
-        ret = adb_read(bulk_out, buf + count, length - count);
+        size_t xfer = length - count;
+        if (xfer > USB_FFS_MAX_IO) xfer = USB_FFS_MAX_IO;
+        ret = adb_read(bulk_out, buf + count, xfer);
         if (ret < 0) {
             if (errno != EINTR) {
                 D("[ bulk_read failed fd=%d length=%zu count=%zu ]\n",
@@ -415,10 +472,374 @@ static int usb_ffs_read(usb_handle *h, void *data, int len)
     return 0;
 }
 
+#ifdef USB_FFS_AIO
+/* bionic has no wrappers for the AIO syscalls */
+static int io_setup(unsigned nr, aio_context_t *ctx)
+{
+    return syscall(__NR_io_setup, nr, ctx);
+}
+
+static int io_submit(aio_context_t ctx, long n, struct iocb **iocbs)
+{
+    return syscall(__NR_io_submit, ctx, n, iocbs);
+}
+
+static int io_getevents(aio_context_t ctx, long min_nr, long nr,
+                        struct io_event *events, struct timespec *timeout)
+{
+    return syscall(__NR_io_getevents, ctx, min_nr, nr, events, timeout);
+}
+
+static int io_destroy(aio_context_t ctx)
+{
+    return syscall(__NR_io_destroy, ctx);
+}
+
+static struct ffs_aio *ffs_aio_create(int with_buffers)
+{
+    struct ffs_aio *aio = calloc(1, sizeof(*aio));
+    int i;
+
+    if (aio == NULL)
+        return NULL;
+    aio->eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (aio->eventfd < 0 || io_setup(USB_FFS_NUM_SLOTS, &aio->ctx) < 0) {
+        D("[ usb: no AIO (errno=%d), using blocking I/O ]\n", errno);
+        if (aio->eventfd >= 0) adb_close(aio->eventfd);
+        free(aio);
+        return NULL;
+    }
+    if (with_buffers) {
+        for (i = 0; i < USB_FFS_NUM_SLOTS; ++i) {
+            aio->bufs[i] = malloc(USB_FFS_MAX_IO);
+            if (aio->bufs[i] == NULL) fatal("cannot allocate usb buffers");
+        }
+    }
+    return aio;
+}
+
+/* Drop everything queued on the context.  Destroying it cancels those
+** transfers and waits for them, so none can complete into a later one.
+** Consumes a pending kick.
+*/
+static void ffs_aio_reset(struct ffs_aio *aio)
+{
+    uint64_t count;
+
+    io_destroy(aio->ctx);
+    aio->ctx = 0;
+    memset(aio->pending, 0, sizeof(aio->pending));
+    aio->head = aio->queued = 0;
+    aio->offset = 0;
+    aio->maxpacket = 0;
+
+    // Cleared before the eventfd is drained, so a kick that lands in
+    // between is still seen.
+    aio->kicked = 0;
+    adb_read(aio->eventfd, &count, sizeof(count));
+
+    if (io_setup(USB_FFS_NUM_SLOTS, &aio->ctx) < 0)
+        D("[ usb: cannot recreate AIO context: errno=%d ]\n", errno);
+}
+
+/* Give up on AIO for the endpoint.  Only the kernel context goes: a
+** kick may still be signalling the eventfd from another thread, so the
+** rest lives as long as the handle.
+*/
+static void ffs_aio_disable(struct ffs_aio *aio)
+{
+    io_destroy(aio->ctx);
+    aio->ctx = 0;
+}
+
+static void ffs_aio_prep(struct ffs_aio *aio, int i, int fd, int opcode,
+                         const void *buf, size_t len)
+{
+    struct iocb *iocb = &aio->iocbs[i];
+    memset(iocb, 0, sizeof(*iocb));
+    iocb->aio_data = i;
+    iocb->aio_fildes = fd;
+    iocb->aio_lio_opcode = opcode;
+    iocb->aio_buf = (uintptr_t) buf;
+    iocb->aio_nbytes = len;
+    iocb->aio_flags = IOCB_FLAG_RESFD;
+    iocb->aio_resfd = aio->eventfd;
+}
+
+static int ffs_aio_submit(struct ffs_aio *aio, int first, int count)
+{
+    struct iocb *list[USB_FFS_NUM_SLOTS];
+    int i, n;
+
+    for (i = 0; i < count; ++i) {
+        list[i] = &aio->iocbs[first + i];
+        aio->pending[first + i] = 1;
+    }
+    n = io_submit(aio->ctx, count, list);
+    if (n < 0) n = 0;
+    if (n > 0) aio->probed = 1;
+    for (i = n; i < count; ++i) {
+        aio->pending[first + i] = 0;
+    }
+    return n;
+}
+
+/* Sleep until some transfers finish, and reap them.  Returns -1 once
+** the endpoint has been kicked.
+*/
+static int ffs_aio_reap(struct ffs_aio *aio)
+{
+    struct io_event events[USB_FFS_NUM_SLOTS];
+    struct pollfd pfd = { aio->eventfd, POLLIN, 0 };
+    struct timespec zero = { 0, 0 };
+    uint64_t count;
+    int i, n;
+
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+        ;
+    if (aio->kicked)
+        return -1;
+    adb_read(aio->eventfd, &count, sizeof(count));
+
+    n = io_getevents(aio->ctx, 0, USB_FFS_NUM_SLOTS, events, &zero);
+    for (i = 0; i < n; ++i) {
+        int j = events[i].data;
+        aio->pending[j] = 0;
+        aio->result[j] = events[i].res;
+    }
+    return 0;
+}
+
+static int ffs_aio_any_pending(struct ffs_aio *aio)
+{
+    int i;
+    for (i = 0; i < USB_FFS_NUM_SLOTS; ++i) {
+        if (aio->pending[i]) return 1;
+    }
+    return 0;
+}
+
+/* Wake the endpoint's I/O thread, which then drops its transfers. */
+static void ffs_aio_kick(struct ffs_aio *aio)
+{
+    uint64_t one = 1;
+
+    if (aio == NULL)
+        return;
+    aio->kicked = 1;
+    adb_write(aio->eventfd, &one, sizeof(one));
+}
+
+/* FunctionFS only takes AIO from Linux 3.15.  Before that io_setup()
+** works but io_submit() on an endpoint fails with EINVAL, so that is
+** what the first transfer on each endpoint finds out.  Nothing has moved
+** by then, and the blocking calls take over for good.
+*/
+static int ffs_aio_unsupported(struct ffs_aio *aio)
+{
+    return !aio->probed && errno == EINVAL;
+}
+
+/* Bytes the queued reads still hold or may yet bring, at most. */
+static long ffs_read_promised(struct ffs_aio *aio)
+{
+    long total = 0;
+    int k;
+
+    for (k = 0; k < aio->queued; ++k) {
+        int i = (aio->head + k) % USB_FFS_NUM_SLOTS;
+        if (aio->pending[i]) {
+            total += aio->iocbs[i].aio_nbytes;
+        } else if (aio->result[i] > 0) {
+            total += aio->result[i] - (k == 0 ? aio->offset : 0);
+        }
+    }
+    return total;
+}
+
+/* Queue one more read of 'size' bytes behind the others. */
+static int ffs_read_queue(usb_handle *h, long size)
+{
+    struct ffs_aio *aio = h->read_aio;
+    int i = (aio->head + aio->queued) % USB_FFS_NUM_SLOTS;
+
+    ffs_aio_prep(aio, i, h->bulk_out, IOCB_CMD_PREAD, aio->bufs[i], size);
+    if (ffs_aio_submit(aio, i, 1) != 1)
+        return -1;
+    aio->queued++;
+    return 0;
+}
+
+/* Keep reads of one USB packet queued between callers, so whatever the
+** host sends next is taken at once.  Reads any bigger could wait past
+** the end of a message: the host doesn't end a transfer that fills its
+** last packet.  The packet size depends on the link, so this starts once
+** the endpoint can say what it is.
+*/
+static void ffs_read_ahead(usb_handle *h)
+{
+    struct ffs_aio *aio = h->read_aio;
+
+#ifdef FUNCTIONFS_ENDPOINT_DESC
+    if (aio->maxpacket == 0) {
+        struct usb_endpoint_descriptor desc;
+        if (ioctl(h->bulk_out, FUNCTIONFS_ENDPOINT_DESC, &desc) == 0)
+            aio->maxpacket = le16toh(desc.wMaxPacketSize) & 0x7ff;
+    }
+#endif
+    if (aio->maxpacket == 0)
+        return;
+    while (aio->queued < USB_FFS_READ_AHEAD) {
+        if (ffs_read_queue(h, aio->maxpacket)) {
+            D("[ usb: cannot queue read-ahead: errno=%d ]\n", errno);
+            return;
+        }
+    }
+}
+
+/* Reads complete in the order they were queued, and are taken as one
+** stream of bytes.  Beyond the read-ahead, transfers are only queued for
+** as much as the caller still wants, so none can wait on a message the
+** host hasn't been asked for yet.
+*/
+static int usb_ffs_aio_read(usb_handle *h, void *data, int len)
+{
+    struct ffs_aio *aio = h->read_aio;
+    char *out = data;
+
+    D("about to read (fd=%d, len=%d)\n", h->bulk_out, len);
+    if (aio->kicked)
+        ffs_aio_reset(aio);
+
+    while (len > 0) {
+        long promised = ffs_read_promised(aio);
+        while (promised < len && aio->queued < USB_FFS_NUM_SLOTS) {
+            long size = len - promised;
+            if (size > USB_FFS_MAX_IO) size = USB_FFS_MAX_IO;
+            if (ffs_read_queue(h, size)) {
+                if (ffs_aio_unsupported(aio)) {
+                    D("[ usb: bulk-out doesn't take AIO, using blocking I/O ]\n");
+                    ffs_aio_disable(aio);
+                    h->read = usb_ffs_read;
+                    return usb_ffs_read(h, out, len);
+                }
+                D("[ usb: cannot queue read: errno=%d ]\n", errno);
+                goto fail;
+            }
+            promised += size;
+        }
+
+        int i = aio->head;
+        if (aio->pending[i]) {
+            if (ffs_aio_reap(aio)) goto fail;
+            continue;
+        }
+        if (aio->result[i] < 0) {
+            D("[ usb: read failed: errno=%ld ]\n", -aio->result[i]);
+            goto fail;
+        }
+
+        long n = aio->result[i] - aio->offset;
+        if (n > len) n = len;
+        memcpy(out, aio->bufs[i] + aio->offset, n);
+        out += n;
+        len -= n;
+        aio->offset += n;
+        if (aio->offset == aio->result[i]) {
+            aio->head = (i + 1) % USB_FFS_NUM_SLOTS;
+            aio->queued--;
+            aio->offset = 0;
+        }
+    }
+    ffs_read_ahead(h);
+    D("[ done fd=%d ]\n", h->bulk_out);
+    return 0;
+
+fail:
+    ffs_aio_reset(aio);
+    return -1;
+}
+
+/* Move up to USB_FFS_NUM_AIO * USB_FFS_MAX_IO bytes of 'buf' to the
+** host as transfers all in flight at once.  Returns the bytes moved, or
+** -1 with errno set.
+*/
+static int ffs_aio_write_some(struct ffs_aio *aio, int fd, const char *buf, int len)
+{
+    int i, n, submitted, done = 0, err = 0;
+
+    for (n = 0; len > 0 && n < USB_FFS_NUM_AIO; ++n) {
+        int xfer = (len > USB_FFS_MAX_IO) ? USB_FFS_MAX_IO : len;
+        ffs_aio_prep(aio, n, fd, IOCB_CMD_PWRITE, buf + n * USB_FFS_MAX_IO, xfer);
+        len -= xfer;
+    }
+
+    submitted = ffs_aio_submit(aio, 0, n);
+    if (submitted < n)
+        err = errno;
+    while (ffs_aio_any_pending(aio)) {
+        if (ffs_aio_reap(aio)) {
+            ffs_aio_reset(aio);
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    for (i = 0; i < submitted && !err; ++i) {
+        if (aio->result[i] < 0)
+            err = -aio->result[i];
+        else if (aio->result[i] != (long) aio->iocbs[i].aio_nbytes)
+            err = EIO;
+        else
+            done += aio->result[i];
+    }
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return done;
+}
+
+/* Large packets go out as several transfers, all submitted at once. */
+static int usb_ffs_aio_write(usb_handle *h, const void *data, int len)
+{
+    struct ffs_aio *aio = h->write_aio;
+    const char *p = data;
+    int n;
+
+    D("about to write (fd=%d, len=%d)\n", h->bulk_in, len);
+    if (aio->kicked)
+        ffs_aio_reset(aio);
+
+    while (len > 0) {
+        n = ffs_aio_write_some(aio, h->bulk_in, p, len);
+        if (n < 0 && ffs_aio_unsupported(aio)) {
+            D("[ usb: bulk-in doesn't take AIO, using blocking I/O ]\n");
+            ffs_aio_disable(aio);
+            h->write = usb_ffs_write;
+            return usb_ffs_write(h, p, len);
+        }
+        if (n < 0) {
+            D("[ usb: write failed: errno=%d ]\n", errno);
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    D("[ done fd=%d ]\n", h->bulk_in);
+    return 0;
+}
+#endif /* USB_FFS_AIO */
+
 static void usb_ffs_kick(usb_handle *h)
 {
     int err;
 
+#ifdef USB_FFS_AIO
+    ffs_aio_kick(h->read_aio);
+    ffs_aio_kick(h->write_aio);
+#endif
+
     err = ioctl(h->bulk_in, FUNCTIONFS_CLEAR_HALT);
     if (err < 0)
         D("[ kick: source (fd=%d) clear halt failed (%d) ]", h->bulk_in, errno);
@@ -451,6 +872,30 @@ static void usb_ffs_init()
     h->read = usb_ffs_read;
     h->kick = usb_ffs_kick;
 
+#ifdef USB_FFS_AIO
+    // Whether the endpoints take it is only known once they're used;
+    // see ffs_aio_unsupported().  Nothing else runs yet, so what isn't
+    // needed can still be freed.
+    h->read_aio = ffs_aio_create(1);
+    h->write_aio = ffs_aio_create(0);
+    if (h->read_aio && h->write_aio) {
+        D("[ usb_init - trying AIO ]\n");
+        h->read = usb_ffs_aio_read;
+        h->write = usb_ffs_aio_write;
+    } else {
+        struct ffs_aio *both[2] = { h->read_aio, h->write_aio };
+        int i, j;
+        for (i = 0; i < 2; ++i) {
+            if (both[i] == NULL) continue;
+            io_destroy(both[i]->ctx);
+            adb_close(both[i]->eventfd);
+            for (j = 0; j < USB_FFS_NUM_SLOTS; ++j) free(both[i]->bufs[j]);
+            free(both[i]);
+        }
+        h->read_aio = h->write_aio = NULL;
+    }
+#endif
+
     h->control  = -1;
     h->bulk_out = -1;
     h->bulk_out = -1;
@@ -2,7 +2,25 @@ LOCAL_PATH := $(call my-dir)
 
 common_cflags :=
 
-common_src_files := graphics.c graphics_fbdev.c events.c resources.c
+common_src_files := graphics.c graphics_fbdev.c graphics_memory.c events.c resources.c pixels.c
+
+# Vectorized pixel kernels; pixels.c picks one at runtime.  On 32-bit ARM
+# the NEON file alone is built with -mfpu=neon (the .neon suffix) and is
+# only used when the CPU reports NEON support.
+ifeq ($(TARGET_ARCH),arm)
+  common_src_files += pixels_neon.c.neon
+  common_cflags += -DMINUI_HAVE_NEON
+endif
+
+ifeq ($(TARGET_ARCH),arm64)
+  common_src_files += pixels_neon.c
+  common_cflags += -DMINUI_HAVE_NEON
+endif
+
+ifneq ($(filter x86 x86_64,$(TARGET_ARCH)),)
+  common_src_files += pixels_sse2.c
+  common_cflags += -DMINUI_HAVE_SSE2
+endif
 
 common_c_includes := \
     external/libpng\
@@ -56,3 +74,50 @@ LOCAL_C_INCLUDES := $(common_c_includes)
 LOCAL_SHARED_LIBRARIES := libpng libpixelflinger
 LOCAL_CFLAGS += $(common_cflags) -DSHARED_MINUI
 include $(BUILD_SHARED_LIBRARY)
+
+
+# Rendering benchmark on the offscreen backend (see minui_bench.c).
+include $(CLEAR_VARS)
+LOCAL_MODULE := minui_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := minui_bench.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_STATIC_LIBRARIES := libminui libpng libz libcutils liblog libc
+LOCAL_FORCE_STATIC_EXECUTABLE := true
+include $(BUILD_EXECUTABLE)
+
+# Host build of minui, so the drawing code (and golden-image tests using
+# gr_dump_png()) can run headless with MINUI_BACKEND=memory.
+host_src_files := graphics.c graphics_fbdev.c graphics_memory.c events.c resources.c pixels.c
+host_cflags := -DOVERSCAN_PERCENT=0
+
+ifneq ($(filter x86 x86_64,$(HOST_ARCH)),)
+  host_src_files += pixels_sse2.c
+  host_cflags += -DMINUI_HAVE_SSE2
+endif
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := libminui_host
+LOCAL_SRC_FILES := $(host_src_files)
+LOCAL_C_INCLUDES := $(common_c_includes)
+LOCAL_CFLAGS := $(host_cflags)
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := minui_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := minui_bench.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_STATIC_LIBRARIES := libminui_host libpng libz libcutils liblog
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
+
+# Packs res/images into the bundle resources.c maps (see res_bundle.h).
+include $(CLEAR_VARS)
+LOCAL_MODULE := mkresbundle
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := mkresbundle.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH) $(common_c_includes)
+LOCAL_STATIC_LIBRARIES := libminui_host libpng libz libcutils liblog
+LOCAL_LDLIBS := -lpthread
+include $(BUILD_HOST_EXECUTABLE)
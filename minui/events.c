@@ -16,8 +16,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
 #include <sys/poll.h>
 
 #include <linux/input.h>
@@ -25,8 +30,8 @@
 #include "minui.h"
 #include "cutils/log.h"
 
-#define MAX_DEVICES 16
-#define MAX_MISC_FDS 16
+#define INPUT_DIR "/dev/input"
+#define MAX_EVENTS 16
 
 #define BITS_PER_LONG (sizeof(unsigned long) * 8)
 #define BITS_TO_LONGS(x) (((x) + BITS_PER_LONG - 1) / BITS_PER_LONG)
@@ -35,54 +40,204 @@
     ((array)[(bit)/BITS_PER_LONG] & (1 << ((bit) % BITS_PER_LONG)))
 
 struct fd_info {
+    int fd;
     ev_callback cb;
     void *data;
+    char *dev_name;     // under INPUT_DIR, for input devices only
 };
 
-static struct pollfd ev_fds[MAX_DEVICES + MAX_MISC_FDS];
-static struct fd_info ev_fdinfo[MAX_DEVICES + MAX_MISC_FDS];
-
+// Everything registered with the epoll set.  Each epoll_event points at
+// its fd_info, so entries are allocated one by one and never move.
+static struct fd_info **ev_fdinfo = NULL;
 static unsigned ev_count = 0;
-static unsigned ev_dev_count = 0;
-static unsigned ev_misc_count = 0;
+static unsigned ev_capacity = 0;
+
+static int epoll_fd = -1;
+static int inotify_fd = -1;
+
+// The input callback, for devices that show up after ev_init().
+static ev_callback ev_input_cb = NULL;
+static void *ev_input_data = NULL;
+
+// Results of the last ev_wait(), consumed by ev_dispatch().
+static struct epoll_event ev_events[MAX_EVENTS];
+static int ev_pending = 0;
+static int ev_next = 0;
+
+static int ensure_epoll(void)
+{
+    if (epoll_fd < 0) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            perror("epoll_create1");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static struct fd_info *register_fd(int fd, ev_callback cb, void *data, const char *dev_name)
+{
+    if (ensure_epoll() < 0) return NULL;
+
+    if (ev_count == ev_capacity) {
+        unsigned capacity = ev_capacity ? ev_capacity * 2 : 16;
+        struct fd_info **info = realloc(ev_fdinfo, capacity * sizeof(*info));
+        if (info == NULL) return NULL;
+        ev_fdinfo = info;
+        ev_capacity = capacity;
+    }
+
+    struct fd_info *info = calloc(1, sizeof(*info));
+    if (info == NULL) return NULL;
+    info->fd = fd;
+    info->cb = cb;
+    info->data = data;
+    if (dev_name != NULL) info->dev_name = strdup(dev_name);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = info;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        free(info->dev_name);
+        free(info);
+        return NULL;
+    }
+
+    ev_fdinfo[ev_count++] = info;
+    return info;
+}
+
+static void unregister_at(unsigned n)
+{
+    struct fd_info *info = ev_fdinfo[n];
+    int i;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, info->fd, NULL);
+
+    // A callback may remove an fd whose events are still waiting to be
+    // dispatched; drop those.
+    for (i = ev_next; i < ev_pending; ++i) {
+        if (ev_events[i].data.ptr == info) ev_events[i].data.ptr = NULL;
+    }
+
+    ev_fdinfo[n] = ev_fdinfo[--ev_count];
+    free(info->dev_name);
+    free(info);
+}
+
+// Open /dev/input/<name> and start watching it, if it's a device
+// reporting the kinds of events recovery cares about.
+static void open_device(int dir_fd, const char *name)
+{
+    unsigned long ev_bits[BITS_TO_LONGS(EV_MAX)];
+    unsigned n;
+    int fd;
+
+    if (strncmp(name, "event", 5)) return;
+    for (n = 0; n < ev_count; ++n) {
+        if (ev_fdinfo[n]->dev_name && !strcmp(ev_fdinfo[n]->dev_name, name)) return;
+    }
+
+    fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    /* read the evbits of the input device */
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits) < 0) {
+        close(fd);
+        return;
+    }
+
+    /* TODO: add ability to specify event masks. For now, just assume
+     * that only EV_KEY and EV_REL event types are ever needed. */
+    if (!test_bit(EV_KEY, ev_bits) && !test_bit(EV_REL, ev_bits) && !test_bit(EV_ABS, ev_bits)) {
+        close(fd);
+        return;
+    }
+
+    if (register_fd(fd, ev_input_cb, ev_input_data, name) == NULL) {
+        close(fd);
+        return;
+    }
+    printf("input device %s added\n", name);
+}
+
+static void close_device(const char *name)
+{
+    unsigned n;
+    for (n = 0; n < ev_count; ++n) {
+        struct fd_info *info = ev_fdinfo[n];
+        if (info->dev_name && !strcmp(info->dev_name, name)) {
+            printf("input device %s removed\n", name);
+            int fd = info->fd;
+            unregister_at(n);
+            close(fd);
+            return;
+        }
+    }
+}
+
+// Devices coming and going under INPUT_DIR.
+static int inotify_callback(int fd, short revents, void *data)
+{
+    char buf[512] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+
+    if (!(revents & POLLIN)) return 0;
+
+    len = read(fd, buf, sizeof(buf));
+    if (len <= 0) return -1;
+
+    int dir_fd = open(INPUT_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    char *p = buf;
+    while (p + sizeof(struct inotify_event) <= buf + len) {
+        struct inotify_event *event = (struct inotify_event *) p;
+        if (event->len > 0) {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                if (dir_fd >= 0) open_device(dir_fd, event->name);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                close_device(event->name);
+            }
+        }
+        p += sizeof(struct inotify_event) + event->len;
+    }
+    if (dir_fd >= 0) close(dir_fd);
+    return 0;
+}
 
 int ev_init(ev_callback input_cb, void *data)
 {
     DIR *dir;
     struct dirent *de;
-    int fd;
 
-    dir = opendir("/dev/input");
+    if (ensure_epoll() < 0) return -1;
+    ev_input_cb = input_cb;
+    ev_input_data = data;
+
+    // Watch for hotplugged devices before scanning, so none slip through
+    // in between.
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0) {
+        if (inotify_add_watch(inotify_fd, INPUT_DIR,
+                              IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0 ||
+            register_fd(inotify_fd, inotify_callback, NULL, NULL) == NULL) {
+            close(inotify_fd);
+            inotify_fd = -1;
+        }
+    }
+    if (inotify_fd < 0) {
+        printf("not watching %s for new input devices\n", INPUT_DIR);
+    }
+
+    dir = opendir(INPUT_DIR);
     if(dir != 0) {
         while((de = readdir(dir))) {
-            unsigned long ev_bits[BITS_TO_LONGS(EV_MAX)];
-
 //            fprintf(stderr,"/dev/input/%s\n", de->d_name);
-            if(strncmp(de->d_name,"event",5)) continue;
-            fd = openat(dirfd(dir), de->d_name, O_RDONLY);
-            if(fd < 0) continue;
-
-            /* read the evbits of the input device */
-            if (ioctl(fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits) < 0) {
-                close(fd);
-                continue;
-            }
-
-            /* TODO: add ability to specify event masks. For now, just assume
-             * that only EV_KEY and EV_REL event types are ever needed. */
-            if (!test_bit(EV_KEY, ev_bits) && !test_bit(EV_REL, ev_bits) && !test_bit(EV_ABS, ev_bits)) {
-                close(fd);
-                continue;
-            }
-
-            ev_fds[ev_count].fd = fd;
-            ev_fds[ev_count].events = POLLIN;
-            ev_fdinfo[ev_count].cb = input_cb;
-            ev_fdinfo[ev_count].data = data;
-            ev_count++;
-            ev_dev_count++;
-            if (ev_dev_count == (MAX_DEVICES + MAX_MISC_FDS)) break;
+            open_device(dirfd(dir), de->d_name);
         }
+        closedir(dir);
     }
 
     return 0;
@@ -90,29 +245,18 @@ int ev_init(ev_callback input_cb, void *data)
 
 int ev_add_fd(int fd, ev_callback cb, void *data)
 {
-    if (ev_misc_count == MAX_MISC_FDS || cb == NULL)
+    if (cb == NULL)
         return -1;
 
-    ev_fds[ev_count].fd = fd;
-    ev_fds[ev_count].events = POLLIN;
-    ev_fdinfo[ev_count].cb = cb;
-    ev_fdinfo[ev_count].data = data;
-    ev_count++;
-    ev_misc_count++;
-    return 0;
+    return register_fd(fd, cb, data, NULL) ? 0 : -1;
 }
 
 int ev_del_fd(int fd)
 {
     unsigned n;
     for (n = 0; n < ev_count; ++n) {
-        if (ev_fds[n].fd == fd) {
-            if (n != ev_count-1) {
-                ev_fds[n] = ev_fds[ev_count-1];
-                ev_fdinfo[n] = ev_fdinfo[ev_count-1];
-            }
-            ev_count--;
-            ev_misc_count--;
+        if (ev_fdinfo[n]->fd == fd) {
+            unregister_at(n);
             return 1;
         }
     }
@@ -122,32 +266,60 @@ int ev_del_fd(int fd)
 void ev_exit(void)
 {
     while (ev_count > 0) {
-        close(ev_fds[--ev_count].fd);
+        int fd = ev_fdinfo[ev_count - 1]->fd;
+        unregister_at(ev_count - 1);
+        close(fd);
+    }
+    free(ev_fdinfo);
+    ev_fdinfo = NULL;
+    ev_capacity = 0;
+    inotify_fd = -1;
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+        epoll_fd = -1;
     }
-    ev_misc_count = 0;
-    ev_dev_count = 0;
+    ev_pending = ev_next = 0;
 }
 
 int ev_wait(int timeout)
 {
     int r;
 
-    r = poll(ev_fds, ev_count, timeout);
-    if (r <= 0)
+    if (epoll_fd < 0)
+        return -1;
+
+    ev_next = 0;
+    r = epoll_wait(epoll_fd, ev_events, MAX_EVENTS, timeout);
+    if (r <= 0) {
+        ev_pending = 0;
         return -1;
+    }
+    ev_pending = r;
     return 0;
 }
 
 void ev_dispatch(void)
 {
-    unsigned n;
-    int ret;
+    while (ev_next < ev_pending) {
+        struct epoll_event *ev = &ev_events[ev_next++];
+        struct fd_info *info = ev->data.ptr;
+        if (info == NULL)
+            continue;
 
-    for (n = 0; n < ev_count; n++) {
-        ev_callback cb = ev_fdinfo[n].cb;
-        if (cb && (ev_fds[n].revents & ev_fds[n].events))
-            cb(ev_fds[n].fd, ev_fds[n].revents, ev_fdinfo[n].data);
+        // An unplugged device reports errors until it's closed; don't
+        // wait for inotify to notice.
+        if (info->dev_name && (ev->events & (EPOLLERR | EPOLLHUP))) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s", info->dev_name);
+            close_device(name);
+            continue;
+        }
+
+        // The EPOLL* event bits have the same values as the POLL* ones.
+        if (info->cb)
+            info->cb(info->fd, ev->events, info->data);
     }
+    ev_pending = ev_next = 0;
 }
 
 int ev_get_input(int fd, short revents, struct input_event *ev)
@@ -169,17 +341,20 @@ int ev_sync_key_state(ev_set_key_callback set_key_cb, void *data)
     unsigned i;
     int ret;
 
-    for (i = 0; i < ev_dev_count; i++) {
+    for (i = 0; i < ev_count; i++) {
         int code;
 
+        if (ev_fdinfo[i]->dev_name == NULL)
+            continue;
+
         memset(key_bits, 0, sizeof(key_bits));
         memset(ev_bits, 0, sizeof(ev_bits));
 
-        ret = ioctl(ev_fds[i].fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
+        ret = ioctl(ev_fdinfo[i]->fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
         if (ret < 0 || !test_bit(EV_KEY, ev_bits))
             continue;
 
-        ret = ioctl(ev_fds[i].fd, EVIOCGKEY(sizeof(key_bits)), key_bits);
+        ret = ioctl(ev_fdinfo[i]->fd, EVIOCGKEY(sizeof(key_bits)), key_bits);
         if (ret < 0)
             continue;
 
@@ -33,6 +33,7 @@
 #include "roboto_23x41.h"
 #include "minui.h"
 #include "graphics.h"
+#include "pixels.h"
 
 typedef struct {
     GRSurface* texture;
@@ -42,6 +43,7 @@ typedef struct {
 
 static GRFont* gr_font = NULL;
 static minui_backend* gr_backend = NULL;
+static const gr_pixel_ops* gr_pixels = &gr_pixel_ops_scalar;
 
 static int overscan_percent = OVERSCAN_PERCENT;
 static int overscan_offset_x = 0;
@@ -56,6 +58,23 @@ static unsigned char gr_current_a = 255;
 
 static GRSurface* gr_draw = NULL;
 
+// Glyphs prerendered for gr_text_opaque(), one set per combination of
+// color, background and weight, most recently used kept.
+#define GLYPH_CACHE_SIZE 4
+
+typedef struct {
+    unsigned char color[4];
+    unsigned char bg[3];
+    int bold;
+    unsigned int last_used;
+    unsigned char* data;            // 96 cells of cwidth x cheight pixels
+    unsigned char rendered[96];
+} GRGlyphCache;
+
+static GRGlyphCache gr_glyph_cache[GLYPH_CACHE_SIZE];
+static unsigned int gr_glyph_clock = 0;
+static unsigned char gr_text_bg[3] = { 0, 0, 0 };
+
 static bool outside(int x, int y)
 {
     return x < 0 || x >= gr_draw->width || y < 0 || y >= gr_draw->height;
@@ -76,36 +95,10 @@ static void text_blend(unsigned char* src_p, int src_row_bytes,
                        unsigned char* dst_p, int dst_row_bytes,
                        int width, int height)
 {
-    int i, j;
-    for (j = 0; j < height; ++j) {
-        unsigned char* sx = src_p;
-        unsigned char* px = dst_p;
-        for (i = 0; i < width; ++i) {
-            unsigned char a = *sx++;
-            if (gr_current_a < 255) a = ((int)a * gr_current_a) / 255;
-            if (a == 255) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            } else if (a > 0) {
-                *px = (*px * (255-a) + gr_current_r * a) / 255;
-                ++px;
-                *px = (*px * (255-a) + gr_current_g * a) / 255;
-                ++px;
-                *px = (*px * (255-a) + gr_current_b * a) / 255;
-                ++px;
-                ++px;
-            } else {
-                px += 4;
-            }
-        }
-        src_p += src_row_bytes;
-        dst_p += dst_row_bytes;
-    }
+    unsigned char color[4] = { gr_current_r, gr_current_g, gr_current_b, gr_current_a };
+    gr_pixels->blend(src_p, src_row_bytes, dst_p, dst_row_bytes, width, height, color);
 }
 
-
 void gr_text(int x, int y, const char *s, int bold)
 {
     GRFont *font = gr_font;
@@ -137,6 +130,99 @@ void gr_text(int x, int y, const char *s, int bold)
     }
 }
 
+void gr_text_background(void)
+{
+    gr_text_bg[0] = gr_current_r;
+    gr_text_bg[1] = gr_current_g;
+    gr_text_bg[2] = gr_current_b;
+}
+
+// Returns the glyph cache for the current color and text background,
+// (re)using the least recently used entry if there is none yet.  Returns
+// NULL if memory for it can't be allocated.
+static GRGlyphCache* glyph_cache_get(int bold)
+{
+    unsigned char color[4] = { gr_current_r, gr_current_g, gr_current_b, gr_current_a };
+    GRGlyphCache* victim = NULL;
+    int i;
+
+    for (i = 0; i < GLYPH_CACHE_SIZE; ++i) {
+        GRGlyphCache* c = &gr_glyph_cache[i];
+        if (c->data != NULL && c->bold == bold &&
+            memcmp(c->color, color, sizeof(color)) == 0 &&
+            memcmp(c->bg, gr_text_bg, sizeof(gr_text_bg)) == 0) {
+            c->last_used = ++gr_glyph_clock;
+            return c;
+        }
+        if (victim == NULL || c->data == NULL ||
+            (victim->data != NULL && c->last_used < victim->last_used)) {
+            victim = c;
+        }
+    }
+
+    if (victim->data == NULL) {
+        victim->data = malloc(96 * gr_font->cwidth * gr_font->cheight * 4);
+        if (victim->data == NULL) return NULL;
+    }
+    memcpy(victim->color, color, sizeof(color));
+    memcpy(victim->bg, gr_text_bg, sizeof(gr_text_bg));
+    victim->bold = bold;
+    victim->last_used = ++gr_glyph_clock;
+    memset(victim->rendered, 0, sizeof(victim->rendered));
+    return victim;
+}
+
+// Paints glyph 'off' over the text background into a cell of 4-byte
+// pixels, exactly as gr_fill() followed by gr_text() would.
+static void render_glyph(unsigned char* dst_p, int dst_row_bytes, unsigned off, int bold)
+{
+    GRFont* font = gr_font;
+    unsigned char bg[4] = { gr_text_bg[0], gr_text_bg[1], gr_text_bg[2], 255 };
+    gr_pixels->fill(dst_p, dst_row_bytes, font->cwidth, font->cheight, bg);
+    if (off >= 96 || gr_current_a == 0) return;
+
+    unsigned char* src_p = font->texture->data + (off * font->cwidth) +
+        (bold ? font->cheight * font->texture->row_bytes : 0);
+    text_blend(src_p, font->texture->row_bytes, dst_p, dst_row_bytes,
+               font->cwidth, font->cheight);
+}
+
+void gr_text_opaque(int x, int y, const char *s, int bold)
+{
+    GRFont *font = gr_font;
+    unsigned off;
+
+    if (!font->texture) return;
+
+    bold = bold && (font->texture->height != font->cheight);
+    GRGlyphCache* cache = glyph_cache_get(bold);
+    int cell_row_bytes = font->cwidth * 4;
+    int cell_bytes = cell_row_bytes * font->cheight;
+
+    x += overscan_offset_x;
+    y += overscan_offset_y;
+
+    while((off = *s++)) {
+        off -= 32;
+        if (outside(x, y) || outside(x+font->cwidth-1, y+font->cheight-1)) break;
+
+        unsigned char* dst_p = gr_draw->data + y*gr_draw->row_bytes + x*gr_draw->pixel_bytes;
+        if (cache != NULL && off < 96) {
+            unsigned char* cell = cache->data + off * cell_bytes;
+            if (!cache->rendered[off]) {
+                memset(cell, 0, cell_bytes);
+                render_glyph(cell, cell_row_bytes, off, bold);
+                cache->rendered[off] = 1;
+            }
+            gr_pixels->blit(cell, cell_row_bytes, dst_p, gr_draw->row_bytes,
+                            cell_row_bytes, font->cheight);
+        } else {
+            render_glyph(dst_p, gr_draw->row_bytes, off, bold);
+        }
+        x += font->cwidth;
+    }
+}
+
 void gr_texticon(int x, int y, GRSurface* icon) {
     if (icon == NULL) return;
 
@@ -172,17 +258,9 @@ void gr_clear()
         gr_current_r == gr_current_b) {
         memset(gr_draw->data, gr_current_r, gr_draw->height * gr_draw->row_bytes);
     } else {
-        int x, y;
-        unsigned char* px = gr_draw->data;
-        for (y = 0; y < gr_draw->height; ++y) {
-            for (x = 0; x < gr_draw->width; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            px += gr_draw->row_bytes - (gr_draw->width * gr_draw->pixel_bytes);
-        }
+        unsigned char color[4] = { gr_current_r, gr_current_g, gr_current_b, 255 };
+        gr_pixels->fill(gr_draw->data, gr_draw->row_bytes,
+                        gr_draw->width, gr_draw->height, color);
     }
 }
 
@@ -197,34 +275,8 @@ void gr_fill(int x1, int y1, int x2, int y2)
     if (outside(x1, y1) || outside(x2-1, y2-1)) return;
 
     unsigned char* p = gr_draw->data + y1 * gr_draw->row_bytes + x1 * gr_draw->pixel_bytes;
-    if (gr_current_a == 255) {
-        int x, y;
-        for (y = y1; y < y2; ++y) {
-            unsigned char* px = p;
-            for (x = x1; x < x2; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            p += gr_draw->row_bytes;
-        }
-    } else if (gr_current_a > 0) {
-        int x, y;
-        for (y = y1; y < y2; ++y) {
-            unsigned char* px = p;
-            for (x = x1; x < x2; ++x) {
-                *px = (*px * (255-gr_current_a) + gr_current_r * gr_current_a) / 255;
-                ++px;
-                *px = (*px * (255-gr_current_a) + gr_current_g * gr_current_a) / 255;
-                ++px;
-                *px = (*px * (255-gr_current_a) + gr_current_b * gr_current_a) / 255;
-                ++px;
-                ++px;
-            }
-            p += gr_draw->row_bytes;
-        }
-    }
+    unsigned char color[4] = { gr_current_r, gr_current_g, gr_current_b, gr_current_a };
+    gr_pixels->fill(p, gr_draw->row_bytes, x2 - x1, y2 - y1, color);
 }
 
 void gr_blit(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
@@ -243,12 +295,21 @@ void gr_blit(GRSurface* source, int sx, int sy, int w, int h, int dx, int dy) {
     unsigned char* src_p = source->data + sy*source->row_bytes + sx*source->pixel_bytes;
     unsigned char* dst_p = gr_draw->data + dy*gr_draw->row_bytes + dx*gr_draw->pixel_bytes;
 
-    int i;
-    for (i = 0; i < h; ++i) {
-        memcpy(dst_p, src_p, w * source->pixel_bytes);
-        src_p += source->row_bytes;
-        dst_p += gr_draw->row_bytes;
-    }
+    gr_pixels->blit(src_p, source->row_bytes, dst_p, gr_draw->row_bytes,
+                    w * source->pixel_bytes, h);
+}
+
+void gr_move_rows(int src_y, int dst_y, int h)
+{
+    src_y += overscan_offset_y;
+    dst_y += overscan_offset_y;
+
+    if (h <= 0 || src_y < 0 || dst_y < 0 ||
+        src_y + h > gr_draw->height || dst_y + h > gr_draw->height) return;
+
+    memmove(gr_draw->data + dst_y * gr_draw->row_bytes,
+            gr_draw->data + src_y * gr_draw->row_bytes,
+            h * gr_draw->row_bytes);
 }
 
 unsigned int gr_get_width(GRSurface* surface) {
@@ -267,6 +328,8 @@ unsigned int gr_get_height(GRSurface* surface) {
 
 static void gr_init_font(void)
 {
+    if (gr_font != NULL) return;    // gr_init() after gr_exit()
+
     gr_font = calloc(sizeof(*gr_font), 1);
 
     int res = res_create_alpha_surface("font", &(gr_font->texture));
@@ -354,12 +417,51 @@ void gr_flip() {
     gr_draw = gr_backend->flip(gr_backend);
 }
 
+bool gr_can_flip_rows() {
+    return gr_backend->flip_rows != NULL;
+}
+
+void gr_flip_rows(int y, int h) {
+    if (gr_backend->flip_rows == NULL) {
+        gr_flip();
+        return;
+    }
+
+    y += overscan_offset_y;
+    if (y < 0) {
+        h += y;
+        y = 0;
+    }
+    if (y + h > gr_draw->height) h = gr_draw->height - y;
+    if (h <= 0) return;
+
+    gr_draw = gr_backend->flip_rows(gr_backend, y, h);
+}
+
+bool gr_can_wait_vsync() {
+    return gr_backend->wait_vsync != NULL;
+}
+
+void gr_wait_vsync() {
+    if (gr_backend->wait_vsync != NULL) {
+        gr_backend->wait_vsync(gr_backend);
+    }
+}
+
 int gr_init(void)
 {
     gr_init_font();
 
-    gr_vt_fd = open("/dev/tty0", O_RDWR | O_SYNC);
-    if (gr_vt_fd < 0) {
+    gr_pixels = gr_pixel_ops_select();
+    printf("minui: using %s pixel kernels\n", gr_pixels->name);
+
+    // Offscreen drawing leaves the console alone.
+    bool offscreen = memory_backend_requested();
+
+    gr_vt_fd = offscreen ? -1 : open("/dev/tty0", O_RDWR | O_SYNC);
+    if (offscreen) {
+        // Nothing to switch to graphics mode.
+    } else if (gr_vt_fd < 0) {
         // This is non-fatal; post-Cupcake kernels don't have tty0.
         perror("can't open /dev/tty0");
     } else if (ioctl(gr_vt_fd, KDSETMODE, (void*) KD_GRAPHICS)) {
@@ -369,11 +471,13 @@ int gr_init(void)
         return -1;
     }
 
+    if (offscreen)
+        gr_backend = open_memory();
 #ifdef MSMFB_OVERLAY
-    if (target_has_overlay())
+    else if (target_has_overlay())
         gr_backend = open_overlay();
-    else
 #endif
+    else
         gr_backend = open_fbdev();
 
     gr_draw = gr_backend->init(gr_backend);
@@ -33,6 +33,16 @@ typedef struct minui_backend {
     // drawing surface.
     gr_surface (*flip)(struct minui_backend*);
 
+    // Like flip(), but only rows [y, y+h) of the drawing surface have
+    // changed since the last flip, and the surface returned is the same
+    // one (still holding the whole frame).  NULL if the backend can't
+    // do partial updates.
+    gr_surface (*flip_rows)(struct minui_backend*, int y, int h);
+
+    // Blocks until the next vertical blank.  NULL if the display can't
+    // report it.
+    void (*wait_vsync)(struct minui_backend*);
+
     // Blank (or unblank) the screen.
     void (*blank)(struct minui_backend*, bool);
 
@@ -42,6 +52,8 @@ typedef struct minui_backend {
 
 minui_backend* open_fbdev();
 minui_backend* open_overlay();
+minui_backend* open_memory();
+bool memory_backend_requested();
 
 bool target_has_overlay();
 
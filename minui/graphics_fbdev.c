@@ -32,8 +32,14 @@
 #include "minui.h"
 #include "graphics.h"
 
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, __u32)
+#endif
+
 static gr_surface fbdev_init(minui_backend*);
 static gr_surface fbdev_flip(minui_backend*);
+static gr_surface fbdev_flip_rows(minui_backend*, int, int);
+static void fbdev_wait_vsync(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
 
@@ -48,6 +54,8 @@ static int fb_fd = -1;
 static minui_backend my_backend = {
     .init = fbdev_init,
     .flip = fbdev_flip,
+    .flip_rows = NULL,
+    .wait_vsync = NULL,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
 };
@@ -161,6 +169,10 @@ static gr_surface fbdev_init(minui_backend* backend) {
             perror("failed to allocate in-memory surface");
             return NULL;
         }
+
+        // The in-memory surface survives flips, so only the rows that
+        // changed need to be copied out.
+        backend->flip_rows = fbdev_flip_rows;
     }
 
     memset(gr_draw->data, 0, gr_draw->height * gr_draw->row_bytes);
@@ -172,6 +184,13 @@ static gr_surface fbdev_init(minui_backend* backend) {
     fbdev_blank(backend, true);
     fbdev_blank(backend, false);
 
+    // Not every driver implements FBIO_WAITFORVSYNC; only offer it if
+    // a first wait works.
+    __u32 crtc = 0;
+    if (ioctl(fb_fd, FBIO_WAITFORVSYNC, &crtc) == 0) {
+        backend->wait_vsync = fbdev_wait_vsync;
+    }
+
     return gr_draw;
 }
 
@@ -190,9 +209,24 @@ static gr_surface fbdev_flip(minui_backend* backend __unused) {
     return gr_draw;
 }
 
-static void fbdev_exit(minui_backend* backend __unused) {
+static gr_surface fbdev_flip_rows(minui_backend* backend __unused, int y, int h) {
+    // Only used without double-buffering (see fbdev_init()).
+    size_t offset = y * gr_draw->row_bytes;
+    memcpy(gr_framebuffer[0].data + offset, gr_draw->data + offset,
+           h * gr_draw->row_bytes);
+    return gr_draw;
+}
+
+static void fbdev_wait_vsync(minui_backend* backend __unused) {
+    __u32 crtc = 0;
+    ioctl(fb_fd, FBIO_WAITFORVSYNC, &crtc);
+}
+
+static void fbdev_exit(minui_backend* backend) {
     close(fb_fd);
     fb_fd = -1;
+    backend->flip_rows = NULL;
+    backend->wait_vsync = NULL;
 
     if (!double_buffered && gr_draw) {
         free(gr_draw->data);
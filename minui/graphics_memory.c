@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A backend that draws into memory instead of a display, so minui (and
+// the UI built on it) can run headless: on a build host, in tests that
+// compare against golden images, and in benchmarks.
+//
+// It behaves like a single-buffered framebuffer.  Flipping converts the
+// RGBX drawing surface into a "display" buffer in the configured pixel
+// format, which is what gr_dump_ppm() and gr_dump_png() read back.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <png.h>
+
+#include "minui.h"
+#include "graphics.h"
+
+#ifdef RECOVERY_BGRA
+#define DEFAULT_FORMAT GR_FORMAT_BGRA_8888
+#else
+#define DEFAULT_FORMAT GR_FORMAT_RGBX_8888
+#endif
+
+static gr_surface memory_init(minui_backend*);
+static gr_surface memory_flip(minui_backend*);
+static gr_surface memory_flip_rows(minui_backend*, int, int);
+static void memory_blank(minui_backend*, bool);
+static void memory_exit(minui_backend*);
+
+static bool requested = false;
+static int mem_width = 720;
+static int mem_height = 1280;
+static int mem_format = DEFAULT_FORMAT;
+
+static GRSurface* gr_draw = NULL;
+static unsigned char* display = NULL;
+static int display_row_bytes = 0;
+
+static minui_backend my_backend = {
+    .init = memory_init,
+    .flip = memory_flip,
+    .flip_rows = memory_flip_rows,
+    .wait_vsync = NULL,
+    .blank = memory_blank,
+    .exit = memory_exit,
+};
+
+minui_backend* open_memory() {
+    return &my_backend;
+}
+
+void gr_use_memory_backend(int width, int height, int format) {
+    requested = true;
+    mem_width = width;
+    mem_height = height;
+    mem_format = format;
+}
+
+// Whether gr_init() should use this backend: asked for explicitly, or
+// through MINUI_BACKEND=memory, with MINUI_MEMORY_SIZE=<w>x<h> and
+// MINUI_MEMORY_FORMAT=RGBX_8888|BGRA_8888|RGB_565 optionally.
+bool memory_backend_requested() {
+    if (requested) return true;
+
+    const char* backend = getenv("MINUI_BACKEND");
+    if (backend == NULL || strcmp(backend, "memory") != 0) return false;
+
+    const char* size = getenv("MINUI_MEMORY_SIZE");
+    int w, h;
+    if (size != NULL && sscanf(size, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+        mem_width = w;
+        mem_height = h;
+    }
+    const char* format = getenv("MINUI_MEMORY_FORMAT");
+    if (format != NULL) {
+        if (strcmp(format, "RGBX_8888") == 0) {
+            mem_format = GR_FORMAT_RGBX_8888;
+        } else if (strcmp(format, "BGRA_8888") == 0) {
+            mem_format = GR_FORMAT_BGRA_8888;
+        } else if (strcmp(format, "RGB_565") == 0) {
+            mem_format = GR_FORMAT_RGB_565;
+        } else {
+            printf("unknown MINUI_MEMORY_FORMAT \"%s\"\n", format);
+        }
+    }
+    return true;
+}
+
+static gr_surface memory_init(minui_backend* backend __unused) {
+    if (mem_width <= 0 || mem_height <= 0) return NULL;
+
+    gr_draw = (GRSurface*) malloc(sizeof(GRSurface));
+    if (gr_draw == NULL) return NULL;
+    gr_draw->width = mem_width;
+    gr_draw->height = mem_height;
+    gr_draw->pixel_bytes = 4;
+    gr_draw->row_bytes = mem_width * 4;
+    gr_draw->data = (unsigned char*) calloc(mem_height, gr_draw->row_bytes);
+
+    display_row_bytes = mem_width * (mem_format == GR_FORMAT_RGB_565 ? 2 : 4);
+    display = (unsigned char*) calloc(mem_height, display_row_bytes);
+
+    if (gr_draw->data == NULL || display == NULL) {
+        perror("failed to allocate memory surface");
+        memory_exit(backend);
+        return NULL;
+    }
+
+    printf("memory framebuffer: %d x %d, format %d\n", mem_width, mem_height, mem_format);
+    return gr_draw;
+}
+
+// Convert rows [y, y+h) of the drawing surface to the display format.
+static void present_rows(int y, int h) {
+    int i, x;
+    for (i = y; i < y + h; ++i) {
+        const unsigned char* src = gr_draw->data + i * gr_draw->row_bytes;
+        unsigned char* dst = display + i * display_row_bytes;
+        switch (mem_format) {
+            case GR_FORMAT_BGRA_8888:
+                for (x = 0; x < gr_draw->width; ++x, src += 4, dst += 4) {
+                    dst[0] = src[2];
+                    dst[1] = src[1];
+                    dst[2] = src[0];
+                    dst[3] = src[3];
+                }
+                break;
+            case GR_FORMAT_RGB_565:
+                for (x = 0; x < gr_draw->width; ++x, src += 4, dst += 2) {
+                    uint16_t p = ((src[0] >> 3) << 11) | ((src[1] >> 2) << 5) | (src[2] >> 3);
+                    dst[0] = p & 0xff;
+                    dst[1] = p >> 8;
+                }
+                break;
+            default:
+                memcpy(dst, src, gr_draw->width * 4);
+                break;
+        }
+    }
+}
+
+static gr_surface memory_flip(minui_backend* backend __unused) {
+    present_rows(0, gr_draw->height);
+    return gr_draw;
+}
+
+static gr_surface memory_flip_rows(minui_backend* backend __unused, int y, int h) {
+    present_rows(y, h);
+    return gr_draw;
+}
+
+static void memory_blank(minui_backend* backend __unused, bool blank __unused) {
+}
+
+static void memory_exit(minui_backend* backend __unused) {
+    if (gr_draw != NULL) {
+        free(gr_draw->data);
+        free(gr_draw);
+        gr_draw = NULL;
+    }
+    free(display);
+    display = NULL;
+}
+
+// Read row y of the presented frame back as 8-bit RGB.
+static void read_rgb_row(int y, unsigned char* rgb) {
+    const unsigned char* p = display + y * display_row_bytes;
+    int x;
+    for (x = 0; x < mem_width; ++x, rgb += 3) {
+        switch (mem_format) {
+            case GR_FORMAT_BGRA_8888:
+                rgb[0] = p[2];
+                rgb[1] = p[1];
+                rgb[2] = p[0];
+                p += 4;
+                break;
+            case GR_FORMAT_RGB_565: {
+                uint16_t v = p[0] | (p[1] << 8);
+                unsigned char r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+                rgb[0] = (r << 3) | (r >> 2);
+                rgb[1] = (g << 2) | (g >> 4);
+                rgb[2] = (b << 3) | (b >> 2);
+                p += 2;
+                break;
+            }
+            default:
+                rgb[0] = p[0];
+                rgb[1] = p[1];
+                rgb[2] = p[2];
+                p += 4;
+                break;
+        }
+    }
+}
+
+int gr_dump_ppm(const char* path) {
+    if (display == NULL) return -1;
+
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+
+    unsigned char* row = malloc(mem_width * 3);
+    if (row == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", mem_width, mem_height);
+    int y;
+    for (y = 0; y < mem_height; ++y) {
+        read_rgb_row(y, row);
+        fwrite(row, 3, mem_width, fp);
+    }
+    free(row);
+
+    int result = ferror(fp) ? -1 : 0;
+    if (fclose(fp) != 0) result = -1;
+    return result;
+}
+
+int gr_dump_png(const char* path) {
+    if (display == NULL) return -1;
+
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+
+    int result = -1;
+    unsigned char* row = NULL;
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = NULL;
+    if (png_ptr == NULL) goto exit;
+    info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == NULL) goto exit;
+
+    row = malloc(mem_width * 3);
+    if (row == NULL) goto exit;
+
+    if (setjmp(png_jmpbuf(png_ptr))) goto exit;
+
+    png_init_io(png_ptr, fp);
+    png_set_IHDR(png_ptr, info_ptr, mem_width, mem_height, 8, PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+    int y;
+    for (y = 0; y < mem_height; ++y) {
+        read_rgb_row(y, row);
+        png_write_row(png_ptr, row);
+    }
+    png_write_end(png_ptr, NULL);
+    result = 0;
+
+exit:
+    png_destroy_write_struct(&png_ptr, info_ptr ? &info_ptr : NULL);
+    free(row);
+    if (fclose(fp) != 0) result = -1;
+    return result;
+}
@@ -67,6 +67,8 @@ static int fb_fd = -1;
 static minui_backend overlay_backend = {
     .init = overlay_init,
     .flip = overlay_flip,
+    .flip_rows = NULL,
+    .wait_vsync = NULL,
     .blank = overlay_blank,
     .exit = overlay_exit,
 };
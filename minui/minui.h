@@ -42,13 +42,45 @@ int gr_fb_width(void);
 int gr_fb_height(void);
 
 void gr_flip(void);
+
+// Present only rows [y, y+h) of the drawing surface.  Only valid when
+// gr_can_flip_rows() is true: the surface then keeps its contents
+// across flips, so callers may redraw just the parts that changed.
+// Otherwise this is the same as gr_flip().
+void gr_flip_rows(int y, int h);
+bool gr_can_flip_rows(void);
+// Wait for the display's next vertical blank, if gr_can_wait_vsync().
+void gr_wait_vsync(void);
+bool gr_can_wait_vsync(void);
 void gr_fb_blank(bool blank);
 
+// Offscreen rendering, for tests and benchmarks.  Called before
+// gr_init(), makes it draw into a width x height buffer in memory
+// instead of the display.  Setting MINUI_BACKEND=memory in the
+// environment does the same (see graphics_memory.c).
+enum { GR_FORMAT_RGBX_8888, GR_FORMAT_BGRA_8888, GR_FORMAT_RGB_565 };
+void gr_use_memory_backend(int width, int height, int format);
+// Write the frame last presented by the memory backend as a binary PPM
+// or a PNG.  Return 0 on success.
+int gr_dump_ppm(const char* path);
+int gr_dump_png(const char* path);
+
 void gr_clear();  // clear entire surface to current color
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 void gr_fill(int x1, int y1, int x2, int y2);
 void gr_text(int x, int y, const char *s, int bold);
 void gr_texticon(int x, int y, gr_surface icon);
+
+// Make the current color the background for gr_text_opaque().
+void gr_text_background(void);
+// Like gr_text(), but paints whole character cells (the glyph in the
+// current color over the gr_text_background() color).  Cells come from
+// a cache of prerendered glyphs, so this copies instead of blending.
+void gr_text_opaque(int x, int y, const char *s, int bold);
+
+// Move h rows of the drawing surface from src_y to dst_y (the areas may
+// overlap).  Only useful when gr_can_flip_rows() is true.
+void gr_move_rows(int src_y, int dst_y, int h);
 int gr_measure(const char *s);
 void gr_font_size(int *x, int *y);
 
@@ -63,6 +95,8 @@ struct input_event;
 typedef int (*ev_callback)(int fd, short revents, void *data);
 typedef int (*ev_set_key_callback)(int code, int value, void *data);
 
+// Input devices under /dev/input are watched from ev_init() on,
+// including ones plugged in later; input_cb gets their events.
 int ev_init(ev_callback input_cb, void *data);
 void ev_exit(void);
 int ev_add_fd(int fd, ev_callback cb, void *data);
@@ -89,7 +123,9 @@ void ev_dispatch(void);
 // interpreted as an alpha mask used to render text in the current
 // color (with gr_text() or gr_texticon()).
 //
-// All these functions load PNG images from "/res/images/${name}.png".
+// All these functions load PNG images from "/res/images/${name}.png",
+// unless the image is in the prepacked bundle made by mkresbundle, in
+// which case the surface refers to the already decoded, mapped pixels.
 
 // Load a single display surface from a PNG image.
 int res_create_display_surface(const char* name, gr_surface* pSurface);
@@ -97,10 +133,25 @@ int res_create_display_surface(const char* name, gr_surface* pSurface);
 // Load an array of display surfaces from a single PNG image.  The PNG
 // should have a 'Frames' text chunk whose value is the number of
 // frames this image represents.  The pixel data itself is interlaced
-// by row.
+// by row.  All frames share one allocation; free them with
+// res_free_multi_surface().
 int res_create_multi_display_surface(const char* name,
                                      int* frames, gr_surface** pSurface);
 
+// Like res_create_multi_display_surface(), but returns as soon as the
+// frame count and size are known and decodes the pixels on a background
+// thread, frame by frame in order.  Frames from the resource bundle are
+// ready immediately.  Call res_wait_frame() before drawing a frame.
+int res_create_multi_display_surface_async(const char* name,
+                                           int* frames, gr_surface** pSurface);
+
+// Whether frame 'frame' of a multi-frame surface has been decoded.
+int res_frame_ready(gr_surface* surface, int frame);
+
+// Block until frame 'frame' has been decoded.  Returns 0, or a negative
+// value if decoding the image failed.
+int res_wait_frame(gr_surface* surface, int frame);
+
 // Load a single alpha surface from a grayscale PNG image.
 int res_create_alpha_surface(const char* name, gr_surface* pSurface);
 
@@ -113,10 +164,18 @@ int res_create_alpha_surface(const char* name, gr_surface* pSurface);
 int res_create_localized_alpha_surface(const char* name, const char* locale,
                                        gr_surface* pSurface);
 
+// Where res_create_*_surface() read images from (default /res/images),
+// and the prepacked bundle they look in first (default
+// /res/images.bundle; NULL to always decode the PNGs).
+void res_set_paths(const char* image_dir, const char* bundle_path);
+
 // Free a surface allocated by any of the res_create_*_surface()
 // functions.
 void res_free_surface(gr_surface surface);
 
+// Free the frames returned by res_create_multi_display_surface(_async).
+void res_free_multi_surface(gr_surface* surface);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Times the minui drawing primitives on the offscreen backend at several
+// resolutions.  screen_ui_bench times ScreenRecoveryUI's screens built
+// from them.
+//
+//   minui_bench [WxH ...] [-f RGBX_8888|BGRA_8888|RGB_565] [-o dump.png]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "minui.h"
+
+// resources.c expects the recovery binary to provide this.
+char* locale = NULL;
+
+static const double kMinSeconds = 0.25;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+typedef void (*bench_fn)(void);
+
+static void run(const char* name, bench_fn fn) {
+    int iterations = 0;
+    double start = now();
+    double elapsed;
+    do {
+        fn();
+        ++iterations;
+        elapsed = now() - start;
+    } while (elapsed < kMinSeconds);
+    printf("  %-24s %10.1f us\n", name, elapsed * 1000000 / iterations);
+}
+
+static int char_width, char_height;
+static GRSurface* icon;
+static const char* kLine = "Installing update... writing system partition";
+
+static void bench_fill_opaque() {
+    gr_color(0, 0, 0, 255);
+    gr_fill(0, 0, gr_fb_width(), gr_fb_height());
+}
+
+static void bench_fill_blend() {
+    gr_color(60, 60, 61, 128);
+    gr_fill(0, 0, gr_fb_width(), gr_fb_height() / 4);
+}
+
+static void bench_clear() {
+    gr_color(0, 0, 64, 255);
+    gr_clear();
+}
+
+static void bench_text() {
+    gr_color(76, 76, 76, 255);
+    gr_text(4, gr_fb_height() / 2, kLine, 0);
+}
+
+static void bench_text_opaque() {
+    gr_color(0, 0, 0, 255);
+    gr_text_background();
+    gr_color(76, 76, 76, 255);
+    gr_text_opaque(4, gr_fb_height() / 2, kLine, 0);
+}
+
+static void bench_blit() {
+    gr_blit(icon, 0, 0, icon->width, icon->height,
+            (gr_fb_width() - icon->width) / 2, (gr_fb_height() - icon->height) / 2);
+}
+
+static void bench_flip() {
+    gr_flip();
+}
+
+static void bench_flip_rows() {
+    gr_flip_rows(gr_fb_height() - char_height, char_height);
+}
+
+static int parse_format(const char* s) {
+    if (strcmp(s, "BGRA_8888") == 0) return GR_FORMAT_BGRA_8888;
+    if (strcmp(s, "RGB_565") == 0) return GR_FORMAT_RGB_565;
+    return GR_FORMAT_RGBX_8888;
+}
+
+int main(int argc, char** argv) {
+    static const char* kDefaultSizes[] = { "480x800", "720x1280", "1080x1920", "1440x2560" };
+    const char* sizes[16];
+    int num_sizes = 0;
+    int format = GR_FORMAT_RGBX_8888;
+    const char* dump = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            format = parse_format(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            dump = argv[++i];
+        } else if (num_sizes < 16) {
+            sizes[num_sizes++] = argv[i];
+        }
+    }
+    if (num_sizes == 0) {
+        num_sizes = sizeof(kDefaultSizes) / sizeof(kDefaultSizes[0]);
+        memcpy(sizes, kDefaultSizes, sizeof(kDefaultSizes));
+    }
+
+    for (int i = 0; i < num_sizes; ++i) {
+        int w, h;
+        if (sscanf(sizes[i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+            fprintf(stderr, "bad size \"%s\"\n", sizes[i]);
+            return 1;
+        }
+
+        gr_use_memory_backend(w, h, format);
+        if (gr_init() != 0) {
+            fprintf(stderr, "gr_init failed for %s\n", sizes[i]);
+            return 1;
+        }
+        gr_font_size(&char_width, &char_height);
+
+        // A stand-in for the installing icon.
+        icon = malloc(sizeof(GRSurface));
+        icon->width = icon->height = 256;
+        icon->pixel_bytes = 4;
+        icon->row_bytes = icon->width * 4;
+        icon->data = malloc(icon->height * icon->row_bytes);
+        for (int j = 0; j < icon->height * icon->row_bytes; ++j) {
+            icon->data[j] = j * 7;
+        }
+
+        printf("%s:\n", sizes[i]);
+        run("gr_fill (opaque)", bench_fill_opaque);
+        run("gr_fill (blended)", bench_fill_blend);
+        run("gr_clear", bench_clear);
+        run("gr_text", bench_text);
+        run("gr_text_opaque", bench_text_opaque);
+        run("gr_blit 256x256", bench_blit);
+        run("gr_flip", bench_flip);
+        run("gr_flip_rows (1 line)", bench_flip_rows);
+
+        if (dump != NULL && i == num_sizes - 1) {
+            int n = strlen(dump);
+            int result = (n > 4 && strcmp(dump + n - 4, ".ppm") == 0) ?
+                gr_dump_ppm(dump) : gr_dump_png(dump);
+            if (result != 0) fprintf(stderr, "failed to write %s\n", dump);
+        }
+
+        free(icon->data);
+        free(icon);
+        gr_exit();
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Packs the PNGs in a res/images directory into a resource bundle (see
+// res_bundle.h), decoding them with the same code recovery would use.
+//
+//   mkresbundle <image dir> <output file>
+//
+// Images named *_text are localized text images, "font" is the font
+// alpha mask, and everything else is a (possibly multi-frame) display
+// image.
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <png.h>
+
+#include "minui.h"
+#include "res_bundle.h"
+
+// resources.c expects the recovery binary to provide this.
+char* locale = NULL;
+
+typedef struct {
+    res_bundle_entry entry;
+    unsigned char* data;
+    size_t size;
+} packed;
+
+static packed* items = NULL;
+static int num_items = 0;
+static int max_items = 0;
+
+static packed* add_item(const char* name, uint32_t kind, uint32_t src_size, uint32_t src_crc) {
+    if (num_items == max_items) {
+        max_items = max_items ? max_items * 2 : 32;
+        items = realloc(items, max_items * sizeof(packed));
+        if (items == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    packed* p = &items[num_items++];
+    memset(p, 0, sizeof(*p));
+    strncpy(p->entry.name, name, sizeof(p->entry.name) - 1);
+    p->entry.kind = kind;
+    p->entry.frames = 1;
+    p->entry.src_size = src_size;
+    p->entry.src_crc = src_crc;
+    return p;
+}
+
+static void set_surface(packed* p, gr_surface s, uint32_t frames) {
+    p->entry.frames = frames;
+    p->entry.width = s->width;
+    p->entry.height = s->height;
+    p->entry.row_bytes = s->row_bytes;
+    p->entry.pixel_bytes = s->pixel_bytes;
+    p->size = (size_t) s->row_bytes * s->height * frames;
+    p->data = malloc(p->size ? p->size : 1);
+}
+
+static int pack_display(const char* name, uint32_t src_size, uint32_t src_crc) {
+    int frames;
+    gr_surface* surfaces;
+    int result = res_create_multi_display_surface(name, &frames, &surfaces);
+    if (result < 0) return result;
+
+    packed* p = add_item(name, RES_BUNDLE_DISPLAY, src_size, src_crc);
+    set_surface(p, surfaces[0], frames);
+    size_t frame_size = p->size / frames;
+    int i;
+    for (i = 0; i < frames; ++i) {
+        memcpy(p->data + i * frame_size, surfaces[i]->data, frame_size);
+    }
+    res_free_multi_surface(surfaces);
+    return 0;
+}
+
+static int pack_alpha(const char* name, uint32_t src_size, uint32_t src_crc) {
+    gr_surface surface;
+    int result = res_create_alpha_surface(name, &surface);
+    if (result < 0) return result;
+
+    packed* p = add_item(name, RES_BUNDLE_ALPHA, src_size, src_crc);
+    set_surface(p, surface, 1);
+    memcpy(p->data, surface->data, p->size);
+    res_free_surface(surface);
+    return 0;
+}
+
+// Adds an entry for every locale in a localized text image, in the
+// order they appear.  The row format is the one
+// res_create_localized_alpha_surface() reads.
+static int pack_localized(const char* dir, const char* name, uint32_t src_size, uint32_t src_crc) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s.png", dir, name);
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return -1;
+
+    int result = -1;
+    unsigned char* row = NULL;
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = png_ptr ? png_create_info_struct(png_ptr) : NULL;
+    if (info_ptr == NULL) goto exit;
+    if (setjmp(png_jmpbuf(png_ptr))) goto exit;
+
+    png_init_io(png_ptr, fp);
+    png_read_info(png_ptr, info_ptr);
+    png_uint_32 width, height;
+    int bit_depth, color_type;
+    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type,
+                 NULL, NULL, NULL);
+    if (png_get_channels(png_ptr, info_ptr) != 1 || color_type != PNG_COLOR_TYPE_GRAY) {
+        fprintf(stderr, "%s: localized images must be grayscale\n", path);
+        goto exit;
+    }
+    png_set_expand_gray_1_2_4_to_8(png_ptr);
+
+    row = malloc(width);
+    png_uint_32 y;
+    for (y = 0; y < height; ++y) {
+        png_read_row(png_ptr, row, NULL);
+        int w = (row[1] << 8) | row[0];
+        int h = (row[3] << 8) | row[2];
+        const char* loc = (const char*) row + 5;
+        if (w > (int) width || y + 1 + h > height) {
+            fprintf(stderr, "%s: bad locale row at %u\n", path, y);
+            goto exit;
+        }
+
+        packed* p = add_item(name, RES_BUNDLE_LOCALIZED, src_size, src_crc);
+        strncpy(p->entry.locale, loc, sizeof(p->entry.locale) - 1);
+        p->entry.width = w;
+        p->entry.height = h;
+        p->entry.row_bytes = w;
+        p->entry.pixel_bytes = 1;
+        p->size = (size_t) w * h;
+        p->data = malloc(p->size ? p->size : 1);
+
+        int i;
+        for (i = 0; i < h; ++i, ++y) {
+            png_read_row(png_ptr, row, NULL);
+            memcpy(p->data + i * w, row, w);
+        }
+    }
+    result = 0;
+
+exit:
+    png_destroy_read_struct(&png_ptr, info_ptr ? &info_ptr : NULL, NULL);
+    free(row);
+    fclose(fp);
+    return result;
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <image dir> <output file>\n", argv[0]);
+        return 2;
+    }
+    const char* dir = argv[1];
+    res_set_paths(dir, NULL);
+
+    // Sorted, so the same images always give the same bundle.
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        perror(dir);
+        return 1;
+    }
+    char* names[256];
+    int num_names = 0;
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL && num_names < 256) {
+        size_t len = strlen(de->d_name);
+        if (len > 4 && strcmp(de->d_name + len - 4, ".png") == 0) {
+            names[num_names++] = strndup(de->d_name, len - 4);
+        }
+    }
+    closedir(d);
+    qsort(names, num_names, sizeof(names[0]), compare_names);
+
+    int i;
+    for (i = 0; i < num_names; ++i) {
+        const char* name = names[i];
+        if (strlen(name) >= sizeof(((res_bundle_entry*) 0)->name)) {
+            fprintf(stderr, "%s: name too long, skipped\n", name);
+            continue;
+        }
+
+        char path[PATH_MAX];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s.png", dir, name);
+        uint32_t crc;
+        if (stat(path, &st) < 0 || res_bundle_file_crc(path, &crc) < 0) {
+            perror(path);
+            return 1;
+        }
+
+        size_t len = strlen(name);
+        int result;
+        if (len > 5 && strcmp(name + len - 5, "_text") == 0) {
+            result = pack_localized(dir, name, st.st_size, crc);
+        } else if (strcmp(name, "font") == 0) {
+            result = pack_alpha(name, st.st_size, crc);
+        } else {
+            result = pack_display(name, st.st_size, crc);
+        }
+        if (result < 0) {
+            fprintf(stderr, "%s: failed to load (%d)\n", path, result);
+            return 1;
+        }
+    }
+
+    res_bundle_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RES_BUNDLE_MAGIC;
+    header.version = RES_BUNDLE_VERSION;
+    header.count = num_items;
+
+    size_t offset = sizeof(header) + num_items * sizeof(res_bundle_entry);
+    for (i = 0; i < num_items; ++i) {
+        offset = (offset + RES_BUNDLE_ALIGN - 1) & ~(size_t) (RES_BUNDLE_ALIGN - 1);
+        items[i].entry.offset = offset;
+        offset += items[i].size;
+    }
+
+    FILE* out = fopen(argv[2], "wb");
+    if (out == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    for (i = 0; i < num_items; ++i) {
+        fwrite(&items[i].entry, sizeof(items[i].entry), 1, out);
+    }
+    static const unsigned char zeros[RES_BUNDLE_ALIGN] = { 0 };
+    long pos = ftell(out);
+    for (i = 0; i < num_items; ++i) {
+        fwrite(zeros, 1, items[i].entry.offset - pos, out);
+        fwrite(items[i].data, 1, items[i].size, out);
+        pos = items[i].entry.offset + items[i].size;
+    }
+    if (fclose(out) != 0) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    printf("%s: %d images, %ld bytes\n", argv[2], num_items, pos);
+    return 0;
+}
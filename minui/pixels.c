@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#if defined(MINUI_HAVE_NEON) && defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "pixels.h"
+
+static void scalar_blend(const unsigned char* src_p, int src_row_bytes,
+                         unsigned char* dst_p, int dst_row_bytes,
+                         int width, int height, const unsigned char* color)
+{
+    int i, j;
+    for (j = 0; j < height; ++j) {
+        const unsigned char* sx = src_p;
+        unsigned char* px = dst_p;
+        for (i = 0; i < width; ++i) {
+            unsigned char a = *sx++;
+            if (color[3] < 255) a = ((int)a * color[3]) / 255;
+            if (a == 255) {
+                *px++ = color[0];
+                *px++ = color[1];
+                *px++ = color[2];
+                px++;
+            } else if (a > 0) {
+                *px = (*px * (255-a) + color[0] * a) / 255;
+                ++px;
+                *px = (*px * (255-a) + color[1] * a) / 255;
+                ++px;
+                *px = (*px * (255-a) + color[2] * a) / 255;
+                ++px;
+                ++px;
+            } else {
+                px += 4;
+            }
+        }
+        src_p += src_row_bytes;
+        dst_p += dst_row_bytes;
+    }
+}
+
+static void scalar_fill(unsigned char* p, int dst_row_bytes,
+                        int width, int height, const unsigned char* color)
+{
+    int x, y;
+    unsigned char a = color[3];
+    if (a == 255) {
+        for (y = 0; y < height; ++y) {
+            unsigned char* px = p;
+            for (x = 0; x < width; ++x) {
+                *px++ = color[0];
+                *px++ = color[1];
+                *px++ = color[2];
+                px++;
+            }
+            p += dst_row_bytes;
+        }
+    } else if (a > 0) {
+        for (y = 0; y < height; ++y) {
+            unsigned char* px = p;
+            for (x = 0; x < width; ++x) {
+                *px = (*px * (255-a) + color[0] * a) / 255;
+                ++px;
+                *px = (*px * (255-a) + color[1] * a) / 255;
+                ++px;
+                *px = (*px * (255-a) + color[2] * a) / 255;
+                ++px;
+                ++px;
+            }
+            p += dst_row_bytes;
+        }
+    }
+}
+
+void gr_pixel_blit_rows(const unsigned char* src, int src_row_bytes,
+                        unsigned char* dst, int dst_row_bytes,
+                        int row_len, int height)
+{
+    if (height <= 0) return;
+
+    // Full-width copies between identical layouts are one contiguous run.
+    if (src_row_bytes == row_len && dst_row_bytes == row_len) {
+        memcpy(dst, src, (size_t)row_len * height);
+        return;
+    }
+
+    int i;
+    for (i = 0; i < height; ++i) {
+        memcpy(dst, src, row_len);
+        src += src_row_bytes;
+        dst += dst_row_bytes;
+    }
+}
+
+const gr_pixel_ops gr_pixel_ops_scalar = {
+    .name = "scalar",
+    .blend = scalar_blend,
+    .fill = scalar_fill,
+    .blit = gr_pixel_blit_rows,
+};
+
+#if defined(MINUI_HAVE_NEON) && defined(__arm__)
+static int cpu_has_neon(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+}
+#endif
+
+const gr_pixel_ops* gr_pixel_ops_select(void)
+{
+#if defined(MINUI_HAVE_NEON)
+#if defined(__arm__)
+    // NEON is optional on ARMv7, so the kernels live in their own
+    // object and are only used when the kernel reports support.
+    if (cpu_has_neon()) return &gr_pixel_ops_neon;
+#else
+    return &gr_pixel_ops_neon;
+#endif
+#endif
+#if defined(MINUI_HAVE_SSE2)
+    // SSE2 is part of every x86 ABI Android supports.
+    return &gr_pixel_ops_sse2;
+#endif
+    return &gr_pixel_ops_scalar;
+}
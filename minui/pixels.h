@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MINUI_PIXELS_H_
+#define _MINUI_PIXELS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Inner loops of the drawing primitives.  Destination pixels are always
+// 4 bytes; the first three bytes are written and the fourth is left
+// alone.  'color' points at {r, g, b, a}.
+//
+// Every implementation must produce exactly the same output as the
+// scalar one, which is kept as the reference.
+typedef struct {
+    const char* name;
+
+    // Blends 'color' into dst using the 8-bit coverage values in src,
+    // each scaled by the color's alpha (text and icon drawing).
+    void (*blend)(const unsigned char* src, int src_row_bytes,
+                  unsigned char* dst, int dst_row_bytes,
+                  int width, int height, const unsigned char* color);
+
+    // Fills a rectangle with 'color', blending by its alpha if that is
+    // less than 255.
+    void (*fill)(unsigned char* dst, int dst_row_bytes,
+                 int width, int height, const unsigned char* color);
+
+    // Copies 'height' rows of 'row_len' bytes.
+    void (*blit)(const unsigned char* src, int src_row_bytes,
+                 unsigned char* dst, int dst_row_bytes,
+                 int row_len, int height);
+} gr_pixel_ops;
+
+extern const gr_pixel_ops gr_pixel_ops_scalar;
+#ifdef MINUI_HAVE_SSE2
+extern const gr_pixel_ops gr_pixel_ops_sse2;
+#endif
+#ifdef MINUI_HAVE_NEON
+extern const gr_pixel_ops gr_pixel_ops_neon;
+#endif
+
+// Returns the fastest implementation the running CPU supports.
+const gr_pixel_ops* gr_pixel_ops_select(void);
+
+// Shared by all implementations; memcpy is already vectorized by libc.
+void gr_pixel_blit_rows(const unsigned char* src, int src_row_bytes,
+                        unsigned char* dst, int dst_row_bytes,
+                        int row_len, int height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
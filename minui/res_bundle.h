@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MINUI_RES_BUNDLE_H_
+#define _MINUI_RES_BUNDLE_H_
+
+#include <stdint.h>
+
+// Layout of the resource bundle written by mkresbundle and mapped by
+// resources.c: the images from res/images already decoded into the
+// surfaces res_create_*_surface() would build, so loading one is just
+// a lookup in the mapped file.
+//
+//   res_bundle_header
+//   res_bundle_entry[count]
+//   pixel data, each entry's starting on a RES_BUNDLE_ALIGN boundary
+//
+// All fields are little-endian, like every device this runs on.
+
+#define RES_BUNDLE_MAGIC    0x4c444e42      // "BNDL"
+#define RES_BUNDLE_VERSION  2
+#define RES_BUNDLE_ALIGN    16
+
+// What an entry stands in for.
+enum {
+    RES_BUNDLE_DISPLAY = 1,     // res_create_(multi_)display_surface()
+    RES_BUNDLE_ALPHA,           // res_create_alpha_surface()
+    RES_BUNDLE_LOCALIZED,       // one locale of res_create_localized_alpha_surface()
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+} res_bundle_header;
+
+typedef struct {
+    char name[48];          // image name, without ".png"
+    char locale[16];        // RES_BUNDLE_LOCALIZED only
+    uint32_t kind;
+    uint32_t frames;        // frames stored one after another
+    uint32_t width;         // of one frame
+    uint32_t height;
+    uint32_t row_bytes;
+    uint32_t pixel_bytes;
+    uint32_t offset;        // of the pixel data, from the start of the file
+    uint32_t src_size;      // size of the PNG it was made from
+    uint32_t src_crc;       // and the CRC-32 of its contents
+} res_bundle_entry;
+
+// CRC-32 of the file at 'path', as recorded in src_crc.  Returns 0, or
+// -1 if the file can't be read.
+int res_bundle_file_crc(const char* path, uint32_t* crc);
+
+#endif
@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -22,14 +24,17 @@
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <linux/fb.h>
 #include <linux/kd.h>
 
 #include <png.h>
+#include <zlib.h>
 
 #include "minui.h"
+#include "res_bundle.h"
 
 #ifdef SHARED_MINUI
 char *locale = NULL;
@@ -39,6 +44,128 @@ extern char* locale;
 
 #define SURFACE_DATA_ALIGNMENT 8
 
+static const char* res_image_dir = "/res/images";
+static const char* res_bundle_path = "/res/images.bundle";
+
+// The prepacked bundle (see res_bundle.h), mapped on first use.
+static unsigned char* bundle_map = NULL;
+static size_t bundle_size = 0;
+static int bundle_state = 0;    // 0: not tried yet, 1: mapped, -1: unavailable
+
+void res_set_paths(const char* image_dir, const char* bundle_path) {
+    res_image_dir = image_dir;
+    res_bundle_path = bundle_path;
+    if (bundle_map != NULL) munmap(bundle_map, bundle_size);
+    bundle_map = NULL;
+    bundle_size = 0;
+    bundle_state = 0;
+}
+
+static const res_bundle_header* open_bundle() {
+    if (bundle_state == 0) {
+        bundle_state = -1;
+        if (res_bundle_path == NULL) return NULL;
+
+        int fd = open(res_bundle_path, O_RDONLY);
+        if (fd < 0) return NULL;
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(res_bundle_header)) {
+            close(fd);
+            return NULL;
+        }
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return NULL;
+
+        const res_bundle_header* header = (const res_bundle_header*) map;
+        if (header->magic != RES_BUNDLE_MAGIC || header->version != RES_BUNDLE_VERSION ||
+            header->count > (st.st_size - sizeof(*header)) / sizeof(res_bundle_entry)) {
+            printf("ignoring bad resource bundle %s\n", res_bundle_path);
+            munmap(map, st.st_size);
+            return NULL;
+        }
+        bundle_map = (unsigned char*) map;
+        bundle_size = st.st_size;
+        bundle_state = 1;
+    }
+    return bundle_state == 1 ? (const res_bundle_header*) bundle_map : NULL;
+}
+
+static int matches_locale(const char* loc, const char* locale);
+
+int res_bundle_file_crc(const char* path, uint32_t* crc) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    unsigned char buf[8192];
+    uLong c = crc32(0L, Z_NULL, 0);
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        c = crc32(c, buf, n);
+    }
+    close(fd);
+    if (n < 0) return -1;
+    *crc = (uint32_t) c;
+    return 0;
+}
+
+// Find the bundle entry standing in for image 'name' loaded as 'kind'.
+// For localized images, that's the first entry matching 'locale', or
+// else the last one, just as the PNG rows are searched.  Entries made
+// from a different PNG than the one in res_image_dir -- by size, then
+// by the CRC of its contents -- are ignored, so a stale bundle can't
+// show the wrong image.
+static const res_bundle_entry* find_bundle_entry(const char* name, uint32_t kind,
+                                                 const char* locale) {
+    const res_bundle_header* header = open_bundle();
+    if (header == NULL) return NULL;
+
+    const res_bundle_entry* entries = (const res_bundle_entry*) (header + 1);
+    const res_bundle_entry* found = NULL;
+    uint32_t i;
+    for (i = 0; i < header->count; ++i) {
+        const res_bundle_entry* e = entries + i;
+        if (e->kind != kind || strncmp(e->name, name, sizeof(e->name)) != 0) continue;
+
+        size_t size = (size_t) e->row_bytes * e->height * e->frames;
+        if (e->offset > bundle_size || size > bundle_size - e->offset) return NULL;
+
+        found = e;
+        if (kind == RES_BUNDLE_LOCALIZED) {
+            char loc[sizeof(e->locale) + 1];
+            memcpy(loc, e->locale, sizeof(e->locale));
+            loc[sizeof(e->locale)] = '\0';
+            if (!matches_locale(loc, locale)) continue;
+        }
+        break;
+    }
+    if (found == NULL) return NULL;
+
+    char path[256];
+    struct stat st;
+    uint32_t crc;
+    snprintf(path, sizeof(path), "%s/%s.png", res_image_dir, name);
+    if (stat(path, &st) == 0 &&
+        ((uint32_t) st.st_size != found->src_size ||
+         (res_bundle_file_crc(path, &crc) == 0 && crc != found->src_crc))) {
+        printf("resource bundle entry for %s is stale\n", name);
+        return NULL;
+    }
+    return found;
+}
+
+// A surface for one frame of a bundle entry, using the mapped pixels.
+static gr_surface bundle_surface(const res_bundle_entry* e, uint32_t frame) {
+    gr_surface surface = malloc(sizeof(GRSurface));
+    if (surface == NULL) return NULL;
+    surface->width = e->width;
+    surface->height = e->height;
+    surface->row_bytes = e->row_bytes;
+    surface->pixel_bytes = e->pixel_bytes;
+    surface->data = bundle_map + e->offset + frame * e->row_bytes * e->height;
+    return surface;
+}
+
 static gr_surface malloc_surface(size_t data_size) {
     unsigned char* temp = malloc(sizeof(GRSurface) + data_size + SURFACE_DATA_ALIGNMENT);
     if (temp == NULL) return NULL;
@@ -54,7 +181,7 @@ static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
     unsigned char header[8];
     int result = 0;
 
-    snprintf(resPath, sizeof(resPath)-1, "/res/images/%s.png", name);
+    snprintf(resPath, sizeof(resPath)-1, "%s/%s.png", res_image_dir, name);
     resPath[sizeof(resPath)-1] = '\0';
     FILE* fp = fopen(resPath, "rb");
     if (fp == NULL) {
@@ -210,6 +337,12 @@ int res_create_display_surface(const char* name, gr_surface* pSurface) {
 
     *pSurface = NULL;
 
+    const res_bundle_entry* e = find_bundle_entry(name, RES_BUNDLE_DISPLAY, NULL);
+    if (e != NULL && e->frames == 1) {
+        *pSurface = bundle_surface(e, 0);
+        return *pSurface ? 0 : -8;
+    }
+
     result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels);
     if (result < 0) return result;
 
@@ -235,8 +368,108 @@ int res_create_display_surface(const char* name, gr_surface* pSurface) {
     return result;
 }
 
-int res_create_multi_display_surface(const char* name, int* frames, gr_surface** pSurface) {
-    gr_surface* surface = NULL;
+// The frames of a multi-frame image share one allocation: this header,
+// the gr_surface array handed to the caller, a GRSurface per frame, and
+// then the pixels of every frame.  When the frames come from a PNG, a
+// background thread decodes them and 'ready' counts how many (always the
+// first ones, in order) are complete.
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int frames;
+    int ready;
+    int result;
+    png_structp png_ptr;
+    png_infop info_ptr;
+    png_byte channels;
+    gr_surface surface[];
+} multi_surface;
+
+static multi_surface* to_multi_surface(gr_surface* surface) {
+    return (multi_surface*) ((char*) surface - offsetof(multi_surface, surface));
+}
+
+// Allocate a multi_surface with 'frame_size' bytes of pixels per frame
+// (0 when the pixels live elsewhere).
+static multi_surface* malloc_multi_surface(int frames, size_t frame_size) {
+    size_t header = sizeof(multi_surface) + frames * (sizeof(gr_surface) + sizeof(GRSurface));
+    header = (header + SURFACE_DATA_ALIGNMENT - 1) & ~(size_t) (SURFACE_DATA_ALIGNMENT - 1);
+    multi_surface* m = malloc(header + frames * frame_size);
+    if (m == NULL) return NULL;
+
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cond, NULL);
+    m->frames = frames;
+    m->ready = 0;
+    m->result = 0;
+    m->png_ptr = NULL;
+    m->info_ptr = NULL;
+    m->channels = 0;
+
+    GRSurface* frame = (GRSurface*) (m->surface + frames);
+    unsigned char* data = (unsigned char*) m + header;
+    int i;
+    for (i = 0; i < frames; ++i) {
+        m->surface[i] = frame + i;
+        frame[i].data = data + i * frame_size;
+    }
+    return m;
+}
+
+static void* decode_frames_thread(void* cookie) {
+    multi_surface* m = (multi_surface*) cookie;
+    png_structp png_ptr = m->png_ptr;
+    png_infop info_ptr = m->info_ptr;
+    int frames = m->frames;
+    int width = m->surface[0]->width;
+    int frame_height = m->surface[0]->height;
+    int result = 0;
+
+    unsigned char* p_row = malloc(width * 4);
+    if (p_row == NULL) {
+        result = -8;
+    } else if (setjmp(png_jmpbuf(png_ptr))) {
+        result = -6;
+    } else {
+        int y;
+        for (y = 0; y < frame_height * frames; ++y) {
+            png_read_row(png_ptr, p_row, NULL);
+            int frame = y % frames;
+            unsigned char* out_row = m->surface[frame]->data +
+                (y / frames) * m->surface[frame]->row_bytes;
+            transform_rgb_to_draw(p_row, out_row, m->channels, width);
+
+            // The rows of the frames are interlaced, so a frame is done
+            // when its last row is.
+            if (y / frames == frame_height - 1) {
+                pthread_mutex_lock(&m->lock);
+                m->ready = frame + 1;
+                pthread_cond_broadcast(&m->cond);
+                pthread_mutex_unlock(&m->lock);
+            }
+        }
+    }
+    free(p_row);
+
+    FILE* fp = (FILE*) png_get_io_ptr(png_ptr);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    if (fp != NULL) fclose(fp);
+
+    pthread_mutex_lock(&m->lock);
+    m->png_ptr = NULL;
+    m->info_ptr = NULL;
+    if (result < 0) {
+        printf("failed to decode frames (%d)\n", result);
+        m->result = result;
+    }
+    pthread_cond_broadcast(&m->cond);
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+int res_create_multi_display_surface_async(const char* name, int* frames,
+                                           gr_surface** pSurface) {
+    multi_surface* m = NULL;
     int result = 0;
     png_structp png_ptr = NULL;
     png_infop info_ptr = NULL;
@@ -247,68 +480,130 @@ int res_create_multi_display_surface(const char* name, int* frames, gr_surface**
     *pSurface = NULL;
     *frames = -1;
 
+    const res_bundle_entry* e = find_bundle_entry(name, RES_BUNDLE_DISPLAY, NULL);
+    if (e != NULL) {
+        m = malloc_multi_surface(e->frames, 0);
+        if (m == NULL) return -8;
+        for (i = 0; i < (int) e->frames; ++i) {
+            m->surface[i]->width = e->width;
+            m->surface[i]->height = e->height;
+            m->surface[i]->row_bytes = e->row_bytes;
+            m->surface[i]->pixel_bytes = e->pixel_bytes;
+            m->surface[i]->data = bundle_map + e->offset + i * e->row_bytes * e->height;
+        }
+        m->ready = e->frames;
+        *frames = e->frames;
+        *pSurface = m->surface;
+        return 0;
+    }
+
     result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels);
     if (result < 0) return result;
 
-    *frames = 1;
+    int count = 1;
     png_textp text;
     int num_text;
     if (png_get_text(png_ptr, info_ptr, &text, &num_text)) {
         for (i = 0; i < num_text; ++i) {
             if (text[i].key && strcmp(text[i].key, "Frames") == 0 && text[i].text) {
-                *frames = atoi(text[i].text);
+                count = atoi(text[i].text);
                 break;
             }
         }
-        printf("  found frames = %d\n", *frames);
+        printf("  found frames = %d\n", count);
     }
 
-    if (height % *frames != 0) {
-        printf("bad height (%d) for frame count (%d)\n", height, *frames);
+    if (count <= 0 || height % count != 0) {
+        printf("bad height (%d) for frame count (%d)\n", height, count);
         result = -9;
         goto exit;
     }
 
-    surface = malloc(*frames * sizeof(gr_surface));
-    if (surface == NULL) {
+    m = malloc_multi_surface(count, (size_t) width * (height / count) * 4);
+    if (m == NULL) {
         result = -8;
         goto exit;
     }
-    for (i = 0; i < *frames; ++i) {
-        surface[i] = init_display_surface(width, height / *frames);
-        if (surface[i] == NULL) {
-            result = -8;
-            goto exit;
-        }
+    for (i = 0; i < count; ++i) {
+        m->surface[i]->width = width;
+        m->surface[i]->height = height / count;
+        m->surface[i]->row_bytes = width * 4;
+        m->surface[i]->pixel_bytes = 4;
     }
-
-    unsigned char* p_row = malloc(width * 4);
-    unsigned int y;
-    for (y = 0; y < height; ++y) {
-        png_read_row(png_ptr, p_row, NULL);
-        int frame = y % *frames;
-        unsigned char* out_row = surface[frame]->data +
-            (y / *frames) * surface[frame]->row_bytes;
-        transform_rgb_to_draw(p_row, out_row, channels, width);
+    m->png_ptr = png_ptr;
+    m->info_ptr = info_ptr;
+    m->channels = channels;
+
+    // The decoder thread owns the PNG from here on.  If it can't be
+    // started, decode right here instead.
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, decode_frames_thread, m) != 0) {
+        decode_frames_thread(m);
     }
-    free(p_row);
+    pthread_attr_destroy(&attr);
 
-    *pSurface = (gr_surface*) surface;
+    *frames = count;
+    *pSurface = m->surface;
+    return 0;
 
 exit:
     png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    return result;
+}
 
+int res_create_multi_display_surface(const char* name, int* frames, gr_surface** pSurface) {
+    int result = res_create_multi_display_surface_async(name, frames, pSurface);
+    if (result < 0) return result;
+
+    result = res_wait_frame(*pSurface, *frames - 1);
     if (result < 0) {
-        if (surface) {
-            for (i = 0; i < *frames; ++i) {
-                if (surface[i]) free(surface[i]);
-            }
-            free(surface);
-        }
+        res_free_multi_surface(*pSurface);
+        *pSurface = NULL;
+        *frames = -1;
+    }
+    return result;
+}
+
+int res_frame_ready(gr_surface* surface, int frame) {
+    multi_surface* m = to_multi_surface(surface);
+    pthread_mutex_lock(&m->lock);
+    int ready = frame < m->ready;
+    pthread_mutex_unlock(&m->lock);
+    return ready;
+}
+
+int res_wait_frame(gr_surface* surface, int frame) {
+    multi_surface* m = to_multi_surface(surface);
+    if (frame < 0 || frame >= m->frames) return -1;
+
+    pthread_mutex_lock(&m->lock);
+    while (frame >= m->ready && m->result == 0) {
+        pthread_cond_wait(&m->cond, &m->lock);
     }
+    int result = frame < m->ready ? 0 : m->result;
+    pthread_mutex_unlock(&m->lock);
     return result;
 }
 
+void res_free_multi_surface(gr_surface* surface) {
+    if (surface == NULL) return;
+    multi_surface* m = to_multi_surface(surface);
+
+    // Let the decoder thread finish with the pixels first.
+    pthread_mutex_lock(&m->lock);
+    while (m->png_ptr != NULL) {
+        pthread_cond_wait(&m->cond, &m->lock);
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
+
 int res_create_alpha_surface(const char* name, gr_surface* pSurface) {
     gr_surface surface = NULL;
     int result = 0;
@@ -319,6 +614,12 @@ int res_create_alpha_surface(const char* name, gr_surface* pSurface) {
 
     *pSurface = NULL;
 
+    const res_bundle_entry* e = find_bundle_entry(name, RES_BUNDLE_ALPHA, NULL);
+    if (e != NULL) {
+        *pSurface = bundle_surface(e, 0);
+        return *pSurface ? 0 : -8;
+    }
+
     result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels);
     if (result < 0) return result;
 
@@ -390,6 +691,12 @@ int res_create_localized_alpha_surface(const char* name,
         goto exit;
     }
 
+    const res_bundle_entry* e = find_bundle_entry(name, RES_BUNDLE_LOCALIZED, locale);
+    if (e != NULL) {
+        *pSurface = bundle_surface(e, 0);
+        return *pSurface ? 0 : -8;
+    }
+
     result = open_png(name, &png_ptr, &info_ptr, &width, &height, &channels);
     if (result < 0) return result;
 
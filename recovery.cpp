@@ -25,21 +25,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "bootloader.h"
 #include "common.h"
 #include "cutils/properties.h"
 #include "cutils/android_reboot.h"
 #include "install.h"
+#include "log_writer.h"
 #include "minui/minui.h"
 #include "minzip/DirUtil.h"
 #include "roots.h"
 #include "ui.h"
 #include "screen_ui.h"
+#include "startup.h"
+#include "verifier.h"
 #include "device.h"
 
 #include "voldclient/voldclient.h"
@@ -81,6 +86,7 @@ static const char *CACHE_ROOT = "/cache";
 static const char *TEMPORARY_LOG_FILE = "/tmp/recovery.log";
 static const char *TEMPORARY_INSTALL_FILE = "/tmp/last_install";
 static const char *SIDELOAD_TEMP_DIR = "/tmp/sideload";
+static const char *STARTUP_TIMELINE_FILE = "/tmp/recovery.timeline";
 
 RecoveryUI* ui = NULL;
 char* locale = NULL;
@@ -97,6 +103,7 @@ char recovery_version[PROPERTY_VALUE_MAX+1];
  * The arguments which may be supplied in the recovery.command file:
  *   --send_intent=anystring - write the text out to recovery.intent
  *   --update_package=path - verify install an OTA package file
+ *       (given more than once, the packages are installed in order)
  *   --wipe_data - erase user data (and cache), then reboot
  *   --wipe_cache - wipe cache (but not user data), then reboot
  *   --set_encrypted_filesystem=on|off - enables / diasables encrypted fs
@@ -256,58 +263,167 @@ set_sdcard_update_bootloader_message() {
     set_bootloader_message(&boot);
 }
 
-// How much of the temp log we have copied to the copy in cache.
-static long tmplog_offset = 0;
+static int
+write_all(int fd, const void* data, size_t len) {
+    const char* p = (const char*)data;
+    while (len > 0) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, p, len));
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+#define LOG_COPY_BUFFER_SIZE (64 * 1024)
+
+// How many previous runs' logs to keep, and how much room their
+// (compressed) copies may take in cache.
+#define KEEP_LOG_COUNT 10
+#define MAX_OLD_LOGS_SIZE (512 * 1024)
+
+// How much of each temp log we have copied to its copy in cache.
+static off_t tmplog_offset = 0;
+static off_t last_log_offset = 0;
 
+// Copy whatever was added to source since *offset to destination.
+// With append, destination collects the log across runs; otherwise it
+// mirrors source, and is only rewritten from the start if it no longer
+// holds exactly what was copied before.  A NULL offset copies all of
+// source over destination.
 static void
-copy_log_file(const char* source, const char* destination, int append) {
-    FILE *log = fopen_path(destination, append ? "a" : "w");
+copy_log_file(const char* source, const char* destination, off_t* offset, bool append) {
+    off_t whole = 0;
+    if (offset == NULL) {
+        offset = &whole;
+        append = false;
+    }
+
+    FILE *log = fopen_path(destination, "a");
     if (log == NULL) {
         LOGE("Can't open %s\n", destination);
-    } else {
-        FILE *tmplog = fopen(source, "r");
-        if (tmplog != NULL) {
-            if (append) {
-                fseek(tmplog, tmplog_offset, SEEK_SET);  // Since last write
-            }
-            char buf[4096];
-            while (fgets(buf, sizeof(buf), tmplog)) fputs(buf, log);
-            if (append) {
-                tmplog_offset = ftell(tmplog);
+        return;
+    }
+    int out = fileno(log);
+
+    struct stat st;
+    if (!append && (*offset == 0 || fstat(out, &st) != 0 || st.st_size != *offset)) {
+        ftruncate(out, 0);
+        *offset = 0;
+    }
+
+    int in = open(source, O_RDONLY);
+    if (in >= 0) {
+        char* buf = (char*)malloc(LOG_COPY_BUFFER_SIZE);
+        off_t pos = *offset;
+        ssize_t n;
+        while (buf != NULL &&
+               (n = TEMP_FAILURE_RETRY(pread(in, buf, LOG_COPY_BUFFER_SIZE, pos))) > 0) {
+            if (write_all(out, buf, n) != 0) {
+                LOGE("Can't write %s (%s)\n", destination, strerror(errno));
+                break;
             }
-            check_and_fclose(tmplog, source);
+            pos += n;
+        }
+        *offset = pos;
+        free(buf);
+        close(in);
+    }
+    fsync(out);
+    check_and_fclose(log, destination);
+}
+
+// Compress src into dst, removing src if that worked.
+static int
+gzip_log(const char* src, const char* dst) {
+    int in = open(src, O_RDONLY);
+    if (in < 0) return -1;
+
+    int ret = -1;
+    gzFile out = gzopen(dst, "wb");
+    char* buf = (char*)malloc(LOG_COPY_BUFFER_SIZE);
+    if (out != NULL && buf != NULL) {
+        ssize_t n;
+        while ((n = TEMP_FAILURE_RETRY(read(in, buf, LOG_COPY_BUFFER_SIZE))) > 0) {
+            if (gzwrite(out, buf, n) != n) break;
         }
-        check_and_fclose(log, destination);
+        ret = n == 0 ? 0 : -1;
+    }
+    if (out != NULL && gzclose(out) != Z_OK) ret = -1;
+    free(buf);
+    close(in);
+
+    if (ret == 0) {
+        unlink(src);
+    } else {
+        unlink(dst);
     }
+    return ret;
 }
 
-// Rename last_log -> last_log.1 -> last_log.2 -> ... -> last_log.$max
-// Overwrites any existing last_log.$max.
+// Rename last_log.1.gz -> last_log.2.gz -> ... -> last_log.$max.gz,
+// overwriting any existing last_log.$max.gz, and compress last_log into
+// last_log.1.gz.  (Uncompressed last_log.N from older recoveries are
+// compressed as they move along, or deleted if a compressed log already
+// holds their place.)  The oldest logs are then dropped until the rest
+// fit in MAX_OLD_LOGS_SIZE.
 static void
 rotate_last_logs(int max) {
     char oldfn[256];
     char newfn[256];
+    char gzfn[256];
+    struct stat st;
 
     int i;
     for (i = max-1; i >= 0; --i) {
+        snprintf(newfn, sizeof(newfn), LAST_LOG_FILE ".%d.gz", i+1);
         snprintf(oldfn, sizeof(oldfn), (i==0) ? LAST_LOG_FILE : (LAST_LOG_FILE ".%d"), i);
-        snprintf(newfn, sizeof(newfn), LAST_LOG_FILE ".%d", i+1);
-        // ignore errors
-        rename(oldfn, newfn);
+        if (i > 0) {
+            snprintf(gzfn, sizeof(gzfn), LAST_LOG_FILE ".%d.gz", i);
+            if (rename(gzfn, newfn) == 0) {
+                unlink(oldfn);
+                continue;
+            }
+        }
+        if (stat(oldfn, &st) == 0) {
+            // ignore errors
+            gzip_log(oldfn, newfn);
+        }
+    }
+    // A plain last_log.$max has no later place to be compressed into.
+    snprintf(oldfn, sizeof(oldfn), LAST_LOG_FILE ".%d", max);
+    unlink(oldfn);
+
+    // Anything left uncompressed (when gzip_log() failed) counts too.
+    off_t total = 0;
+    for (i = 1; i <= max; ++i) {
+        snprintf(oldfn, sizeof(oldfn), LAST_LOG_FILE ".%d.gz", i);
+        snprintf(newfn, sizeof(newfn), LAST_LOG_FILE ".%d", i);
+        const char* names[2] = { oldfn, newfn };
+        for (int j = 0; j < 2; ++j) {
+            if (stat(names[j], &st) != 0) continue;
+            total += st.st_size;
+            if (i > 1 && total > MAX_OLD_LOGS_SIZE) {
+                unlink(names[j]);
+            }
+        }
     }
 }
 
 static void
 copy_logs() {
+    log_flush();
+
     // Copy logs to cache so the system can find out what happened.
-    copy_log_file(TEMPORARY_LOG_FILE, LOG_FILE, true);
-    copy_log_file(TEMPORARY_LOG_FILE, LAST_LOG_FILE, false);
-    copy_log_file(TEMPORARY_INSTALL_FILE, LAST_INSTALL_FILE, false);
+    // Only what was logged since the last copy is written, and each
+    // file is synced on its own.
+    copy_log_file(TEMPORARY_LOG_FILE, LOG_FILE, &tmplog_offset, true);
+    copy_log_file(TEMPORARY_LOG_FILE, LAST_LOG_FILE, &last_log_offset, false);
+    copy_log_file(TEMPORARY_INSTALL_FILE, LAST_INSTALL_FILE, NULL, false);
     chmod(LOG_FILE, 0600);
     chown(LOG_FILE, 1000, 1000);   // system user
     chmod(LAST_LOG_FILE, 0640);
     chmod(LAST_INSTALL_FILE, 0644);
-    sync();
 }
 
 // clear the recovery command and prepare to boot a (hopefully working) system,
@@ -363,6 +479,77 @@ typedef struct _saved_log_file {
     struct _saved_log_file* next;
 } saved_log_file;
 
+// If we're reformatting /cache, we load any "/cache/recovery/last*"
+// files into memory, so we can restore them after the reformat.
+static saved_log_file*
+save_cache_logs() {
+    saved_log_file* head = NULL;
+
+    ensure_path_mounted(CACHE_ROOT);
+
+    DIR* d;
+    struct dirent* de;
+    d = opendir(CACHE_LOG_DIR);
+    if (d) {
+        char path[PATH_MAX];
+        strcpy(path, CACHE_LOG_DIR);
+        strcat(path, "/");
+        int path_len = strlen(path);
+        while ((de = readdir(d)) != NULL) {
+            if (strncmp(de->d_name, "last", 4) == 0) {
+                saved_log_file* p = (saved_log_file*) malloc(sizeof(saved_log_file));
+                strcpy(path+path_len, de->d_name);
+                p->name = strdup(path);
+                if (stat(path, &(p->st)) == 0) {
+                    // truncate files to 512kb
+                    if (p->st.st_size > (1 << 19)) {
+                        p->st.st_size = 1 << 19;
+                    }
+                    p->data = (unsigned char*) malloc(p->st.st_size);
+                    FILE* f = fopen(path, "rb");
+                    fread(p->data, 1, p->st.st_size, f);
+                    fclose(f);
+                    p->next = head;
+                    head = p;
+                } else {
+                    free(p);
+                }
+            }
+        }
+        closedir(d);
+    } else {
+        if (errno != ENOENT) {
+            printf("opendir failed: %s\n", strerror(errno));
+        }
+    }
+
+    return head;
+}
+
+static void
+restore_cache_logs(saved_log_file* head) {
+    while (head) {
+        FILE* f = fopen_path(head->name, "wb");
+        if (f) {
+            fwrite(head->data, 1, head->st.st_size, f);
+            fclose(f);
+            chmod(head->name, head->st.st_mode);
+            chown(head->name, head->st.st_uid, head->st.st_gid);
+        }
+        free(head->name);
+        free(head->data);
+        saved_log_file* temp = head->next;
+        free(head);
+        head = temp;
+    }
+
+    // Any part of the log we'd copied to cache is now gone.
+    // Reset the pointer so we copy from the beginning of the temp
+    // log.
+    tmplog_offset = 0;
+    copy_logs();
+}
+
 static int
 erase_volume(const char *volume) {
     bool is_cache = (strcmp(volume, CACHE_ROOT) == 0);
@@ -373,47 +560,7 @@ erase_volume(const char *volume) {
     saved_log_file* head = NULL;
 
     if (is_cache) {
-        // If we're reformatting /cache, we load any
-        // "/cache/recovery/last*" files into memory, so we can restore
-        // them after the reformat.
-
-        ensure_path_mounted(volume);
-
-        DIR* d;
-        struct dirent* de;
-        d = opendir(CACHE_LOG_DIR);
-        if (d) {
-            char path[PATH_MAX];
-            strcpy(path, CACHE_LOG_DIR);
-            strcat(path, "/");
-            int path_len = strlen(path);
-            while ((de = readdir(d)) != NULL) {
-                if (strncmp(de->d_name, "last", 4) == 0) {
-                    saved_log_file* p = (saved_log_file*) malloc(sizeof(saved_log_file));
-                    strcpy(path+path_len, de->d_name);
-                    p->name = strdup(path);
-                    if (stat(path, &(p->st)) == 0) {
-                        // truncate files to 512kb
-                        if (p->st.st_size > (1 << 19)) {
-                            p->st.st_size = 1 << 19;
-                        }
-                        p->data = (unsigned char*) malloc(p->st.st_size);
-                        FILE* f = fopen(path, "rb");
-                        fread(p->data, 1, p->st.st_size, f);
-                        fclose(f);
-                        p->next = head;
-                        head = p;
-                    } else {
-                        free(p);
-                    }
-                }
-            }
-            closedir(d);
-        } else {
-            if (errno != ENOENT) {
-                printf("opendir failed: %s\n", strerror(errno));
-            }
-        }
+        head = save_cache_logs();
     }
 
     ui->Print("Formatting %s...\n", volume);
@@ -424,33 +571,130 @@ erase_volume(const char *volume) {
     int result = format_volume(volume);
 
     if (is_cache) {
-        while (head) {
-            FILE* f = fopen_path(head->name, "wb");
-            if (f) {
-                fwrite(head->data, 1, head->st.st_size, f);
-                fclose(f);
-                chmod(head->name, head->st.st_mode);
-                chown(head->name, head->st.st_uid, head->st.st_gid);
-            }
-            free(head->name);
-            free(head->data);
-            saved_log_file* temp = head->next;
-            free(head);
-            head = temp;
-        }
+        restore_cache_logs(head);
+    }
 
-        // Any part of the log we'd copied to cache is now gone.
-        // Reset the pointer so we copy from the beginning of the temp
-        // log.
-        tmplog_offset = 0;
-        copy_logs();
+    return result;
+}
+
+static void
+erase_volumes_progress(const char* volume, int result,
+                       int completed, int total, void* cookie) {
+    ui->Print("Formatting %s %s.\n", volume, result == 0 ? "done" : "failed");
+    ui->SetProgress((float)completed / total);
+}
+
+// Like erase_volume(), but formats all of 'volumes' concurrently.
+// Returns 0 if every volume was erased.
+static int
+erase_volumes(const char* const* volumes, int count) {
+    bool has_cache = false;
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(volumes[i], CACHE_ROOT) == 0) has_cache = true;
+    }
+
+    ui->SetBackground(RecoveryUI::ERASING);
+    ui->SetProgressType(RecoveryUI::DETERMINATE);
+    ui->ShowProgress(1.0, 0);
+
+    saved_log_file* head = NULL;
+
+    if (has_cache) {
+        head = save_cache_logs();
+    }
+
+    for (int i = 0; i < count; ++i) {
+        ui->Print("Formatting %s...\n", volumes[i]);
+    }
+
+    int* results = (int*)malloc(count * sizeof(int));
+    int result = format_volumes(volumes, count, results, 0,
+                                erase_volumes_progress, NULL);
+
+    if (has_cache) {
+        restore_cache_logs(head);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (results[i] != 0) {
+            LOGE("Failed to format %s\n", volumes[i]);
+        }
     }
+    free(results);
 
+    ui->SetProgressType(RecoveryUI::EMPTY);
     return result;
 }
 
+// Big enough that the copy runs at the speed of the storage rather
+// than of the syscalls, and page aligned.
+#define COPY_BUFFER_SIZE (1024*1024)
+
+// Copies size bytes from fin to fout, hashing what the package's
+// signature covers on the way so verification needn't read the copy
+// back.  Returns -1 with errno set on failure.
+static int
+copy_package_data(int fin, int fout, off_t size, PackageDigest* digest) {
+  ui->SetProgressType(RecoveryUI::DETERMINATE);
+  ui->ShowProgress(1.0, 0);
+  posix_fadvise(fin, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  double frac = -1.0;
+  off_t so_far = 0;
+
+  // A package without a signature footer will fail verification
+  // however it's copied, so leave the copy to the kernel.
+  unsigned char footer[6];
+  if (size < (off_t)sizeof(footer) ||
+      pread(fin, footer, sizeof(footer), size - sizeof(footer)) != sizeof(footer) ||
+      package_digest_init(digest, size, footer) != 0) {
+    memset(digest, 0, sizeof(*digest));
+    while (so_far < size) {
+      size_t chunk = size - so_far < 0x40000000 ? size - so_far : 0x40000000;
+      ssize_t n = sendfile(fout, fin, NULL, chunk);
+      if (n <= 0) {
+        if (n == 0) errno = EIO;
+        return -1;
+      }
+      so_far += n;
+      ui->SetProgress(so_far / (double)size);
+    }
+    return 0;
+  }
+
+  void* buffer;
+  if (posix_memalign(&buffer, 4096, COPY_BUFFER_SIZE) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+  for (;;) {
+    ssize_t n = TEMP_FAILURE_RETRY(read(fin, buffer, COPY_BUFFER_SIZE));
+    if (n == 0) break;
+    if (n < 0 || write_all(fout, buffer, n) != 0) {
+      free(buffer);
+      return -1;
+    }
+    package_digest_update(digest, buffer, n);
+    so_far += n;
+    double f = so_far / (double)size;
+    if (f > frac + 0.02) {
+      ui->SetProgress(f);
+      frac = f;
+    }
+  }
+  free(buffer);
+
+  // If the file changed size under us the digests won't match what
+  // verification finds, and it will hash the copy itself.
+  package_digest_final(digest);
+  return 0;
+}
+
+// Copies the package to SIDELOAD_TEMP_DIR as 'name', filling in digest
+// as it goes.
 static char*
-copy_sideloaded_package(const char* original_path) {
+copy_sideloaded_package(const char* original_path, const char* name,
+                        PackageDigest* digest) {
   if (ensure_path_mounted(original_path) != 0) {
     LOGE("Can't mount %s\n", original_path);
     return NULL;
@@ -489,43 +733,37 @@ copy_sideloaded_package(const char* original_path) {
   }
 
   char copy_path[PATH_MAX];
-  strcpy(copy_path, SIDELOAD_TEMP_DIR);
-  strcat(copy_path, "/package.zip");
+  snprintf(copy_path, sizeof(copy_path), "%s/%s", SIDELOAD_TEMP_DIR, name);
 
-  char* buffer = (char*)malloc(BUFSIZ);
-  if (buffer == NULL) {
-    LOGE("Failed to allocate buffer\n");
+  int fin = open(original_path, O_RDONLY);
+  if (fin < 0) {
+    LOGE("Failed to open %s (%s)\n", original_path, strerror(errno));
     return NULL;
   }
-
-  size_t read;
-  FILE* fin = fopen(original_path, "rb");
-  if (fin == NULL) {
-    LOGE("Failed to open %s (%s)\n", original_path, strerror(errno));
+  if (fstat(fin, &st) != 0) {
+    LOGE("Failed to stat %s (%s)\n", original_path, strerror(errno));
+    close(fin);
     return NULL;
   }
-  FILE* fout = fopen(copy_path, "wb");
-  if (fout == NULL) {
+  int fout = open(copy_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fout < 0) {
     LOGE("Failed to open %s (%s)\n", copy_path, strerror(errno));
+    close(fin);
     return NULL;
   }
 
-  while ((read = fread(buffer, 1, BUFSIZ, fin)) > 0) {
-    if (fwrite(buffer, 1, read, fout) != read) {
-      LOGE("Short write of %s (%s)\n", copy_path, strerror(errno));
-      return NULL;
-    }
+  ui->Print("Copying package...\n");
+  int ret = copy_package_data(fin, fout, st.st_size, digest);
+  if (ret != 0) {
+    LOGE("Failed to copy %s (%s)\n", original_path, strerror(errno));
   }
-
-  free(buffer);
-
-  if (fclose(fout) != 0) {
+  close(fin);
+  if (close(fout) != 0 && ret == 0) {
     LOGE("Failed to close %s (%s)\n", copy_path, strerror(errno));
-    return NULL;
+    ret = -1;
   }
-
-  if (fclose(fin) != 0) {
-    LOGE("Failed to close %s (%s)\n", original_path, strerror(errno));
+  if (ret != 0) {
+    unlink(copy_path);
     return NULL;
   }
 
@@ -652,6 +890,94 @@ check_avphys_mem(const char *path) {
     return res;
 }
 
+// Packages picked with "Add to install queue"; they are installed,
+// together, ahead of the next package picked to install.
+static char* queued_packages[MAX_QUEUED_PACKAGES];
+static int num_queued_packages = 0;
+
+// Installs the queue and empties it.  When the whole queue fits in
+// memory it's copied to SIDELOAD_TEMP_DIR first, as a single package
+// is, so nothing can change a package between its verification and its
+// install; otherwise install_packages() verifies each one again just
+// before installing it.
+static int
+install_queued_packages(int* wipe_cache) {
+    int count = num_queued_packages;
+    long long total = 0;
+    int i, result;
+
+    for (i = 0; i < count; ++i) {
+        struct stat st;
+        if (stat(queued_packages[i], &st) != 0) {
+            total = -1;
+            break;
+        }
+        total += st.st_size;
+    }
+
+    if (total < 0 || GET_AVPHYS_MEM() <= total + RESERVED_MEMORY_SIZE) {
+        result = install_packages((const char**)queued_packages, count, wipe_cache,
+                                  TEMPORARY_INSTALL_FILE);
+    } else {
+        char* copies[MAX_QUEUED_PACKAGES];
+        PackageDigest digests[MAX_QUEUED_PACKAGES];
+        int copied;
+        for (copied = 0; copied < count; ++copied) {
+            char name[32];
+            snprintf(name, sizeof(name), "package-%d.zip", copied);
+            copies[copied] = copy_sideloaded_package(queued_packages[copied], name,
+                                                     &digests[copied]);
+            if (copies[copied] == NULL) break;
+        }
+        if (copied == count) {
+            result = install_packages((const char**)copies, count, wipe_cache,
+                                      TEMPORARY_INSTALL_FILE, digests);
+        } else {
+            result = INSTALL_ERROR;
+        }
+        for (i = 0; i < copied; ++i) {
+            unlink(copies[i]);
+            free(copies[i]);
+        }
+    }
+
+    for (i = 0; i < count; ++i) free(queued_packages[i]);
+    num_queued_packages = 0;
+    return result;
+}
+
+// Returns 1 to install the package now, 0 to queue it, -1 for neither.
+static int
+confirm_package(const char* name, Device* device) {
+    const char* headers[] = { "Install this package?", name, "", NULL };
+    const char** title_headers = prepend_title(headers);
+
+    char install[64];
+    if (num_queued_packages > 0) {
+        snprintf(install, sizeof(install), " Yes -- install it after %d queued",
+                 num_queued_packages);
+    } else {
+        strlcpy(install, " Yes -- install now", sizeof(install));
+    }
+    const char* items[4];
+    int n = 0;
+    int item_install = n;
+    items[n++] = install;
+    int item_queue = -1;
+    if (num_queued_packages < MAX_QUEUED_PACKAGES - 1) {
+        item_queue = n;
+        items[n++] = " Add to install queue";
+    }
+    items[n++] = " No";
+    items[n] = NULL;
+
+    int chosen = get_menu_selection(title_headers, items, 1, 0, device);
+    free(title_headers);
+    if (chosen == item_install) return 1;
+    if (chosen == item_queue) return 0;
+    return -1;
+}
+
 static int
 update_directory(const char* path, int* wipe_cache, Device* device) {
     const char* MENU_HEADERS[] = { "Choose a package to install:",
@@ -747,13 +1073,32 @@ update_directory(const char* path, int* wipe_cache, Device* device) {
             strlcat(new_path, "/", PATH_MAX);
             strlcat(new_path, item, PATH_MAX);
 
+            int action = confirm_package(item, device);
+            if (action < 0) {
+                continue;
+            } else if (action == 0) {
+                queued_packages[num_queued_packages++] = strdup(new_path);
+                ui->Print("Queued %s\n", item);
+                continue;
+            }
+
+            if (num_queued_packages > 0) {
+                queued_packages[num_queued_packages++] = strdup(new_path);
+                ui->Print("\n-- Install %d packages ...\n", num_queued_packages);
+                set_sdcard_update_bootloader_message();
+                result = install_queued_packages(wipe_cache);
+                break;
+            }
+
             ui->Print("\n-- Install %s ...\n", path);
             set_sdcard_update_bootloader_message();
 
             if (!check_avphys_mem(new_path)) {
-                char* copy = copy_sideloaded_package(new_path);
+                PackageDigest digest;
+                char* copy = copy_sideloaded_package(new_path, "package.zip", &digest);
                 if (copy) {
-                    result = install_package(copy, wipe_cache, TEMPORARY_INSTALL_FILE);
+                    result = install_package_with_digest(copy, wipe_cache,
+                                                         TEMPORARY_INSTALL_FILE, &digest);
                     free(copy);
                 } else {
                     result = INSTALL_ERROR;
@@ -807,8 +1152,8 @@ wipe_data(int confirm, Device* device) {
 
     ui->Print("\n-- Wiping data...\n");
     device->WipeData();
-    erase_volume("/data");
-    erase_volume("/cache");
+    static const char* volumes[] = { "/data", "/cache" };
+    erase_volumes(volumes, 2);
     ui->Print("Data wipe complete.\n");
 }
 
@@ -1113,8 +1458,16 @@ static int write_file(const char *path, const char *value)
     }
 }
 
+static unsigned int notified_volumes_generation = 0;
+
 static int handle_volume_hotswap(char* label, char* path) {
-    ui->NotifyVolumesChanged();
+    // Events that leave the volumes as they were (a removal of a volume
+    // already gone, say) don't need the menus rebuilt.
+    unsigned int generation = vold_get_volumes_generation();
+    if (generation != notified_volumes_generation) {
+        notified_volumes_generation = generation;
+        ui->NotifyVolumesChanged();
+    }
     return 0;
 }
 
@@ -1130,6 +1483,44 @@ static struct vold_callbacks v_callbacks = {
     .disk_removed = handle_volume_hotswap,
 };
 
+// Startup work that doesn't depend on the command line, run in
+// parallel by startup_run().  Each task lists what it needs done first.
+static void init_volumes() {
+    load_volume_table();
+}
+
+static void init_vold() {
+    vold_client_start(&v_callbacks, 0);
+    vold_set_automount(1);
+}
+
+static void init_cache() {
+    ensure_path_mounted(LAST_LOG_FILE);
+    rotate_last_logs(KEEP_LOG_COUNT);
+}
+
+static void init_selinux() {
+    struct selinux_opt seopts[] = {
+      { SELABEL_OPT_PATH, "/file_contexts" }
+    };
+
+    sehandle = selabel_open(SELABEL_CTX_FILE, seopts, 1);
+}
+
+static void init_ui() {
+    // Everything but the localized text, which waits for the locale.
+    ui->Init();
+}
+
+static const struct startup_task init_tasks[] = {
+    { "volumes", init_volumes, { NULL } },
+    { "vold",    init_vold,    { "volumes" } },
+    { "cache",   init_cache,   { "volumes" } },
+    { "selinux", init_selinux, { NULL } },
+    { "keys",    preload_keys, { NULL } },
+    { "ui",      init_ui,      { NULL } },
+};
+
 int
 main(int argc, char **argv) {
     time_t start = time(NULL);
@@ -1178,20 +1569,30 @@ main(int argc, char **argv) {
     umask(0);
 
     // If these fail, there's not really anywhere to complain...
-    freopen(TEMPORARY_LOG_FILE, "a", stdout); setbuf(stdout, NULL);
-    freopen(TEMPORARY_LOG_FILE, "a", stderr); setbuf(stderr, NULL);
+    freopen(TEMPORARY_LOG_FILE, "a", stdout);
+    freopen(TEMPORARY_LOG_FILE, "a", stderr);
+    log_writer_start();
 
     printf("Starting recovery on %s", ctime(&start));
+    double main_ms = startup_now_ms();
 
-    load_volume_table();
-    vold_client_start(&v_callbacks, 0);
-    vold_set_automount(1);
-    ensure_path_mounted(LAST_LOG_FILE);
-    rotate_last_logs(10);
+    Device* device = make_device();
+    ui = device->GetUI();
+    gCurrentUI = ui;
+
+    startup_run(init_tasks, sizeof(init_tasks) / sizeof(init_tasks[0]));
+
+    // The command file lives in /cache, and may need labels to write
+    // back the bootloader message.
+    startup_wait("cache");
+    startup_wait("selinux");
+    double phase_ms = startup_now_ms();
     get_args(&argc, &argv);
+    startup_mark("args", phase_ms);
 
     const char *send_intent = NULL;
-    const char *update_package = NULL;
+    const char *update_packages[MAX_QUEUED_PACKAGES];
+    int num_update_packages = 0;
     int wipe_data = 0, wipe_cache = 0, wipe_media = 0, show_text = 0, sideload = 0;
     bool just_exit = false;
     bool shutdown_after = false;
@@ -1200,7 +1601,13 @@ main(int argc, char **argv) {
     while ((arg = getopt_long(argc, argv, "", OPTIONS, NULL)) != -1) {
         switch (arg) {
         case 's': send_intent = optarg; break;
-        case 'u': update_package = optarg; break;
+        case 'u':
+            if (num_update_packages < MAX_QUEUED_PACKAGES) {
+                update_packages[num_update_packages++] = optarg;
+            } else {
+                LOGE("Too many packages; ignoring %s\n", optarg);
+            }
+            break;
         case 'w': wipe_data = wipe_cache = 1; break;
         case 'm': wipe_media = 1; break;
         case 'c': wipe_cache = 1; break;
@@ -1220,28 +1627,24 @@ main(int argc, char **argv) {
     }
     printf("locale is [%s]\n", locale);
 
-    Device* device = make_device();
-    ui = device->GetUI();
-    gCurrentUI = ui;
-
+    startup_wait("ui");
+    phase_ms = startup_now_ms();
     ui->SetLocale(locale);
-    ui->Init();
+    startup_mark("locale", phase_ms);
     ui->SetBackground(RecoveryUI::NONE);
     if (show_text) ui->ShowText(true);
 
     /*enable the backlight*/
     write_file("/sys/class/leds/lcd-backlight/brightness", "128");
 
-    struct selinux_opt seopts[] = {
-      { SELABEL_OPT_PATH, "/file_contexts" }
-    };
-
-    sehandle = selabel_open(SELABEL_CTX_FILE, seopts, 1);
-
     if (!sehandle) {
         ui->Print("Warning: No file_contexts\n");
     }
 
+    startup_wait_all();
+    startup_mark("startup", main_ms);
+    startup_write_timeline(STARTUP_TIMELINE_FILE);
+
     device->StartRecovery();
 
     printf("Command:");
@@ -1250,7 +1653,8 @@ main(int argc, char **argv) {
     }
     printf("\n");
 
-    if (update_package) {
+    for (int i = 0; i < num_update_packages; ++i) {
+        const char* update_package = update_packages[i];
         // For backwards compatibility on the cache partition only, if
         // we're given an old 'root' path "CACHE:foo", change it to
         // "/cache/foo".
@@ -1261,7 +1665,7 @@ main(int argc, char **argv) {
             strlcat(modified_path, update_package+6, len);
             printf("(replacing path \"%s\" with \"%s\")\n",
                    update_package, modified_path);
-            update_package = modified_path;
+            update_packages[i] = modified_path;
         }
     }
     printf("\n");
@@ -1272,8 +1676,9 @@ main(int argc, char **argv) {
 
     int status = INSTALL_SUCCESS;
 
-    if (update_package != NULL) {
-        status = install_package(update_package, &wipe_cache, TEMPORARY_INSTALL_FILE);
+    if (num_update_packages > 0) {
+        status = install_packages(update_packages, num_update_packages, &wipe_cache,
+                                  TEMPORARY_INSTALL_FILE);
         if (status == INSTALL_SUCCESS && wipe_cache) {
             if (erase_volume("/cache")) {
                 LOGE("Cache wipe (requested by package) failed.");
@@ -1292,9 +1697,9 @@ main(int argc, char **argv) {
             }
         }
     } else if (wipe_data) {
+        static const char* volumes[] = { "/data", "/cache" };
         if (device->WipeData()) status = INSTALL_ERROR;
-        if (erase_volume("/data")) status = INSTALL_ERROR;
-        if (wipe_cache && erase_volume("/cache")) status = INSTALL_ERROR;
+        if (erase_volumes(volumes, wipe_cache ? 2 : 1)) status = INSTALL_ERROR;
         if (status != INSTALL_SUCCESS) ui->Print("Data wipe failed.\n");
     } else if (wipe_cache) {
         if (wipe_cache && erase_volume("/cache")) status = INSTALL_ERROR;
@@ -1327,9 +1732,11 @@ main(int argc, char **argv) {
 
     if (shutdown_after) {
         ui->Print("Shutting down...\n");
+        log_flush();
         property_set(ANDROID_RB_PROPERTY, "shutdown,");
     } else {
         ui->Print("Rebooting...\n");
+        log_flush();
         property_set(ANDROID_RB_PROPERTY, "reboot,");
     }
     return EXIT_SUCCESS;
@@ -16,6 +16,7 @@
 
 #include <errno.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -23,18 +24,25 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <pthread.h>
+#include <sys/wait.h>
 
 #include <fs_mgr.h>
 #include "mtdutils/mtdutils.h"
 #include "mtdutils/mounts.h"
 #include "roots.h"
 #include "common.h"
+#include "log_writer.h"
 #include "make_ext4fs.h"
 
 #include "voldclient/voldclient.h"
 
 static struct fstab *fstab = NULL;
 
+// scan_mounted_volumes() and mtd_scan_partitions() rebuild global
+// tables, so only one thread at a time may (un)mount or look them up.
+static pthread_mutex_t volumes_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 extern struct selabel_handle *sehandle;
 
 static int mkdir_p(const char* path, mode_t mode)
@@ -225,16 +233,7 @@ int ensure_path_mounted(const char* path) {
     return ensure_volume_mounted(v);
 }
 
-int ensure_volume_mounted(fstab_rec* v) {
-    if (v == NULL) {
-        LOGE("cannot mount unknown volume\n");
-        return -1;
-    }
-    if (strcmp(v->fs_type, "ramdisk") == 0) {
-        // the ramdisk is always mounted.
-        return 0;
-    }
-
+static int ensure_volume_mounted_locked(fstab_rec* v) {
     int result;
     result = scan_mounted_volumes();
     if (result < 0) {
@@ -287,6 +286,22 @@ int ensure_volume_mounted(fstab_rec* v) {
     return -1;
 }
 
+int ensure_volume_mounted(fstab_rec* v) {
+    if (v == NULL) {
+        LOGE("cannot mount unknown volume\n");
+        return -1;
+    }
+    if (strcmp(v->fs_type, "ramdisk") == 0) {
+        // the ramdisk is always mounted.
+        return 0;
+    }
+
+    pthread_mutex_lock(&volumes_mutex);
+    int result = ensure_volume_mounted_locked(v);
+    pthread_mutex_unlock(&volumes_mutex);
+    return result;
+}
+
 int ensure_path_unmounted(const char* path) {
     fstab_rec* v;
     if (memcmp(path, "/storage/", 9) == 0) {
@@ -312,16 +327,7 @@ int ensure_path_unmounted(const char* path) {
     return ensure_volume_unmounted(v);
 }
 
-int ensure_volume_unmounted(fstab_rec* v) {
-    if (v == NULL) {
-        LOGE("cannot unmount unknown volume\n");
-        return -1;
-    }
-    if (strcmp(v->fs_type, "ramdisk") == 0) {
-        // the ramdisk is always mounted; you can't unmount it.
-        return -1;
-    }
-
+static int ensure_volume_unmounted_locked(fstab_rec* v) {
     int result;
     result = scan_mounted_volumes();
     if (result < 0) {
@@ -346,6 +352,22 @@ int ensure_volume_unmounted(fstab_rec* v) {
     return unmount_mounted_volume(mv);
 }
 
+int ensure_volume_unmounted(fstab_rec* v) {
+    if (v == NULL) {
+        LOGE("cannot unmount unknown volume\n");
+        return -1;
+    }
+    if (strcmp(v->fs_type, "ramdisk") == 0) {
+        // the ramdisk is always mounted; you can't unmount it.
+        return -1;
+    }
+
+    pthread_mutex_lock(&volumes_mutex);
+    int result = ensure_volume_unmounted_locked(v);
+    pthread_mutex_unlock(&volumes_mutex);
+    return result;
+}
+
 static int rmtree_except(const char* path, const char* except)
 {
     char pathbuf[PATH_MAX];
@@ -385,7 +407,54 @@ static int rmtree_except(const char* path, const char* except)
     return rc;
 }
 
-int format_volume(const char* volume) {
+// Run one of the recovery multi-call tools (make_ext4fs, mkfs.f2fs) in
+// a child process.  Those keep their state in globals, so they can't be
+// run from several threads of this process at once.
+static int run_format_tool(const char** args) {
+    // The child would otherwise inherit whatever is still buffered.
+    log_flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGE("failed to fork %s (%s)\n", args[0], strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        execv("/sbin/recovery", (char* const*)args);
+        fprintf(stdout, "E:Can't run %s (%s)\n", args[0], strerror(errno));
+        fflush(stdout);
+        _exit(-1);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        return -1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Size in bytes of the block device (or image file) at 'path', or -1.
+static long long device_size(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    unsigned long long bytes;
+    long long size;
+    if (ioctl(fd, BLKGETSIZE64, &bytes) == 0) {
+        size = bytes;
+    } else {
+        size = lseek64(fd, 0, SEEK_END);
+    }
+    close(fd);
+    return size;
+}
+
+// 'isolated' is set when several volumes are being formatted at once;
+// mkfs is then run out of process (see run_format_tool()).
+static int do_format_volume(const char* volume, bool isolated) {
     if (strcmp(volume, "media") == 0) {
         if (!is_data_media()) {
             return 0;
@@ -439,8 +508,10 @@ int format_volume(const char* volume) {
     }
 
     if (strcmp(v->fs_type, "yaffs2") == 0 || strcmp(v->fs_type, "mtd") == 0) {
+        pthread_mutex_lock(&volumes_mutex);
         mtd_scan_partitions();
         const MtdPartition* partition = mtd_find_partition_by_name(v->blk_device);
+        pthread_mutex_unlock(&volumes_mutex);
         if (partition == NULL) {
             LOGE("format_volume: no MTD partition \"%s\"\n", v->blk_device);
             return -1;
@@ -462,7 +533,41 @@ int format_volume(const char* volume) {
     }
 
     if (strcmp(v->fs_type, "ext4") == 0) {
-        int result = make_ext4fs(v->blk_device, v->length, volume, sehandle);
+        int result;
+        if (isolated) {
+            char length[32];
+            const char* args[10];
+            int n = 0;
+            long long len = v->length;
+            if (len < 0) {
+                // That much is kept free at the end of the device (for a
+                // crypto footer).  make_ext4fs() works out what's left
+                // itself; the tool has to be told.
+                long long size = device_size(v->blk_device);
+                if (size < 0 || size + len <= 0) {
+                    LOGE("format_volume: can't fit %s in %s\n", volume, v->blk_device);
+                    return -1;
+                }
+                len += size;
+            }
+            args[n++] = "make_ext4fs";
+            if (len != 0) {
+                snprintf(length, sizeof(length), "%lld", len);
+                args[n++] = "-l";
+                args[n++] = length;
+            }
+            args[n++] = "-a";
+            args[n++] = volume;
+            if (sehandle) {
+                args[n++] = "-S";
+                args[n++] = "/file_contexts";
+            }
+            args[n++] = v->blk_device;
+            args[n] = NULL;
+            result = run_format_tool(args);
+        } else {
+            result = make_ext4fs(v->blk_device, v->length, volume, sehandle);
+        }
         if (result != 0) {
             LOGE("format_volume: make_ext4fs failed on %s\n", v->blk_device);
             return -1;
@@ -472,8 +577,13 @@ int format_volume(const char* volume) {
 
 #ifdef USE_F2FS
     if (strcmp(v->fs_type, "f2fs") == 0) {
-        const char* args[] = { "mkfs.f2fs", v->blk_device };
-        int result = make_f2fs_main(2, (char**)args);
+        const char* args[] = { "mkfs.f2fs", v->blk_device, NULL };
+        int result;
+        if (isolated) {
+            result = run_format_tool(args);
+        } else {
+            result = make_f2fs_main(2, (char**)args);
+        }
         if (result != 0) {
             LOGE("format_volume: mkfs.f2fs failed on %s\n", v->blk_device);
             return -1;
@@ -486,6 +596,161 @@ int format_volume(const char* volume) {
     return -1;
 }
 
+int format_volume(const char* volume) {
+    return do_format_volume(volume, false);
+}
+
+enum { FORMAT_PENDING, FORMAT_RUNNING, FORMAT_DONE };
+
+struct format_job {
+    const char* volume;
+    const char* key;    // jobs with equal keys never run concurrently
+    int state;
+    int result;
+};
+
+struct format_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    format_job* jobs;
+    int count;
+    int* finished;      // job indices, in completion order
+    int num_finished;
+};
+
+// Volumes that share a block device ("media" lives on /data) must not
+// be formatted at the same time, and vold only tracks one outstanding
+// command, so all vold-managed volumes are serialized as well.
+static const char* format_job_key(const char* volume) {
+    fstab_rec* v = volume_for_path(strcmp(volume, "media") == 0 ? "/data" : volume);
+    if (v == NULL) {
+        return volume;
+    }
+    if (fs_mgr_is_voldmanaged(v)) {
+        return "vold";
+    }
+    return v->blk_device;
+}
+
+// Return the index of a pending job that may start now, -1 if pending
+// jobs are all blocked by running ones, or -2 if nothing is pending.
+static int next_format_job_locked(format_pool* pool) {
+    bool pending = false;
+    for (int i = 0; i < pool->count; ++i) {
+        if (pool->jobs[i].state != FORMAT_PENDING) continue;
+        pending = true;
+
+        bool busy = false;
+        for (int j = 0; j < pool->count; ++j) {
+            if (pool->jobs[j].state == FORMAT_RUNNING &&
+                strcmp(pool->jobs[j].key, pool->jobs[i].key) == 0) {
+                busy = true;
+                break;
+            }
+        }
+        if (!busy) return i;
+    }
+    return pending ? -1 : -2;
+}
+
+static void* format_worker(void* cookie) {
+    format_pool* pool = (format_pool*)cookie;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        int i = next_format_job_locked(pool);
+        if (i == -2) break;
+        if (i == -1) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+            continue;
+        }
+
+        format_job* job = &pool->jobs[i];
+        job->state = FORMAT_RUNNING;
+        pthread_mutex_unlock(&pool->mutex);
+
+        int result = do_format_volume(job->volume, true);
+
+        pthread_mutex_lock(&pool->mutex);
+        job->result = result;
+        job->state = FORMAT_DONE;
+        pool->finished[pool->num_finished++] = i;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+int format_volumes(const char* const* volumes, int count, int* results,
+                   int max_jobs, format_volume_cb cb, void* cookie) {
+    if (count <= 0) {
+        return 0;
+    }
+    if (max_jobs <= 0 || max_jobs > count) {
+        max_jobs = count;
+    }
+
+    format_pool pool;
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    pool.jobs = (format_job*)calloc(count, sizeof(format_job));
+    pool.finished = (int*)calloc(count, sizeof(int));
+    pool.count = count;
+    pool.num_finished = 0;
+    for (int i = 0; i < count; ++i) {
+        pool.jobs[i].volume = volumes[i];
+        pool.jobs[i].key = format_job_key(volumes[i]);
+        pool.jobs[i].state = FORMAT_PENDING;
+        pool.jobs[i].result = -1;
+    }
+
+    pthread_t* workers = (pthread_t*)malloc(max_jobs * sizeof(pthread_t));
+    int num_workers = 0;
+    for (int i = 0; i < max_jobs; ++i) {
+        if (pthread_create(&workers[num_workers], NULL, format_worker, &pool) == 0) {
+            ++num_workers;
+        }
+    }
+    if (num_workers == 0) {
+        // No threads available; do the work on this one instead.
+        format_worker(&pool);
+    }
+
+    // Report completions from the caller's thread so the callback never
+    // has to worry about which worker it runs on.
+    int reported = 0;
+    pthread_mutex_lock(&pool.mutex);
+    while (reported < count) {
+        while (reported == pool.num_finished) {
+            pthread_cond_wait(&pool.cond, &pool.mutex);
+        }
+        format_job* job = &pool.jobs[pool.finished[reported++]];
+        pthread_mutex_unlock(&pool.mutex);
+        if (cb != NULL) {
+            cb(job->volume, job->result, reported, count, cookie);
+        }
+        pthread_mutex_lock(&pool.mutex);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+
+    for (int i = 0; i < num_workers; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < count; ++i) {
+        if (results != NULL) results[i] = pool.jobs[i].result;
+        if (pool.jobs[i].result != 0) failed = -1;
+    }
+
+    free(workers);
+    free(pool.finished);
+    free(pool.jobs);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.mutex);
+    return failed;
+}
+
 int setup_install_mounts() {
     if (fstab == NULL) {
         LOGE("can't set up install mounts: no fstab loaded\n");
@@ -45,6 +45,20 @@ int ensure_path_unmounted(const char* path);
 // it is mounted.
 int format_volume(const char* volume);
 
+// Called by format_volumes() each time one of its volumes is done.
+// Runs on the thread that called format_volumes(), in completion order.
+typedef void (*format_volume_cb)(const char* volume, int result,
+                                 int completed, int total, void* cookie);
+
+// Reformat several volumes (same rules as format_volume() for each
+// entry).  Up to 'max_jobs' volumes (0 for one per volume) are
+// unmounted and formatted at the same time; volumes backed by the same
+// device, and volumes managed by vold, are still done one at a time.
+// The result for volumes[i] is stored in results[i].  Returns 0 if
+// every volume was formatted successfully.
+int format_volumes(const char* const* volumes, int count, int* results,
+                   int max_jobs, format_volume_cb cb, void* cookie);
+
 // Ensure that all and only the volumes that packages expect to find
 // mounted (/tmp and /cache) are mounted.  Returns 0 on success.
 int setup_install_mounts();
@@ -22,8 +22,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -42,11 +45,24 @@ static int char_height;
 // so use a global variable.
 static ScreenRecoveryUI* self = NULL;
 
-// Return the current time as a double (including fractions of a second).
+// Shortest time between two presented frames (one display refresh).
+static const double kMinFrameInterval = 1.0 / 60;
+
+// How often the render thread checks for requests if it has nothing to
+// be woken up through.
+static const int kNoWakePollMs = 50;
+
+// Return the current time as a double (including fractions of a second),
+// on the monotonic clock the frame timer uses.
 static double now() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec + tv.tv_usec / 1000000.0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void to_timespec(double t, struct timespec* ts) {
+    ts->tv_sec = (time_t) t;
+    ts->tv_nsec = (long) ((t - ts->tv_sec) * 1000000000.0);
 }
 
 ScreenRecoveryUI::ScreenRecoveryUI() :
@@ -54,16 +70,21 @@ ScreenRecoveryUI::ScreenRecoveryUI() :
     installingFrame(0),
     locale(NULL),
     rtl_locale(false),
+    locale_set(false),
+    initialized(false),
     progressBarType(EMPTY),
     progressScopeStart(0),
     progressScopeSize(0),
     progress(0),
     pagesIdentical(false),
+    log_ring(kLogRingSize),
+    log_pending(0),
     text_cols(0),
     text_rows(0),
     text_col(0),
     text_row(0),
     text_top(0),
+    text_lines(0),
     show_text(false),
     show_text_ever(false),
     dialog_icon(NONE),
@@ -75,12 +96,35 @@ ScreenRecoveryUI::ScreenRecoveryUI() :
     menu_show_start(0),
     max_menu_rows(0),
     animation_fps(20),
-    installing_frames(-1) {
-
-    for (int i = 0; i < NR_ICONS; i++)
+    installing_frames(-1),
+    progress_top(0),
+    progress_bottom(0),
+    screen_valid(false),
+    log_top(0),
+    log_lines(0),
+    dirty_menu_sel(-1),
+    redraw_requests(0),
+    wake_fd(-1),
+    wake_write_fd(-1) {
+
+    for (int i = 0; i < NR_ICONS; i++) {
         backgroundIcon[i] = NULL;
+        backgroundText[i] = NULL;
+    }
 
     pthread_mutex_init(&updateMutex, NULL);
+    pthread_mutex_init(&renderMutex, NULL);
+    wake_fd = wake_write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        LOGE("eventfd failed: %s; using a pipe\n", strerror(errno));
+        int fds[2];
+        if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0) {
+            wake_fd = fds[0];
+            wake_write_fd = fds[1];
+        } else {
+            LOGE("pipe failed: %s; polling for redraws\n", strerror(errno));
+        }
+    }
     self = this;
 }
 
@@ -95,7 +139,7 @@ void ScreenRecoveryUI::draw_background_locked(Icon icon)
     if (icon) {
         gr_surface surface = backgroundIcon[icon];
         if (icon == INSTALLING_UPDATE || icon == ERASING) {
-            surface = installation[installingFrame];
+            surface = installing_frame_locked();
         }
         gr_surface text_surface = backgroundText[icon];
 
@@ -117,15 +161,31 @@ void ScreenRecoveryUI::draw_background_locked(Icon icon)
     }
 }
 
+// The current frame of the installing animation.  The frames are still
+// being decoded in the background for a while after Init(); wait for
+// this one if it isn't done yet.
+// Should only be called with updateMutex locked.
+gr_surface ScreenRecoveryUI::installing_frame_locked()
+{
+    if (installing_frames <= 0) return NULL;
+    if (res_wait_frame(installation, installingFrame) < 0) return NULL;
+    return installation[installingFrame];
+}
+
 // Draw the progress bar (if any) on the screen.  Does not flip pages.
 // Should only be called with updateMutex locked.
 void ScreenRecoveryUI::draw_progress_locked()
 {
+    progress_top = gr_fb_height();
+    progress_bottom = 0;
+
     if (currentIcon == ERROR) return;
 
     if (currentIcon == INSTALLING_UPDATE || currentIcon == ERASING) {
-        gr_surface icon = installation[installingFrame];
+        gr_surface icon = installing_frame_locked();
         gr_blit(icon, 0, 0, gr_get_width(icon), gr_get_height(icon), iconX, iconY);
+        progress_top = iconY;
+        progress_bottom = iconY + gr_get_height(icon);
     }
 
     if (progressBarType != EMPTY) {
@@ -136,6 +196,9 @@ void ScreenRecoveryUI::draw_progress_locked()
         int dx = (gr_fb_width() - width)/2;
         int dy = (3*gr_fb_height() + iconHeight - 2*height)/4;
 
+        if (dy < progress_top) progress_top = dy;
+        if (dy + height > progress_bottom) progress_bottom = dy + height;
+
         // Erase behind the progress bar (in case this was a progress-only update)
         SetColor(TEXT_FILL);
         gr_fill(dx, dy, width, height);
@@ -232,10 +295,116 @@ void ScreenRecoveryUI::draw_dialog()
     }
 }
 
+// Draw menu[item] (a header or an entry) at its place on the screen,
+// and return its y position.  Does not flip pages.
+// Should only be called with updateMutex locked.
+int ScreenRecoveryUI::draw_menu_item_locked(int item)
+{
+    int y = (item < menu_top ? item : item - menu_show_start) * (char_height+4);
+
+    if (item < menu_top) {
+        SetColor(TOP);
+        if (menu[item][0]) gr_text(4, y, menu[item], 1);
+    } else if (item == menu_top + menu_sel) {
+        // draw the highlight bar
+        SetColor(MENU_SEL_BG);
+        gr_fill(0, y-2, gr_fb_width(), y+char_height+2);
+        // text of selected item
+        SetColor(MENU_SEL_FG);
+        if (menu[item][0]) gr_text(4, y, menu[item], 1);
+    } else {
+        SetColor(MENU);
+        if (menu[item][0]) gr_text(4, y, menu[item], 0);
+    }
+    return y;
+}
+
+// Number of log lines that fit below pixel row 'top'.
+// Should only be called with updateMutex locked.
+int ScreenRecoveryUI::log_rows_locked(int top)
+{
+    int count = 0;
+    for (int ty = gr_fb_height() - char_height;
+         ty > top+2 && count < text_rows;
+         ty -= char_height) {
+        ++count;
+    }
+    return count;
+}
+
+// Draw the i-th log line counting up from the bottom of the screen,
+// covering its whole row.  Does not flip pages.
+// Should only be called with updateMutex locked.
+void ScreenRecoveryUI::draw_log_row_locked(int i)
+{
+    int row = (text_top + text_rows - 1 - i) % text_rows;
+    int ty = gr_fb_height() - (i+1) * char_height;
+    const char* line = text[row];
+
+    // The text cells are painted opaque from the glyph cache; only the
+    // margins around them need filling.
+    int x = 4 + strlen(line) * char_width;
+    if (x > gr_fb_width()) x = gr_fb_width();
+    SetColor(TEXT_FILL);
+    gr_text_background();
+    gr_fill(0, ty, 4, ty + char_height);
+    gr_fill(x, ty, gr_fb_width(), ty + char_height);
+
+    SetColor(LOG);
+    gr_text_opaque(4, ty, line, 0);
+}
+
+// Clear the log area (everything below 'top') and draw the text log
+// into it.  Does not flip pages.
+// Should only be called with updateMutex locked.
+void ScreenRecoveryUI::draw_text_log_locked(int top)
+{
+    // display from the bottom up, until we hit the top of the
+    // screen, the bottom of the menu, or we've displayed the
+    // entire text buffer.
+    int rows = log_rows_locked(top);
+
+    SetColor(TEXT_FILL);
+    gr_fill(0, top, gr_fb_width(), gr_fb_height() - rows * char_height);
+
+    for (int i = 0; i < rows; ++i) {
+        draw_log_row_locked(i);
+    }
+    log_lines = text_lines;
+}
+
+// Bring the log area up to date after it scrolled: move the lines that
+// stay visible up with gr_move_rows() and draw only the new ones, plus
+// the previous last line, which may have grown since.  Falls back to
+// redrawing the whole log if everything scrolled away.  Returns the
+// first pixel row that changed.  Does not flip pages.
+// Should only be called with updateMutex locked.
+int ScreenRecoveryUI::scroll_text_log_locked()
+{
+    int rows = log_rows_locked(log_top);
+    unsigned int scrolled = text_lines - log_lines;
+    if (scrolled == 0 || scrolled >= (unsigned int) rows) {
+        draw_text_log_locked(log_top);
+        return log_top;
+    }
+
+    int first_ty = gr_fb_height() - rows * char_height;
+    gr_move_rows(first_ty + scrolled * char_height, first_ty,
+                 (rows - scrolled) * char_height);
+    for (int i = 0; i <= (int) scrolled; ++i) {
+        draw_log_row_locked(i);
+    }
+    log_lines = text_lines;
+    return first_ty;
+}
+
 // Redraw everything on the screen.  Does not flip pages.
 // Should only be called with updateMutex locked.
 void ScreenRecoveryUI::draw_screen_locked()
 {
+    screen_valid = false;
+    dirty_menu_sel = -1;
+
     if (!show_text) {
         draw_background_locked(currentIcon);
         draw_progress_locked();
@@ -250,18 +419,14 @@ void ScreenRecoveryUI::draw_screen_locked()
         gr_clear();
 
         int y = 0;
-        int i = 0;
         if (show_menu) {
+            int i;
             int row = 0;
-            if (y == 0)
-                SetColor(TOP);
-            else
-                SetColor(HEADER);
-            for (; i < menu_top; ++i) {
-                if (menu[i][0]) gr_text(4, y, menu[i], i < menu_top);
-                y += char_height+4;
+            for (i = 0; i < menu_top; ++i) {
+                draw_menu_item_locked(i);
                 row++;
             }
+            y = row * (char_height+4);
 
             int j;
             if (menu_items - menu_show_start + menu_top >= max_menu_rows)
@@ -269,19 +434,8 @@ void ScreenRecoveryUI::draw_screen_locked()
             else
                 j = menu_items - menu_show_start;
 
-            SetColor(MENU);
             for (i = menu_show_start + menu_top; i < (menu_show_start + menu_top + j); ++i) {
-                if (i == menu_top + menu_sel) {
-                    // draw the highlight bar
-                    SetColor(MENU_SEL_BG);
-                    gr_fill(0, y-2, gr_fb_width(), y+char_height+2);
-                    // text of selected item
-                    SetColor(MENU_SEL_FG);
-                    if (menu[i][0]) gr_text(4, y, menu[i], 1);
-                    SetColor(MENU);
-                } else {
-                    if (menu[i][0]) gr_text(4, y, menu[i], i < menu_top);
-                }
+                draw_menu_item_locked(i);
                 y += char_height+4;
                 row++;
                 if (row >= max_menu_rows)
@@ -291,23 +445,11 @@ void ScreenRecoveryUI::draw_screen_locked()
             y += 4;
             gr_fill(0, y, gr_fb_width(), y+2);
             y += 4;
-            ++i;
         }
 
-        SetColor(LOG);
-
-        // display from the bottom up, until we hit the top of the
-        // screen, the bottom of the menu, or we've displayed the
-        // entire text buffer.
-        int ty;
-        int row = (text_top+text_rows-1) % text_rows;
-        for (int ty = gr_fb_height() - char_height, count = 0;
-             ty > y+2 && count < text_rows;
-             ty -= char_height, ++count) {
-            gr_text(4, ty, text[row], 0);
-            --row;
-            if (row < 0) row = text_rows-1;
-        }
+        draw_text_log_locked(y);
+        log_top = y;
+        screen_valid = true;
     }
 }
 
@@ -319,6 +461,56 @@ void ScreenRecoveryUI::update_screen_locked()
     gr_flip();
 }
 
+// Redraw only the parts of the text screen in 'requests' (REDRAW_MENU,
+// REDRAW_LOG, REDRAW_LOG_LINE) and present just those rows, when the
+// display supports partial flips.  Otherwise falls back to
+// update_screen_locked().
+// Should only be called with updateMutex locked.
+void ScreenRecoveryUI::update_dirty_locked(int requests)
+{
+    if (!show_text) {
+        // The log and menu aren't visible; nothing to repaint.
+        dirty_menu_sel = -1;
+        return;
+    }
+    if (!screen_valid || DialogShowing() || !gr_can_flip_rows()) {
+        update_screen_locked();
+        return;
+    }
+
+    int top = gr_fb_height();
+    int bottom = 0;
+
+    if ((requests & REDRAW_MENU) && dirty_menu_sel >= 0 && show_menu) {
+        int items[2] = { menu_top + dirty_menu_sel, menu_top + menu_sel };
+        for (int k = 0; k < 2; ++k) {
+            int y = (items[k] - menu_show_start) * (char_height+4);
+            SetColor(TEXT_FILL);
+            gr_fill(0, y-2, gr_fb_width(), y+char_height+2);
+            draw_menu_item_locked(items[k]);
+            if (y-2 < top) top = y-2;
+            if (y+char_height+2 > bottom) bottom = y+char_height+2;
+        }
+    }
+
+    if (requests & REDRAW_LOG) {
+        int ty = scroll_text_log_locked();
+        if (ty < top) top = ty;
+        bottom = gr_fb_height();
+    } else if (requests & REDRAW_LOG_LINE) {
+        int ty = gr_fb_height() - char_height;
+        if (log_rows_locked(log_top) > 0) {
+            draw_log_row_locked(0);
+            if (ty < top) top = ty;
+            bottom = gr_fb_height();
+        }
+    }
+
+    dirty_menu_sel = -1;
+
+    if (bottom > top) gr_flip_rows(top, bottom - top);
+}
+
 // Updates only the progress bar, if possible, otherwise redraws the screen.
 // Should only be called with updateMutex locked.
 void ScreenRecoveryUI::update_progress_locked()
@@ -328,11 +520,108 @@ void ScreenRecoveryUI::update_progress_locked()
         pagesIdentical = true;
     } else {
         draw_progress_locked();  // Draw only the progress bar and overlays
+        if (gr_can_flip_rows()) {
+            if (progress_bottom > progress_top) {
+                gr_flip_rows(progress_top, progress_bottom - progress_top);
+            }
+            return;
+        }
     }
     gr_flip();
 }
 
-// Keeps the progress bar updated, even when the process is otherwise busy.
+// Ask the render thread to draw 'what' (REDRAW_* flags) soon.
+void ScreenRecoveryUI::request_redraw(int what)
+{
+    pthread_mutex_lock(&renderMutex);
+    redraw_requests |= what;
+    pthread_mutex_unlock(&renderMutex);
+    wake_renderer();
+}
+
+void ScreenRecoveryUI::wake_renderer()
+{
+    uint64_t one = 1;
+    if (wake_write_fd >= 0) write(wake_write_fd, &one, sizeof(one));
+}
+
+// Whether something on screen moves by itself (the installing animation
+// or a timed progress bar), so the render thread needs to wake up for
+// frames even when nobody asks it to.
+// Should only be called with updateMutex locked.
+bool ScreenRecoveryUI::animating_locked()
+{
+    if (show_text) return false;
+    if ((currentIcon == INSTALLING_UPDATE || currentIcon == ERASING) &&
+        installing_frames > 0) {
+        return true;
+    }
+    return progressBarType == DETERMINATE && progressScopeDuration > 0 &&
+           progress < 1.0;
+}
+
+// Collect the pending redraw requests, including those for log
+// messages Print() has queued since the last frame.
+// Should only be called with updateMutex locked.
+int ScreenRecoveryUI::take_redraw_requests_locked()
+{
+    pthread_mutex_lock(&renderMutex);
+    int requests = redraw_requests;
+    redraw_requests = 0;
+    pthread_mutex_unlock(&renderMutex);
+    return requests | drain_log_locked();
+}
+
+// Lay out one Print() message in the text log.
+// Should only be called with updateMutex locked.
+void ScreenRecoveryUI::append_text_locked(const char* msg)
+{
+    for (const char* ptr = msg; *ptr != '\0'; ++ptr) {
+        if (*ptr == '\n' || text_col >= text_cols) {
+            text[text_row][text_col] = '\0';
+            text_col = 0;
+            text_row = (text_row + 1) % text_rows;
+            if (text_row == text_top) text_top = (text_top + 1) % text_rows;
+            ++text_lines;
+        }
+        if (*ptr != '\n') text[text_row][text_col++] = *ptr;
+    }
+    text[text_row][text_col] = '\0';
+}
+
+// Move everything queued on log_ring into the text log, and return the
+// REDRAW_* flags for what changed.
+// Should only be called with updateMutex locked.
+int ScreenRecoveryUI::drain_log_locked()
+{
+    // Clear the flag first, so a message queued while we drain
+    // wakes us again.
+    __atomic_store_n(&log_pending, 0, __ATOMIC_SEQ_CST);
+    if (text_rows <= 0 || text_cols <= 0) return 0;
+
+    int old_row = text_row;
+    bool changed = false;
+    char msg[LogRing::kMessageSize];
+    while (log_ring.Pop(msg)) {
+        append_text_locked(msg);
+        changed = true;
+    }
+
+    // Messages only get dropped if the renderer falls far behind; they
+    // are still in the log file.
+    unsigned int dropped = log_ring.TakeDropped();
+    if (dropped > 0) {
+        snprintf(msg, sizeof(msg), "\n(%u messages not shown)\n", dropped);
+        append_text_locked(msg);
+        changed = true;
+    }
+
+    if (!changed) return 0;
+    return (text_row != old_row) ? REDRAW_LOG : REDRAW_LOG_LINE;
+}
+
+// Draws everything; keeps the progress bar updated, even when the
+// process is otherwise busy.
 void* ScreenRecoveryUI::progress_thread(void *cookie) {
     self->progress_loop();
     return NULL;
@@ -340,40 +629,118 @@ void* ScreenRecoveryUI::progress_thread(void *cookie) {
 
 void ScreenRecoveryUI::progress_loop() {
     double interval = 1.0 / animation_fps;
+    // minimum of 20ms delay between animation frames
+    if (interval < 0.02) interval = 0.02;
+    double next_tick = 0;       // when the next animation frame is due, 0 if none
+    double last_frame = 0;
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        LOGE("timerfd_create failed: %s\n", strerror(errno));
+    }
+    bool vsync = gr_can_wait_vsync();
+
     for (;;) {
-        double start = now();
+        // Sleep until something changed or the next animation frame is
+        // due; with nothing animating, only requests wake us up.
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        if (next_tick > 0) {
+            to_timespec(next_tick, &its.it_value);
+        }
+        if (timer_fd >= 0) {
+            timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+        }
+
+        struct pollfd fds[2];
+        fds[0].fd = wake_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = timer_fd;
+        fds[1].events = POLLIN;
+        int timeout = -1;
+        if (timer_fd < 0 && next_tick > 0) {
+            // No timerfd; fall back to a poll() timeout.
+            double wait = next_tick - now();
+            timeout = wait > 0 ? (int)(wait * 1000) + 1 : 0;
+        }
+        if (wake_fd < 0 && (timeout < 0 || timeout > kNoWakePollMs)) {
+            // Nothing can wake us up; look for requests every so often.
+            timeout = kNoWakePollMs;
+        }
+        if (poll(fds, timer_fd >= 0 ? 2 : 1, timeout) < 0 && errno != EINTR) {
+            LOGE("render poll failed: %s\n", strerror(errno));
+            usleep(interval * 1000000);
+        }
+        uint64_t count;
+        if (wake_fd >= 0) {
+            // One read empties an eventfd; a pipe may hold several wakeups.
+            char drain[64];
+            while (read(wake_fd, drain, sizeof(drain)) > 0) {}
+        }
+        if (timer_fd >= 0) read(timer_fd, &count, sizeof(count));
+
+        // Don't present faster than the display refreshes; whatever is
+        // requested in the meantime ends up in this same frame.  Start
+        // drawing right at a vertical blank if the display reports them.
+        if (vsync) {
+            gr_wait_vsync();
+        } else {
+            double wait = last_frame + kMinFrameInterval - now();
+            if (wait > 0) usleep((long)(wait * 1000000));
+        }
+
         pthread_mutex_lock(&updateMutex);
+        int requests = take_redraw_requests_locked();
 
-        int redraw = 0;
+        double start = now();
+        if (next_tick > 0 && start >= next_tick) {
+            // update the installation animation, if active
+            // skip this if we have a text overlay (too expensive to update)
+            // A frame still being decoded is skipped for this tick
+            // rather than waited for, so the progress bar keeps moving.
+            if ((currentIcon == INSTALLING_UPDATE || currentIcon == ERASING) &&
+                installing_frames > 0 && !show_text) {
+                int next = (installingFrame + 1) % installing_frames;
+                if (res_frame_ready(installation, next)) {
+                    installingFrame = next;
+                    requests |= REDRAW_PROGRESS;
+                }
+            }
 
-        // update the installation animation, if active
-        // skip this if we have a text overlay (too expensive to update)
-        if ((currentIcon == INSTALLING_UPDATE || currentIcon == ERASING) &&
-            installing_frames > 0 && !show_text) {
-            installingFrame = (installingFrame + 1) % installing_frames;
-            redraw = 1;
+            // move the progress bar forward on timed intervals, if configured
+            int duration = progressScopeDuration;
+            if (progressBarType == DETERMINATE && duration > 0) {
+                double elapsed = start - progressScopeTime;
+                float p = 1.0 * elapsed / duration;
+                if (p > 1.0) p = 1.0;
+                if (p > progress) {
+                    progress = p;
+                    requests |= REDRAW_PROGRESS;
+                }
+            }
         }
 
-        // move the progress bar forward on timed intervals, if configured
-        int duration = progressScopeDuration;
-        if (progressBarType == DETERMINATE && duration > 0) {
-            double elapsed = now() - progressScopeTime;
-            float p = 1.0 * elapsed / duration;
-            if (p > 1.0) p = 1.0;
-            if (p > progress) {
-                progress = p;
-                redraw = 1;
+        if (requests & REDRAW_SCREEN) {
+            update_screen_locked();
+        } else {
+            if (requests & (REDRAW_MENU | REDRAW_LOG | REDRAW_LOG_LINE)) {
+                update_dirty_locked(requests);
+            }
+            // The progress bar isn't shown under the text overlay.
+            if ((requests & REDRAW_PROGRESS) && !show_text) {
+                update_progress_locked();
             }
         }
+        if (requests) last_frame = now();
 
-        if (redraw) update_progress_locked();
+        // Schedule the next animation frame, if anything still moves.
+        if (!animating_locked()) {
+            next_tick = 0;
+        } else if (next_tick == 0 || start >= next_tick) {
+            next_tick = start + interval;
+        }
 
         pthread_mutex_unlock(&updateMutex);
-        double end = now();
-        // minimum of 20ms delay between frames
-        double delay = interval - (end-start);
-        if (delay < 0.02) delay = 0.02;
-        usleep((long)(delay * 1000000));
     }
 }
 
@@ -385,7 +752,7 @@ void ScreenRecoveryUI::LoadBitmap(const char* filename, gr_surface* surface) {
 }
 
 void ScreenRecoveryUI::LoadBitmapArray(const char* filename, int* frames, gr_surface** surface) {
-    int result = res_create_multi_display_surface(filename, frames, surface);
+    int result = res_create_multi_display_surface_async(filename, frames, surface);
     if (result < 0) {
         LOGE("missing bitmap %s\n(Code %d)\n", filename, result);
     }
@@ -398,12 +765,25 @@ void ScreenRecoveryUI::LoadLocalizedBitmap(const char* filename, gr_surface* sur
     }
 }
 
+void ScreenRecoveryUI::LoadLocalizedText() {
+    gr_surface text[NR_ICONS] = { NULL };
+    LoadLocalizedBitmap("installing_text", &text[INSTALLING_UPDATE]);
+    LoadLocalizedBitmap("erasing_text", &text[ERASING]);
+    LoadLocalizedBitmap("no_command_text", &text[NO_COMMAND]);
+    LoadLocalizedBitmap("error_text", &text[ERROR]);
+
+    pthread_mutex_lock(&updateMutex);
+    memcpy(backgroundText, text, sizeof(backgroundText));
+    pthread_mutex_unlock(&updateMutex);
+}
+
 void ScreenRecoveryUI::Init()
 {
     gr_init();
 
     gr_font_size(&char_width, &char_height);
 
+    pthread_mutex_lock(&updateMutex);
     text_col = text_row = 0;
     text_rows = gr_fb_height() / char_height;
     max_menu_rows = text_rows - 10;
@@ -414,10 +794,11 @@ void ScreenRecoveryUI::Init()
 
     text_cols = gr_fb_width() / char_width;
     if (text_cols > kMaxCols - 1) text_cols = kMaxCols - 1;
+    pthread_mutex_unlock(&updateMutex);
 
     backgroundIcon[NONE] = NULL;
     LoadBitmapArray("icon_installing", &installing_frames, &installation);
-    backgroundIcon[INSTALLING_UPDATE] = installing_frames ? installation[0] : NULL;
+    backgroundIcon[INSTALLING_UPDATE] = installing_frames > 0 ? installation[0] : NULL;
     backgroundIcon[ERASING] = backgroundIcon[INSTALLING_UPDATE];
     LoadBitmap("icon_info", &backgroundIcon[INFO]);
     LoadBitmap("icon_error", &backgroundIcon[ERROR]);
@@ -426,10 +807,13 @@ void ScreenRecoveryUI::Init()
     LoadBitmap("progress_empty", &progressBarEmpty);
     LoadBitmap("progress_fill", &progressBarFill);
 
-    LoadLocalizedBitmap("installing_text", &backgroundText[INSTALLING_UPDATE]);
-    LoadLocalizedBitmap("erasing_text", &backgroundText[ERASING]);
-    LoadLocalizedBitmap("no_command_text", &backgroundText[NO_COMMAND]);
-    LoadLocalizedBitmap("error_text", &backgroundText[ERROR]);
+    // The text depends on the locale; if that isn't known yet it's
+    // loaded by SetLocale(), so the rest doesn't have to wait for it.
+    pthread_mutex_lock(&updateMutex);
+    initialized = true;
+    bool have_locale = locale_set;
+    pthread_mutex_unlock(&updateMutex);
+    if (have_locale) LoadLocalizedText();
 
     pthread_create(&progress_t, NULL, progress_thread, NULL);
 
@@ -460,6 +844,12 @@ void ScreenRecoveryUI::SetLocale(const char* new_locale) {
     } else {
         new_locale = NULL;
     }
+
+    pthread_mutex_lock(&updateMutex);
+    locale_set = true;
+    bool have_ui = initialized;
+    pthread_mutex_unlock(&updateMutex);
+    if (have_ui) LoadLocalizedText();
 }
 
 void ScreenRecoveryUI::SetBackground(Icon icon)
@@ -467,7 +857,7 @@ void ScreenRecoveryUI::SetBackground(Icon icon)
     pthread_mutex_lock(&updateMutex);
 
     currentIcon = icon;
-    update_screen_locked();
+    request_redraw(REDRAW_SCREEN);
 
     pthread_mutex_unlock(&updateMutex);
 }
@@ -481,7 +871,7 @@ void ScreenRecoveryUI::SetProgressType(ProgressType type)
     progressScopeStart = 0;
     progressScopeSize = 0;
     progress = 0;
-    update_progress_locked();
+    request_redraw(REDRAW_PROGRESS);
     pthread_mutex_unlock(&updateMutex);
 }
 
@@ -494,7 +884,7 @@ void ScreenRecoveryUI::ShowProgress(float portion, float seconds)
     progressScopeTime = now();
     progressScopeDuration = seconds;
     progress = 0;
-    update_progress_locked();
+    request_redraw(REDRAW_PROGRESS);
     pthread_mutex_unlock(&updateMutex);
 }
 
@@ -509,7 +899,7 @@ void ScreenRecoveryUI::SetProgress(float fraction)
         float scale = width * progressScopeSize;
         if ((int) (progress * scale) != (int) (fraction * scale)) {
             progress = fraction;
-            update_progress_locked();
+            request_redraw(REDRAW_PROGRESS);
         }
     }
     pthread_mutex_unlock(&updateMutex);
@@ -525,23 +915,14 @@ void ScreenRecoveryUI::Print(const char *fmt, ...)
 
     fputs(buf, stdout);
 
-    // This can get called before ui_init(), so be careful.
-    pthread_mutex_lock(&updateMutex);
-    if (text_rows > 0 && text_cols > 0) {
-        char *ptr;
-        for (ptr = buf; *ptr != '\0'; ++ptr) {
-            if (*ptr == '\n' || text_col >= text_cols) {
-                text[text_row][text_col] = '\0';
-                text_col = 0;
-                text_row = (text_row + 1) % text_rows;
-                if (text_row == text_top) text_top = (text_top + 1) % text_rows;
-            }
-            if (*ptr != '\n') text[text_row][text_col++] = *ptr;
-        }
-        text[text_row][text_col] = '\0';
-        update_screen_locked();
+    // This can get called before ui_init(), and from any thread.  The
+    // message is only queued here, without taking any lock; the render
+    // thread lays it out and draws it.  Only the first message after
+    // the renderer drained the queue has to wake it up.
+    log_ring.Push(buf);
+    if (!__atomic_exchange_n(&log_pending, 1, __ATOMIC_SEQ_CST)) {
+        wake_renderer();
     }
-    pthread_mutex_unlock(&updateMutex);
 }
 
 void ScreenRecoveryUI::DialogShowInfo(const char* text)
@@ -550,7 +931,7 @@ void ScreenRecoveryUI::DialogShowInfo(const char* text)
     free(dialog_text);
     dialog_text = strdup(text);
     dialog_icon = INFO;
-    update_screen_locked();
+    request_redraw(REDRAW_SCREEN);
     pthread_mutex_unlock(&updateMutex);
 }
 
@@ -560,7 +941,7 @@ void ScreenRecoveryUI::DialogShowError(const char* text)
     free(dialog_text);
     dialog_text = strdup(text);
     dialog_icon = ERROR;
-    update_screen_locked();
+    request_redraw(REDRAW_SCREEN);
     pthread_mutex_unlock(&updateMutex);
 }
 
@@ -569,7 +950,7 @@ void ScreenRecoveryUI::DialogDismiss()
     pthread_mutex_lock(&updateMutex);
     free(dialog_text);
     dialog_text = NULL;
-    update_screen_locked();
+    request_redraw(REDRAW_SCREEN);
     pthread_mutex_unlock(&updateMutex);
 }
 
@@ -592,7 +973,7 @@ void ScreenRecoveryUI::StartMenu(const char* const * headers, const char* const
         menu_items = i - menu_top;
         show_menu = 1;
         menu_sel = initial_selection;
-        update_screen_locked();
+        request_redraw(REDRAW_SCREEN);
     }
     pthread_mutex_unlock(&updateMutex);
 }
@@ -601,6 +982,7 @@ int ScreenRecoveryUI::SelectMenu(int sel) {
     int old_sel;
     pthread_mutex_lock(&updateMutex);
     if (show_menu > 0) {
+        int old_show_start = menu_show_start;
         old_sel = menu_sel;
         menu_sel = sel;
         if (menu_sel < 0) menu_sel = menu_items + menu_sel;
@@ -612,7 +994,14 @@ int ScreenRecoveryUI::SelectMenu(int sel) {
             menu_show_start = menu_sel + menu_top - max_menu_rows + 1;
         }
         sel = menu_sel;
-        if (menu_sel != old_sel) update_screen_locked();
+        if (menu_show_start != old_show_start) {
+            request_redraw(REDRAW_SCREEN);
+        } else if (menu_sel != old_sel) {
+            // Repaint the item highlighted on screen, which isn't
+            // old_sel if several moves land in the same frame.
+            if (dirty_menu_sel < 0) dirty_menu_sel = old_sel;
+            request_redraw(REDRAW_MENU);
+        }
     }
     pthread_mutex_unlock(&updateMutex);
     return sel;
@@ -623,7 +1012,7 @@ void ScreenRecoveryUI::EndMenu() {
     pthread_mutex_lock(&updateMutex);
     if (show_menu > 0 && text_rows > 0 && text_cols > 0) {
         show_menu = 0;
-        update_screen_locked();
+        request_redraw(REDRAW_SCREEN);
     }
     pthread_mutex_unlock(&updateMutex);
 }
@@ -649,13 +1038,13 @@ void ScreenRecoveryUI::ShowText(bool visible)
     pthread_mutex_lock(&updateMutex);
     show_text = visible;
     if (show_text) show_text_ever = 1;
-    update_screen_locked();
+    request_redraw(REDRAW_SCREEN);
     pthread_mutex_unlock(&updateMutex);
 }
 
 void ScreenRecoveryUI::Redraw()
 {
     pthread_mutex_lock(&updateMutex);
-    update_screen_locked();
+    request_redraw(REDRAW_SCREEN);
     pthread_mutex_unlock(&updateMutex);
 }
@@ -19,6 +19,7 @@
 
 #include <pthread.h>
 
+#include "log_ring.h"
 #include "ui.h"
 #include "minui/minui.h"
 
@@ -67,10 +68,15 @@ class ScreenRecoveryUI : public RecoveryUI {
     int install_overlay_offset_x, install_overlay_offset_y;
 
   private:
+    // Times the drawing code below (screen_ui_bench.cpp).
+    friend class ScreenRecoveryUIBench;
+
     Icon currentIcon;
     int installingFrame;
     const char* locale;
     bool rtl_locale;
+    bool locale_set;
+    bool initialized;
 
     pthread_mutex_t updateMutex;
     gr_surface backgroundIcon[NR_ICONS];
@@ -94,10 +100,17 @@ class ScreenRecoveryUI : public RecoveryUI {
     static const int kMaxMenuCols = 96;
     static const int kMaxMenuRows = 250;
 
-    // Log text overlay, displayed when a magic key is pressed
+    // Log text overlay, displayed when a magic key is pressed.  Print()
+    // queues messages on log_ring without locking; only the render
+    // thread takes them off and lays them out in 'text'.
+    static const int kLogRingSize = 256;
+    LogRing log_ring;
+    int log_pending;        // set by Print() until the renderer drains
     char text[kMaxRows][kMaxCols];
     int text_cols, text_rows;
     int text_col, text_row, text_top;
+    // Lines completed so far; tells the renderer how far the log scrolled.
+    unsigned int text_lines;
     bool show_text;
     bool show_text_ever;   // has show_text ever been true?
 
@@ -117,19 +130,58 @@ class ScreenRecoveryUI : public RecoveryUI {
 
     int iconX, iconY;
 
+    // Pixel rows touched by the last draw_progress_locked().
+    int progress_top, progress_bottom;
+
+    // What changed since the screen was last drawn, so that
+    // update_dirty_locked() can repaint (and present) just that.
+    bool screen_valid;      // a full text screen has been drawn
+    int log_top;            // first pixel row of the log area
+    unsigned int log_lines; // text_lines when the log was drawn
+    int dirty_menu_sel;     // highlighted item on screen, or -1
+
+    // Pending work for the render thread (progress_loop()).  Drawing
+    // only happens there, at most once per display refresh; everything
+    // else just records what changed and wakes it up through wake_fd.
+    enum {
+        REDRAW_SCREEN   = 1 << 0,
+        REDRAW_PROGRESS = 1 << 1,
+        REDRAW_MENU     = 1 << 2,
+        REDRAW_LOG      = 1 << 3,   // the log scrolled
+        REDRAW_LOG_LINE = 1 << 4,   // only the current log line changed
+    };
+    pthread_mutex_t renderMutex;    // guards redraw_requests
+    int redraw_requests;
+    int wake_fd;                    // eventfd, or a pipe's read end; -1 if neither
+    int wake_write_fd;              // where wake_renderer() writes
+
     void draw_install_overlay_locked(int frame);
     void draw_background_locked(Icon icon);
+    gr_surface installing_frame_locked();
     void draw_progress_locked();
     void draw_dialog();
+    int draw_menu_item_locked(int item);
+    int log_rows_locked(int top);
+    void draw_log_row_locked(int i);
+    void draw_text_log_locked(int top);
+    int scroll_text_log_locked();
     void draw_screen_locked();
     void update_screen_locked();
+    void update_dirty_locked(int requests);
     void update_progress_locked();
+    void request_redraw(int what);
+    void wake_renderer();
+    bool animating_locked();
+    int take_redraw_requests_locked();
+    void append_text_locked(const char* msg);
+    int drain_log_locked();
     static void* progress_thread(void* cookie);
     void progress_loop();
 
     void LoadBitmap(const char* filename, gr_surface* surface);
     void LoadBitmapArray(const char* filename, int* frames, gr_surface** surface);
     void LoadLocalizedBitmap(const char* filename, gr_surface* surface);
+    void LoadLocalizedText();
 };
 
 #endif  // RECOVERY_UI_H
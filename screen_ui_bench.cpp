@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Times ScreenRecoveryUI's own drawing -- the full text screen, a menu
+// move, a scrolling log line and the installing screen -- on minui's
+// offscreen backend.  The parts of recovery the UI calls into are
+// stubbed out below, so this runs on the host.
+//
+//   screen_ui_bench [WxH] [-f RGBX_8888|BGRA_8888|RGB_565] [-r image dir] [-o dump.png]
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/android_reboot.h>
+#include <cutils/properties.h>
+
+#include "common.h"
+#include "minui/minui.h"
+#include "roots.h"
+#include "screen_ui.h"
+#include "voldclient/voldclient.h"
+
+// What screen_ui.cpp and ui.cpp need from the rest of recovery.
+void ui_print(const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stdout, format, ap);
+    va_end(ap);
+}
+
+int ensure_path_mounted(const char* path) {
+    return -1;
+}
+
+void vold_unmount_all() {
+}
+
+int property_get(const char* key, char* value, const char* default_value) {
+    return snprintf(value, PROPERTY_VALUE_MAX, "%s", default_value ? default_value : "");
+}
+
+int android_reboot(int cmd, int flags, char* arg) {
+    return -1;
+}
+
+// Drives the UI's private drawing code directly, the way its render
+// thread would, with updateMutex held.  Nothing here asks the render
+// thread for a frame, so it stays asleep while we time.
+class ScreenRecoveryUIBench {
+  public:
+    explicit ScreenRecoveryUIBench(ScreenRecoveryUI* ui) : ui_(ui) { }
+
+    void TextScreen() {
+        pthread_mutex_lock(&ui_->updateMutex);
+        ui_->show_text = true;
+        ui_->update_screen_locked();
+        pthread_mutex_unlock(&ui_->updateMutex);
+    }
+
+    void MenuMove() {
+        pthread_mutex_lock(&ui_->updateMutex);
+        ui_->dirty_menu_sel = ui_->menu_sel;
+        ui_->menu_sel = (ui_->menu_sel + 1) % ui_->menu_items;
+        ui_->update_dirty_locked(ScreenRecoveryUI::REDRAW_MENU);
+        pthread_mutex_unlock(&ui_->updateMutex);
+    }
+
+    void LogLine() {
+        // What Print() queues, then what the render thread does with it.
+        ui_->log_ring.Push("Patching system image after verification.\n");
+        pthread_mutex_lock(&ui_->updateMutex);
+        ui_->update_dirty_locked(ui_->drain_log_locked());
+        pthread_mutex_unlock(&ui_->updateMutex);
+    }
+
+    void InstallingFrame() {
+        pthread_mutex_lock(&ui_->updateMutex);
+        if (ui_->show_text) {
+            ui_->show_text = false;
+            ui_->currentIcon = RecoveryUI::INSTALLING_UPDATE;
+            ui_->progressBarType = RecoveryUI::DETERMINATE;
+            ui_->progressScopeStart = 0;
+            ui_->progressScopeSize = 1;
+            ui_->pagesIdentical = false;
+        }
+        if (ui_->installing_frames > 0) {
+            ui_->installingFrame = (ui_->installingFrame + 1) % ui_->installing_frames;
+        }
+        ui_->progress = ui_->progress >= 1 ? 0 : ui_->progress + 0.01;
+        ui_->update_progress_locked();
+        pthread_mutex_unlock(&ui_->updateMutex);
+    }
+
+  private:
+    ScreenRecoveryUI* ui_;
+};
+
+static ScreenRecoveryUIBench* bench;
+
+static const double kMinSeconds = 0.25;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+typedef void (*bench_fn)(void);
+
+static void run(const char* name, bench_fn fn) {
+    int iterations = 0;
+    double start = now();
+    double elapsed;
+    do {
+        fn();
+        ++iterations;
+        elapsed = now() - start;
+    } while (elapsed < kMinSeconds);
+    printf("  %-24s %10.1f us\n", name, elapsed * 1000000 / iterations);
+}
+
+static void bench_text_screen() {
+    bench->TextScreen();
+}
+
+static void bench_menu_move() {
+    bench->MenuMove();
+}
+
+static void bench_log_line() {
+    bench->LogLine();
+}
+
+static void bench_installing_frame() {
+    bench->InstallingFrame();
+}
+
+static int parse_format(const char* s) {
+    if (strcmp(s, "BGRA_8888") == 0) return GR_FORMAT_BGRA_8888;
+    if (strcmp(s, "RGB_565") == 0) return GR_FORMAT_RGB_565;
+    return GR_FORMAT_RGBX_8888;
+}
+
+int main(int argc, char** argv) {
+    const char* size = "1080x1920";
+    const char* image_dir = "res/images";
+    int format = GR_FORMAT_RGBX_8888;
+    const char* dump = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            format = parse_format(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            image_dir = argv[++i];
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            dump = argv[++i];
+        } else {
+            size = argv[i];
+        }
+    }
+
+    int w, h;
+    if (sscanf(size, "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+        fprintf(stderr, "bad size \"%s\"\n", size);
+        return 1;
+    }
+
+    // The UI starts its threads in Init(), so there is one of it, at
+    // one size, per run.
+    gr_use_memory_backend(w, h, format);
+    res_set_paths(image_dir, NULL);
+
+    ScreenRecoveryUI* ui = new ScreenRecoveryUI;
+    ui->SetLocale("en_US");
+    ui->Init();
+
+    static const char* kHeaders[] = { "CWM-based Recovery", "", NULL };
+    static const char* kItems[] = {
+        "reboot system now", "apply update", "wipe data/factory reset",
+        "wipe cache partition", "backup and restore", "mounts and storage",
+        "advanced", "power off", NULL
+    };
+    ui->StartMenu(kHeaders, kItems, 0);
+    ui->ShowText(true);
+    for (int i = 0; i < 200; ++i) {
+        ui->Print("Installing update... writing system partition (%d)\n", i);
+    }
+    // Let the render thread lay out and draw all of that, then go idle.
+    usleep(200 * 1000);
+
+    bench = new ScreenRecoveryUIBench(ui);
+
+    printf("%s:\n", size);
+    run("text screen + flip", bench_text_screen);
+    run("menu move", bench_menu_move);
+    run("log line", bench_log_line);
+    if (dump != NULL) {
+        bench_text_screen();
+        int n = strlen(dump);
+        int result = (n > 4 && strcmp(dump + n - 4, ".ppm") == 0) ?
+            gr_dump_ppm(dump) : gr_dump_png(dump);
+        if (result != 0) fprintf(stderr, "failed to write %s\n", dump);
+    }
+    run("installing frame", bench_installing_frame);
+
+    // The UI's threads never exit; don't wait for them.
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "startup.h"
+
+#define MAX_PHASES 32
+
+struct phase {
+    const char* name;
+    double start_ms;
+    double end_ms;
+    int tid;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+
+static struct phase phases[MAX_PHASES];
+static int num_phases = 0;
+
+static const struct startup_task* tasks = NULL;
+static int num_tasks = 0;
+static bool* done = NULL;
+
+double startup_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void startup_mark(const char* phase, double start_ms) {
+    double end_ms = startup_now_ms();
+    int tid = syscall(__NR_gettid);
+
+    pthread_mutex_lock(&lock);
+    if (num_phases < MAX_PHASES) {
+        struct phase* p = &phases[num_phases++];
+        p->name = phase;
+        p->start_ms = start_ms;
+        p->end_ms = end_ms;
+        p->tid = tid;
+    }
+    pthread_mutex_unlock(&lock);
+
+    LOGI("startup: %s took %.1f ms (%.1f -> %.1f)\n",
+         phase, end_ms - start_ms, start_ms, end_ms);
+}
+
+static int find_task_locked(const char* name) {
+    for (int i = 0; i < num_tasks; ++i) {
+        if (strcmp(tasks[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+// Waits for 'name' with the lock held.
+static void wait_locked(const char* name) {
+    int i = find_task_locked(name);
+    if (i < 0) {
+        LOGW("startup: no task \"%s\"\n", name);
+        return;
+    }
+    while (!done[i]) {
+        pthread_cond_wait(&finished, &lock);
+    }
+}
+
+static void* task_thread(void* cookie) {
+    int i = (int)(long)cookie;
+    const struct startup_task* task = &tasks[i];
+
+    pthread_mutex_lock(&lock);
+    for (int d = 0; d < STARTUP_MAX_DEPS && task->deps[d] != NULL; ++d) {
+        wait_locked(task->deps[d]);
+    }
+    pthread_mutex_unlock(&lock);
+
+    double start_ms = startup_now_ms();
+    task->run();
+    startup_mark(task->name, start_ms);
+
+    pthread_mutex_lock(&lock);
+    done[i] = true;
+    pthread_cond_broadcast(&finished);
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+void startup_run(const struct startup_task* t, int count) {
+    pthread_mutex_lock(&lock);
+    tasks = t;
+    num_tasks = count;
+    done = new bool[count]();
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < count; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, task_thread, (void*)(long)i) == 0) {
+            pthread_detach(thread);
+        } else {
+            // Still runs, just not alongside anything.
+            task_thread((void*)(long)i);
+        }
+    }
+}
+
+void startup_wait(const char* name) {
+    pthread_mutex_lock(&lock);
+    wait_locked(name);
+    pthread_mutex_unlock(&lock);
+}
+
+void startup_wait_all() {
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < num_tasks; ++i) {
+        while (!done[i]) {
+            pthread_cond_wait(&finished, &lock);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void startup_write_timeline(const char* path) {
+    FILE* f = fopen(path, "w");
+    if (f == NULL) {
+        LOGW("Can't write %s (%s)\n", path, strerror(errno));
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < num_phases; ++i) {
+        fprintf(f, "%s %.3f %.3f %d\n", phases[i].name,
+                phases[i].start_ms, phases[i].end_ms, phases[i].tid);
+    }
+    pthread_mutex_unlock(&lock);
+    fclose(f);
+}
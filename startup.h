@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RECOVERY_STARTUP_H
+#define RECOVERY_STARTUP_H
+
+// Recovery's startup as a set of tasks that each run on their own
+// thread once the tasks they depend on are done, so independent work
+// (decoding images, talking to vold, mounting /cache...) overlaps.
+// Every task, and any phase the caller marks itself, is timed against
+// CLOCK_MONOTONIC -- i.e. from kernel boot -- for the log and for a
+// timeline file.
+
+#define STARTUP_MAX_DEPS 4
+
+struct startup_task {
+    const char* name;
+    void (*run)();
+    // Names of the tasks that must finish first; unused ones are NULL.
+    const char* deps[STARTUP_MAX_DEPS];
+};
+
+// Milliseconds on the clock the timeline uses.
+double startup_now_ms();
+
+// Start every task.  'tasks' must stay valid until they are all done.
+void startup_run(const struct startup_task* tasks, int count);
+
+// Block until the named task has finished.
+void startup_wait(const char* name);
+
+// Block until every task has finished.
+void startup_wait_all();
+
+// Record a phase the caller ran itself, from start_ms until now.
+void startup_mark(const char* phase, double start_ms);
+
+// Write every phase recorded so far to 'path', one per line:
+//   <phase> <start ms> <end ms> <thread>
+void startup_write_timeline(const char* path);
+
+#endif  // RECOVERY_STARTUP_H
@@ -23,4 +23,108 @@ $(foreach file,$(test_src_files), \
     $(eval LOCAL_MODULE := $(notdir $(file:%.cpp=%))) \
     $(eval LOCAL_C_INCLUDES := $(LOCAL_PATH)/..) \
     $(eval include $(BUILD_NATIVE_TEST)) \
-)
\ No newline at end of file
+)
+# minui pixel kernels, checked against the scalar reference.
+include $(CLEAR_VARS)
+LOCAL_MODULE := minui_pixels_test
+LOCAL_SRC_FILES := minui_pixels_test.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := \
+    libminui \
+    libgtest \
+    libgtest_main
+include $(BUILD_NATIVE_TEST)
+
+# Lock-free log queue used by ScreenRecoveryUI::Print().
+include $(CLEAR_VARS)
+LOCAL_MODULE := log_ring_test
+LOCAL_SRC_FILES := log_ring_test.cpp ../log_ring.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := \
+    libgtest \
+    libgtest_main
+include $(BUILD_NATIVE_TEST)
+
+# minadbd payload negotiation, packet pool and wire framing.
+include $(CLEAR_VARS)
+LOCAL_MODULE := minadbd_loopback_test
+LOCAL_SRC_FILES := minadbd_loopback_test.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_CFLAGS := -DADB_HOST=0
+LOCAL_STATIC_LIBRARIES := \
+    libminadbd \
+    libmincrypt \
+    libcutils \
+    liblog \
+    libgtest \
+    libgtest_main
+include $(BUILD_NATIVE_TEST)
+
+# minadbd fdevent loop, run against both the epoll and select backends.
+include $(CLEAR_VARS)
+LOCAL_MODULE := minadbd_fdevent_test
+LOCAL_SRC_FILES := minadbd_fdevent_test.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_CFLAGS := -DADB_HOST=0
+LOCAL_STATIC_LIBRARIES := \
+    libminadbd \
+    libmincrypt \
+    libcutils \
+    liblog \
+    libgtest \
+    libgtest_main
+include $(BUILD_NATIVE_TEST)
+
+# minadbd's FUSE sideload server, fed from memory.  Needs root and
+# /dev/fuse; skips itself without them.
+include $(CLEAR_VARS)
+LOCAL_MODULE := fuse_sideload_test
+LOCAL_SRC_FILES := fuse_sideload_test.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := \
+    libminadbd \
+    libmincrypt \
+    libcutils \
+    liblog \
+    libgtest \
+    libgtest_main
+include $(BUILD_NATIVE_TEST)
+
+# minadbd's FunctionFS transport against a dummy_hcd gadget.
+include $(CLEAR_VARS)
+LOCAL_MODULE := usb_ffs_loopback_test
+LOCAL_SRC_FILES := \
+    usb_ffs_loopback_test.cpp \
+    ../minadbd/usb_linux_client.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/.. $(LOCAL_PATH)/../minadbd
+LOCAL_CFLAGS := -DADB_HOST=0 -D_XOPEN_SOURCE -D_GNU_SOURCE -DUSB_FFS_AIO
+LOCAL_STATIC_LIBRARIES := \
+    libcutils \
+    liblog \
+    libgtest \
+    libgtest_main
+include $(BUILD_NATIVE_TEST)
+
+# voldclient command pipelining, against a fake vold socket.
+include $(CLEAR_VARS)
+LOCAL_MODULE := voldclient_test
+LOCAL_SRC_FILES := voldclient_test.cpp
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_CFLAGS := -DMINIVOLD
+LOCAL_STATIC_LIBRARIES := \
+    libvoldclient \
+    libcutils \
+    liblog \
+    libgtest \
+    libgtest_main
+include $(BUILD_NATIVE_TEST)
+
+# Binary command channel between recovery and the update binary.
+include $(CLEAR_VARS)
+LOCAL_MODULE := progress_channel_test
+LOCAL_SRC_FILES := progress_channel_test.cpp ../updater/progress_channel.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := \
+    libgtest \
+    libgtest_main
+include $(BUILD_NATIVE_TEST)
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+extern "C" {
+#include "minadbd/fuse_sideload.h"
+}
+
+// Serves the package from memory, and counts what it's asked for.
+struct MemoryProvider {
+    std::vector<uint8_t> data;
+    uint32_t block_size;
+    std::vector<int> reads;   // per block
+    bool fail;
+    bool closed;
+};
+
+static int memory_read_block(void* cookie, uint32_t block, uint8_t* buffer,
+                             uint32_t fetch_size) {
+    MemoryProvider* p = reinterpret_cast<MemoryProvider*>(cookie);
+    size_t offset = (size_t)block * p->block_size;
+    if (p->fail || offset + fetch_size > p->data.size()) return -1;
+    memcpy(buffer, &p->data[offset], fetch_size);
+    p->reads[block]++;
+    return 0;
+}
+
+static void memory_close(void* cookie) {
+    reinterpret_cast<MemoryProvider*>(cookie)->closed = true;
+}
+
+static struct provider_vtab memory_vtab = { memory_read_block, memory_close };
+
+static const uint32_t kBlockSize = 4096;
+// More blocks than the cache holds, and a short one at the end.
+static const uint32_t kBlocks = 40;
+static const size_t kFileSize = kBlocks * kBlockSize + 100;
+
+struct Server {
+    MemoryProvider* provider;
+    volatile bool done;
+    int result;
+};
+
+static void* server_thread(void* cookie) {
+    Server* s = reinterpret_cast<Server*>(cookie);
+    s->result = run_fuse_sideload(&memory_vtab, s->provider, s->provider->data.size(),
+                                  s->provider->block_size);
+    s->done = true;
+    return NULL;
+}
+
+class FuseSideloadTest : public testing::Test {
+  protected:
+    virtual void SetUp() {
+        provider.block_size = kBlockSize;
+        provider.data.resize(kFileSize);
+        for (size_t i = 0; i < kFileSize; ++i) {
+            provider.data[i] = (uint8_t)(rand() >> 7);
+        }
+        provider.reads.assign(kBlocks + 1, 0);
+        provider.fail = false;
+        provider.closed = false;
+
+        server.provider = &provider;
+        server.done = false;
+        server.result = 0;
+        pthread_create(&thread, NULL, server_thread, &server);
+
+        // Mounting needs root and /dev/fuse; without them there's
+        // nothing to test.
+        struct stat st;
+        mounted = false;
+        for (int i = 0; i < 500 && !server.done; ++i) {
+            if (stat(FUSE_SIDELOAD_HOST_PATHNAME, &st) == 0) {
+                mounted = true;
+                break;
+            }
+            usleep(10000);
+        }
+        if (!mounted) {
+            printf("%s not mounted; skipping\n", FUSE_SIDELOAD_HOST_PATHNAME);
+        }
+    }
+
+    virtual void TearDown() {
+        struct stat st;
+        if (mounted) stat(FUSE_SIDELOAD_HOST_EXIT_PATHNAME, &st);
+        pthread_join(thread, NULL);
+        if (mounted) EXPECT_EQ(0, server.result);
+        EXPECT_TRUE(provider.closed);
+    }
+
+    // Reads [offset, offset+len) through a fresh open, which drops the
+    // kernel's page cache for the file.  No readahead, so only the
+    // blocks asked for are fetched.
+    ssize_t ReadAt(off_t offset, uint8_t* buf, size_t len) {
+        int fd = open(FUSE_SIDELOAD_HOST_PATHNAME, O_RDONLY);
+        if (fd < 0) return -1;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+        ssize_t n = pread(fd, buf, len, offset);
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return n;
+    }
+
+    MemoryProvider provider;
+    Server server;
+    pthread_t thread;
+    bool mounted;
+};
+
+TEST_F(FuseSideloadTest, ReadsWholePackage) {
+    if (!mounted) return;
+
+    struct stat st;
+    ASSERT_EQ(0, stat(FUSE_SIDELOAD_HOST_PATHNAME, &st));
+    EXPECT_EQ((off_t)kFileSize, st.st_size);
+
+    std::vector<uint8_t> buf(kFileSize + 4096);
+    ASSERT_EQ((ssize_t)kFileSize, ReadAt(0, &buf[0], buf.size()));
+    EXPECT_EQ(0, memcmp(&buf[0], &provider.data[0], kFileSize));
+    for (uint32_t i = 0; i <= kBlocks; ++i) {
+        EXPECT_GE(provider.reads[i], 1) << "block " << i;
+    }
+
+    // Unaligned, across a block boundary.
+    ASSERT_EQ(100, ReadAt(kBlockSize * 3 - 50, &buf[0], 100));
+    EXPECT_EQ(0, memcmp(&buf[0], &provider.data[kBlockSize * 3 - 50], 100));
+
+    // Past the end.
+    EXPECT_EQ(0, ReadAt(kFileSize, &buf[0], 100));
+}
+
+TEST_F(FuseSideloadTest, CachedBlocksNotFetchedAgain) {
+    if (!mounted) return;
+
+    std::vector<uint8_t> buf(kBlockSize);
+    ASSERT_EQ((ssize_t)kBlockSize, ReadAt(0, &buf[0], kBlockSize));
+    int first = provider.reads[0];
+    ASSERT_GE(first, 1);
+
+    // Still in the cache, even though the kernel asks again.
+    ASSERT_EQ((ssize_t)kBlockSize, ReadAt(0, &buf[0], kBlockSize));
+    EXPECT_EQ(first, provider.reads[0]);
+    EXPECT_EQ(0, memcmp(&buf[0], &provider.data[0], kBlockSize));
+}
+
+TEST_F(FuseSideloadTest, RefetchedBlockMustMatch) {
+    if (!mounted) return;
+
+    std::vector<uint8_t> buf(kFileSize);
+    ASSERT_EQ((ssize_t)kFileSize, ReadAt(0, &buf[0], kFileSize));
+
+    // Blocks 1 and 2 have been evicted by 33 and 34; an unchanged copy
+    // is fine...
+    ASSERT_EQ((ssize_t)kBlockSize, ReadAt(kBlockSize, &buf[0], kBlockSize));
+    EXPECT_GE(provider.reads[1], 2);
+    EXPECT_EQ(0, memcmp(&buf[0], &provider.data[kBlockSize], kBlockSize));
+
+    // ...but a different one is refused.
+    provider.data[kBlockSize * 2 + 7] ^= 0xff;
+    errno = 0;
+    EXPECT_EQ(-1, ReadAt(kBlockSize * 2, &buf[0], kBlockSize));
+    EXPECT_EQ(EIO, errno);
+
+    // Blocks that didn't change are still served.
+    ASSERT_EQ((ssize_t)kBlockSize, ReadAt(kBlockSize * 5, &buf[0], kBlockSize));
+    EXPECT_EQ(0, memcmp(&buf[0], &provider.data[kBlockSize * 5], kBlockSize));
+}
+
+TEST_F(FuseSideloadTest, ProviderFailureIsEIO) {
+    if (!mounted) return;
+
+    provider.fail = true;
+    std::vector<uint8_t> buf(kBlockSize);
+    errno = 0;
+    EXPECT_EQ(-1, ReadAt(kBlockSize * 9, &buf[0], kBlockSize));
+    EXPECT_EQ(EIO, errno);
+
+    provider.fail = false;
+    ASSERT_EQ((ssize_t)kBlockSize, ReadAt(kBlockSize * 9, &buf[0], kBlockSize));
+    EXPECT_EQ(0, memcmp(&buf[0], &provider.data[kBlockSize * 9], kBlockSize));
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "log_ring.h"
+
+namespace android {
+
+class LogRingTest : public testing::Test {
+};
+
+TEST_F(LogRingTest, Fifo) {
+    LogRing ring(4);
+    char buf[LogRing::kMessageSize];
+
+    EXPECT_FALSE(ring.Pop(buf));
+    EXPECT_TRUE(ring.Push("one\n"));
+    EXPECT_TRUE(ring.Push("two\n"));
+    ASSERT_TRUE(ring.Pop(buf));
+    EXPECT_STREQ("one\n", buf);
+    ASSERT_TRUE(ring.Pop(buf));
+    EXPECT_STREQ("two\n", buf);
+    EXPECT_FALSE(ring.Pop(buf));
+}
+
+TEST_F(LogRingTest, FullDropsAndCounts) {
+    LogRing ring(3);    // rounded up to 4
+    char buf[LogRing::kMessageSize];
+
+    for (int i = 0; i < 4; ++i) EXPECT_TRUE(ring.Push("x"));
+    EXPECT_FALSE(ring.Push("y"));
+    EXPECT_FALSE(ring.Push("y"));
+    EXPECT_EQ(2U, ring.TakeDropped());
+    EXPECT_EQ(0U, ring.TakeDropped());
+
+    ASSERT_TRUE(ring.Pop(buf));
+    EXPECT_TRUE(ring.Push("z"));
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(ring.Pop(buf));
+        EXPECT_STREQ("x", buf);
+    }
+    ASSERT_TRUE(ring.Pop(buf));
+    EXPECT_STREQ("z", buf);
+}
+
+TEST_F(LogRingTest, Truncates) {
+    LogRing ring(1);
+    char long_msg[LogRing::kMessageSize * 2];
+    memset(long_msg, 'a', sizeof(long_msg) - 1);
+    long_msg[sizeof(long_msg) - 1] = '\0';
+
+    char buf[LogRing::kMessageSize];
+    ASSERT_TRUE(ring.Push(long_msg));
+    ASSERT_TRUE(ring.Pop(buf));
+    EXPECT_EQ(LogRing::kMessageSize - 1, (int) strlen(buf));
+}
+
+static const int kProducers = 8;
+static const int kMessagesPerProducer = 20000;
+
+struct Producer {
+    LogRing* ring;
+    int id;
+    int pushed;
+    int* finished;
+};
+
+static void* produce(void* cookie) {
+    Producer* p = reinterpret_cast<Producer*>(cookie);
+    char msg[64];
+    for (int i = 0; i < kMessagesPerProducer; ++i) {
+        snprintf(msg, sizeof(msg), "%d %d\n", p->id, i);
+        if (p->ring->Push(msg)) ++p->pushed;
+    }
+    __atomic_add_fetch(p->finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Checks that 'msg' arrived intact and after the previous message from
+// the same producer.
+static bool check_message(const char* msg, int* last, int* received) {
+    int id, seq;
+    char nl;
+    if (sscanf(msg, "%d %d%c", &id, &seq, &nl) != 3 || nl != '\n' ||
+        id < 0 || id >= kProducers || seq <= last[id]) {
+        ADD_FAILURE() << "bad or out of order message: " << msg;
+        return false;
+    }
+    last[id] = seq;
+    ++received[id];
+    return true;
+}
+
+// Many threads log at once while one thread drains: every message that
+// was accepted arrives exactly once, intact and in per-thread order.
+TEST_F(LogRingTest, ManyProducersStress) {
+    LogRing ring(64);
+    int finished = 0;
+    Producer producers[kProducers];
+    pthread_t threads[kProducers];
+    for (int i = 0; i < kProducers; ++i) {
+        producers[i].ring = &ring;
+        producers[i].id = i;
+        producers[i].pushed = 0;
+        producers[i].finished = &finished;
+        ASSERT_EQ(0, pthread_create(&threads[i], NULL, produce, &producers[i]));
+    }
+
+    int last[kProducers];
+    int received[kProducers];
+    for (int i = 0; i < kProducers; ++i) {
+        last[i] = -1;
+        received[i] = 0;
+    }
+
+    char buf[LogRing::kMessageSize];
+    bool ok = true;
+    bool done = false;
+    while (ok && !done) {
+        // Everything pushed before the last producer finished is visible
+        // once we see it finish, so draining after that gets it all.
+        done = __atomic_load_n(&finished, __ATOMIC_ACQUIRE) == kProducers;
+        while (ok && ring.Pop(buf)) {
+            ok = check_message(buf, last, received);
+        }
+        if (!done) sched_yield();
+    }
+
+    for (int i = 0; i < kProducers; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    unsigned int total = 0;
+    for (int i = 0; i < kProducers; ++i) {
+        EXPECT_EQ(producers[i].pushed, received[i]);
+        total += received[i];
+    }
+    EXPECT_EQ((unsigned int) (kProducers * kMessagesPerProducer),
+              total + ring.TakeDropped());
+}
+
+}  // namespace android
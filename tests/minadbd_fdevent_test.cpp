@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "minadbd/fdevent.h"
+
+// libminadbd logs errors through the recovery UI.
+void ui_print(const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
+}
+}
+
+// Every test runs against both backends and must see the same thing.
+class FdeventTest : public testing::TestWithParam<int> {
+  protected:
+    virtual void SetUp() {
+        ASSERT_EQ(0, fdevent_set_backend(GetParam()));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    }
+
+    virtual void TearDown() {
+        if (fds[1] >= 0) close(fds[1]);
+    }
+
+    int fds[2];
+};
+
+struct Seen {
+    int calls;
+    unsigned events;
+    fdevent* other;   // if set, stop watching it from the callback
+};
+
+static void record(int fd, unsigned events, void* cookie) {
+    Seen* seen = reinterpret_cast<Seen*>(cookie);
+    seen->calls++;
+    seen->events |= events;
+    if (seen->other) fdevent_del(seen->other, FDE_READ);
+}
+
+TEST_P(FdeventTest, ReadWhenDataArrives) {
+    Seen seen = {};
+    fdevent fde;
+    fdevent_install(&fde, fds[0], record, &seen);
+    fdevent_set(&fde, FDE_READ);
+
+    fdevent_loop_once(0);
+    EXPECT_EQ(0, seen.calls);
+
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    fdevent_loop_once(1000);
+    EXPECT_EQ(1, seen.calls);
+    EXPECT_EQ((unsigned) FDE_READ, seen.events);
+
+    fdevent_remove(&fde);
+}
+
+TEST_P(FdeventTest, WriteAndSetMask) {
+    Seen seen = {};
+    fdevent fde;
+    fdevent_install(&fde, fds[0], record, &seen);
+    fdevent_set(&fde, FDE_WRITE);
+
+    fdevent_loop_once(1000);
+    EXPECT_EQ(1, seen.calls);
+    EXPECT_EQ((unsigned) FDE_WRITE, seen.events);
+
+    // Nothing is reported once nothing is watched.
+    seen = Seen();
+    fdevent_del(&fde, FDE_WRITE);
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    fdevent_loop_once(0);
+    EXPECT_EQ(0, seen.calls);
+
+    fdevent_add(&fde, FDE_READ);
+    fdevent_add(&fde, FDE_WRITE);
+    fdevent_loop_once(1000);
+    EXPECT_EQ((unsigned) (FDE_READ | FDE_WRITE), seen.events);
+
+    fdevent_remove(&fde);
+}
+
+TEST_P(FdeventTest, HangupIsReadable) {
+    Seen seen = {};
+    fdevent fde;
+    fdevent_install(&fde, fds[0], record, &seen);
+    fdevent_set(&fde, FDE_READ);
+
+    close(fds[1]);
+    fds[1] = -1;
+    fdevent_loop_once(1000);
+    EXPECT_EQ((unsigned) FDE_READ, seen.events);
+
+    fdevent_remove(&fde);
+}
+
+TEST_P(FdeventTest, RemoveCloses) {
+    Seen seen = {};
+    fdevent fde;
+    int fd = dup(fds[0]);
+    fdevent_install(&fde, fd, record, &seen);
+    fdevent_set(&fde, FDE_READ | FDE_DONT_CLOSE);
+    fdevent_remove(&fde);
+    EXPECT_NE(-1, fcntl(fd, F_GETFD));
+
+    fdevent_install(&fde, fd, record, &seen);
+    fdevent_set(&fde, FDE_READ);
+    fdevent_remove(&fde);
+    EXPECT_EQ(-1, fcntl(fd, F_GETFD));
+
+    // A removed fdevent hears nothing more.
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    fdevent_loop_once(0);
+    EXPECT_EQ(0, seen.calls);
+    close(fds[0]);
+}
+
+TEST_P(FdeventTest, UnwatchedPendingEventIsDropped) {
+    int other[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, other));
+
+    Seen a = {}, b = {};
+    fdevent fde_a, fde_b;
+    fdevent_install(&fde_a, fds[0], record, &a);
+    fdevent_install(&fde_b, other[0], record, &b);
+    fdevent_set(&fde_a, FDE_READ);
+    fdevent_set(&fde_b, FDE_READ);
+
+    // Both become readable in one pass; whichever callback runs first
+    // stops the other from watching, so only one may be called.
+    a.other = &fde_b;
+    b.other = &fde_a;
+    ASSERT_EQ(1, write(fds[1], "x", 1));
+    ASSERT_EQ(1, write(other[1], "x", 1));
+    usleep(10000);
+    fdevent_loop_once(1000);
+    EXPECT_EQ(1, a.calls + b.calls);
+
+    fdevent_remove(&fde_a);
+    fdevent_remove(&fde_b);
+    close(other[1]);
+}
+
+TEST_P(FdeventTest, BackendFixedWhileInstalled) {
+    fdevent fde;
+    fdevent_install(&fde, fds[0], record, NULL);
+    EXPECT_EQ(-1, fdevent_set_backend(FDE_BACKEND_SELECT));
+    fdevent_remove(&fde);
+    EXPECT_EQ(0, fdevent_set_backend(GetParam()));
+}
+
+INSTANTIATE_TEST_CASE_P(Backends, FdeventTest,
+                        testing::Values(FDE_BACKEND_EPOLL, FDE_BACKEND_SELECT));
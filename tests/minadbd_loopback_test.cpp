@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+extern "C" {
+#include "minadbd/adb.h"
+
+// libminadbd logs errors through the recovery UI.
+void ui_print(const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
+}
+}
+
+class MinadbdLoopbackTest : public testing::Test {
+  protected:
+    virtual void SetUp() {
+        memset(&t, 0, sizeof(t));
+        t.protocol_version = A_VERSION_MIN;
+        t.max_payload = MAX_PAYLOAD_V1;
+    }
+
+    atransport t;
+};
+
+TEST_F(MinadbdLoopbackTest, OldHostKeepsSmallPayloads) {
+    negotiate_connection(&t, A_VERSION_MIN, MAX_PAYLOAD_V1);
+    EXPECT_EQ((unsigned) A_VERSION_MIN, t.protocol_version);
+    EXPECT_EQ((size_t) MAX_PAYLOAD_V1, get_max_payload(&t));
+}
+
+TEST_F(MinadbdLoopbackTest, NewHostGetsLargePayloads) {
+    negotiate_connection(&t, A_VERSION, MAX_PAYLOAD);
+    EXPECT_EQ((unsigned) A_VERSION, t.protocol_version);
+    EXPECT_EQ((size_t) MAX_PAYLOAD, get_max_payload(&t));
+
+    // Never more than either side supports.
+    negotiate_connection(&t, A_VERSION + 1, 64 * 1024);
+    EXPECT_EQ((unsigned) A_VERSION, t.protocol_version);
+    EXPECT_EQ((size_t) 64 * 1024, get_max_payload(&t));
+
+    negotiate_connection(&t, A_VERSION, 1024 * 1024);
+    EXPECT_EQ((size_t) MAX_PAYLOAD, get_max_payload(&t));
+
+    negotiate_connection(&t, A_VERSION, 0);
+    EXPECT_EQ((size_t) MAX_PAYLOAD_V1, get_max_payload(&t));
+}
+
+TEST_F(MinadbdLoopbackTest, ChecksumOnlyBeforeSkipVersion) {
+    apacket* p = get_apacket();
+    p->msg.command = A_WRTE;
+    p->msg.magic = A_WRTE ^ 0xffffffff;
+    p->msg.data_length = 4;
+    memcpy(p->data, "abcd", 4);
+    p->msg.data_check = 0;
+
+    EXPECT_NE(0, check_data(p, &t));
+    negotiate_connection(&t, A_VERSION, MAX_PAYLOAD);
+    EXPECT_EQ(0, check_data(p, &t));
+    put_apacket(p);
+}
+
+TEST_F(MinadbdLoopbackTest, PacketsAreReused) {
+    apacket* p = get_apacket();
+    p->msg.command = A_WRTE;
+    p->len = 123;
+    put_apacket(p);
+
+    apacket* q = get_apacket();
+    EXPECT_EQ(p, q);
+    EXPECT_EQ(0U, q->msg.command);
+    EXPECT_EQ(0U, q->len);
+    put_apacket(q);
+}
+
+// Packets framed as on the wire, over a socketpair standing in for USB.
+struct Loopback {
+    atransport* t;
+    int fd;
+    size_t total;
+};
+
+static const size_t kLoopbackBytes = 32 * 1024 * 1024;
+
+static void* loopback_writer(void* cookie) {
+    Loopback* l = reinterpret_cast<Loopback*>(cookie);
+    apacket* p = get_apacket();
+    size_t payload = get_max_payload(l->t);
+    for (size_t sent = 0; sent < l->total; sent += payload) {
+        p->msg.command = A_WRTE;
+        p->msg.magic = A_WRTE ^ 0xffffffff;
+        p->msg.data_length = payload;
+        memset(p->data, (int) (sent / payload), payload);
+        unsigned sum = 0;
+        if (l->t->protocol_version < A_VERSION_SKIP_CHECKSUM) {
+            for (size_t i = 0; i < payload; ++i) sum += p->data[i];
+        }
+        p->msg.data_check = sum;
+        if (writex(l->fd, &p->msg, sizeof(p->msg)) || writex(l->fd, p->data, payload)) break;
+    }
+    put_apacket(p);
+    return NULL;
+}
+
+// Returns MB/s, or -1 if a packet arrived damaged.
+static double run_loopback(atransport* t) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return -1;
+
+    Loopback l = { t, fds[0], kLoopbackBytes };
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t writer;
+    pthread_create(&writer, NULL, loopback_writer, &l);
+
+    double result = 0;
+    size_t received = 0;
+    unsigned n = 0;
+    while (received < kLoopbackBytes) {
+        apacket* p = get_apacket();
+        if (readx(fds[1], &p->msg, sizeof(p->msg)) || check_header(p) ||
+            readx(fds[1], p->data, p->msg.data_length) || check_data(p, t) ||
+            p->data[p->msg.data_length - 1] != (unsigned char) n++) {
+            put_apacket(p);
+            result = -1;
+            break;
+        }
+        received += p->msg.data_length;
+        put_apacket(p);
+    }
+    close(fds[1]);
+    pthread_join(writer, NULL);
+    close(fds[0]);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (result < 0) return result;
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return received / elapsed / (1024 * 1024);
+}
+
+TEST_F(MinadbdLoopbackTest, Throughput) {
+    double old_rate = run_loopback(&t);
+    ASSERT_GT(old_rate, 0);
+
+    negotiate_connection(&t, A_VERSION, MAX_PAYLOAD);
+    double new_rate = run_loopback(&t);
+    ASSERT_GT(new_rate, 0);
+
+    printf("loopback: %.0f MB/s with %d byte payloads, %.0f MB/s with %d\n",
+           old_rate, MAX_PAYLOAD_V1, new_rate, MAX_PAYLOAD);
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "minui/pixels.h"
+
+namespace android {
+
+// Checks the kernels picked for this CPU against the scalar reference.
+class MinuiPixelsTest : public testing::Test {
+  protected:
+    virtual void SetUp() {
+        srand(1234);
+        ops = gr_pixel_ops_select();
+    }
+
+    static unsigned char random_byte() {
+        // Bias towards the values the kernels special-case.
+        switch (rand() % 8) {
+          case 0: return 0;
+          case 1: return 255;
+          default: return rand() & 0xff;
+        }
+    }
+
+    static void randomize(std::vector<unsigned char>* buf) {
+        for (size_t i = 0; i < buf->size(); ++i) (*buf)[i] = random_byte();
+    }
+
+    static void random_color(unsigned char* color) {
+        for (int i = 0; i < 4; ++i) color[i] = random_byte();
+    }
+
+    const gr_pixel_ops* ops;
+};
+
+static const int kMaxWidth = 37;
+static const int kMaxHeight = 5;
+static const int kDstRowBytes = (kMaxWidth + 3) * 4;
+static const int kSrcRowBytes = kMaxWidth + 5;
+
+TEST_F(MinuiPixelsTest, Blend) {
+    std::vector<unsigned char> src(kSrcRowBytes * kMaxHeight);
+    std::vector<unsigned char> expected(kDstRowBytes * kMaxHeight);
+    for (int iter = 0; iter < 2000; ++iter) {
+        int width = 1 + rand() % kMaxWidth;
+        int height = 1 + rand() % kMaxHeight;
+        // Start at an arbitrary pixel so stores are unaligned too.
+        int offset = rand() % 4;
+        unsigned char color[4];
+        random_color(color);
+        randomize(&src);
+        randomize(&expected);
+        std::vector<unsigned char> actual(expected);
+
+        gr_pixel_ops_scalar.blend(&src[offset], kSrcRowBytes,
+                                  &expected[offset * 4], kDstRowBytes,
+                                  width, height, color);
+        ops->blend(&src[offset], kSrcRowBytes,
+                   &actual[offset * 4], kDstRowBytes,
+                   width, height, color);
+        ASSERT_EQ(0, memcmp(&expected[0], &actual[0], expected.size()))
+            << ops->name << " width " << width << " alpha " << (int)color[3];
+    }
+}
+
+TEST_F(MinuiPixelsTest, Fill) {
+    std::vector<unsigned char> expected(kDstRowBytes * kMaxHeight);
+    for (int iter = 0; iter < 2000; ++iter) {
+        int width = 1 + rand() % kMaxWidth;
+        int height = 1 + rand() % kMaxHeight;
+        unsigned char color[4];
+        random_color(color);
+        randomize(&expected);
+        std::vector<unsigned char> actual(expected);
+
+        gr_pixel_ops_scalar.fill(&expected[0], kDstRowBytes, width, height, color);
+        ops->fill(&actual[0], kDstRowBytes, width, height, color);
+        ASSERT_EQ(0, memcmp(&expected[0], &actual[0], expected.size()))
+            << ops->name << " width " << width << " alpha " << (int)color[3];
+    }
+}
+
+TEST_F(MinuiPixelsTest, Blit) {
+    std::vector<unsigned char> src(kDstRowBytes * kMaxHeight);
+    std::vector<unsigned char> expected(kDstRowBytes * kMaxHeight);
+    for (int iter = 0; iter < 500; ++iter) {
+        int row_len = 4 * (1 + rand() % kMaxWidth);
+        int height = 1 + rand() % kMaxHeight;
+        // Exercise both the strided and the contiguous path.
+        int row_bytes = (iter & 1) ? kDstRowBytes : row_len;
+        randomize(&src);
+        randomize(&expected);
+        std::vector<unsigned char> actual(expected);
+
+        for (int y = 0; y < height; ++y) {
+            memcpy(&expected[y * row_bytes], &src[y * row_bytes], row_len);
+        }
+        ops->blit(&src[0], row_bytes, &actual[0], row_bytes, row_len, height);
+        ASSERT_EQ(0, memcmp(&expected[0], &actual[0], expected.size()));
+    }
+}
+
+}  // namespace android
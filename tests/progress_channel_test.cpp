@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "updater/progress_channel.h"
+
+struct Record {
+    int type;
+    std::string payload;
+};
+
+static void collect(int type, const unsigned char* payload, size_t len, void* cookie) {
+    std::vector<Record>* records = reinterpret_cast<std::vector<Record>*>(cookie);
+    Record r = { type, std::string(reinterpret_cast<const char*>(payload), len) };
+    records->push_back(r);
+}
+
+static std::string preamble() {
+    std::string s(PROGRESS_MAGIC, PROGRESS_MAGIC_SIZE);
+    s += (char)PROGRESS_CHANNEL_VERSION;
+    return s;
+}
+
+static std::string record(int type, const std::string& payload) {
+    std::string s;
+    s += (char)type;
+    s += (char)(payload.size() & 0xff);
+    s += (char)(payload.size() >> 8);
+    return s + payload;
+}
+
+static std::string u32(uint32_t v) {
+    std::string s;
+    for (int i = 0; i < 4; ++i) s += (char)(v >> (8 * i));
+    return s;
+}
+
+// Feeds 'stream' in pieces of 'step' bytes.
+static int parse(const std::string& stream, std::vector<Record>* records, size_t step) {
+    ProgressParser p;
+    progress_parser_init(&p);
+    for (size_t i = 0; i < stream.size(); i += step) {
+        size_t n = std::min(step, stream.size() - i);
+        if (progress_parser_feed(&p, stream.data() + i, n, collect, records) != 0) {
+            return -1;
+        }
+    }
+    return progress_parser_finish(&p);
+}
+
+// Everything the writer put into the pipe.
+static std::string drain(int fd) {
+    std::string out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        out.append(buf, n);
+    }
+    return out;
+}
+
+class ProgressChannelTest : public testing::Test {
+  protected:
+    virtual void SetUp() {
+        ASSERT_EQ(0, pipe(fds));
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        progress_writer_init(&w, fds[1]);
+    }
+    virtual void TearDown() {
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    int fds[2];
+    ProgressWriter w;
+};
+
+TEST_F(ProgressChannelTest, RoundTrip) {
+    ASSERT_EQ(0, progress_show(&w, 0.5, 10));
+    ASSERT_EQ(0, progress_print(&w, "Installing\n", 11));
+    ASSERT_EQ(0, progress_write(&w, PROGRESS_WIPE_CACHE, NULL, 0));
+    ASSERT_EQ(0, progress_text(&w, "clear_display\n", 14));
+    ASSERT_EQ(0, progress_flush(&w));
+    std::string stream = drain(fds[0]);
+
+    // However it's cut up on the way.
+    for (size_t step = 1; step <= stream.size(); ++step) {
+        std::vector<Record> records;
+        ASSERT_EQ(0, parse(stream, &records, step)) << "step " << step;
+        ASSERT_EQ(4U, records.size());
+        EXPECT_EQ(PROGRESS_SHOW, records[0].type);
+        EXPECT_EQ(500000U, progress_get_u32((const unsigned char*)records[0].payload.data()));
+        EXPECT_EQ(10U, progress_get_u32((const unsigned char*)records[0].payload.data() + 4));
+        EXPECT_EQ(PROGRESS_PRINT, records[1].type);
+        EXPECT_EQ("Installing\n", records[1].payload);
+        EXPECT_EQ(PROGRESS_WIPE_CACHE, records[2].type);
+        EXPECT_EQ("", records[2].payload);
+        EXPECT_EQ(PROGRESS_TEXT, records[3].type);
+        EXPECT_EQ("clear_display\n", records[3].payload);
+    }
+}
+
+TEST_F(ProgressChannelTest, SetProgressNotHeld) {
+    ASSERT_EQ(0, progress_set(&w, 0.1));
+    EXPECT_NE("", drain(fds[0]));
+
+    // However quickly they come, each is in the pipe before the call
+    // returns: the last one before a long step mustn't wait for the next.
+    for (int i = 2; i <= 100; ++i) {
+        ASSERT_EQ(0, progress_set(&w, i / 100.0));
+        std::string stream = preamble() + drain(fds[0]);
+        std::vector<Record> records;
+        ASSERT_EQ(0, parse(stream, &records, stream.size()));
+        ASSERT_EQ(1U, records.size());
+        EXPECT_EQ(PROGRESS_SET, records[0].type);
+        EXPECT_EQ((uint32_t)(i * PROGRESS_FRACTION_ONE / 100),
+                  progress_get_u32((const unsigned char*)records[0].payload.data()));
+    }
+}
+
+TEST_F(ProgressChannelTest, FlushSendsPreamble) {
+    ASSERT_EQ(0, progress_flush(&w));
+    std::vector<Record> records;
+    std::string stream = drain(fds[0]);
+    EXPECT_EQ(preamble(), stream);
+    EXPECT_EQ(0, parse(stream, &records, 1));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST_F(ProgressChannelTest, LongPrintSplit) {
+    std::string text(PROGRESS_MAX_PAYLOAD * 2 + 100, 'a');
+    ASSERT_EQ(0, progress_print(&w, text.data(), text.size()));
+    std::vector<Record> records;
+    ASSERT_EQ(0, parse(drain(fds[0]), &records, 1000));
+    ASSERT_EQ(3U, records.size());
+    std::string joined;
+    for (size_t i = 0; i < records.size(); ++i) {
+        EXPECT_EQ(PROGRESS_PRINT, records[i].type);
+        joined += records[i].payload;
+    }
+    EXPECT_EQ(text, joined);
+}
+
+TEST_F(ProgressChannelTest, FractionsClamped) {
+    ASSERT_EQ(0, progress_show(&w, 2.5, -3));
+    std::vector<Record> records;
+    ASSERT_EQ(0, parse(drain(fds[0]), &records, 64));
+    ASSERT_EQ(1U, records.size());
+    const unsigned char* payload = (const unsigned char*)records[0].payload.data();
+    EXPECT_EQ((uint32_t)PROGRESS_FRACTION_ONE, progress_get_u32(payload));
+    EXPECT_EQ(0U, progress_get_u32(payload + 4));
+}
+
+TEST_F(ProgressChannelTest, WriteFailureSticks) {
+    close(fds[0]);
+    signal(SIGPIPE, SIG_IGN);
+    EXPECT_EQ(-1, progress_print(&w, "x", 1));
+    EXPECT_EQ(-1, progress_flush(&w));
+    fds[0] = open("/dev/null", O_RDONLY);
+}
+
+TEST(ProgressParserTest, Empty) {
+    std::vector<Record> records;
+    EXPECT_EQ(0, parse("", &records, 1));
+    EXPECT_EQ(0, parse(preamble(), &records, 1));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST(ProgressParserTest, BadPreamble) {
+    std::vector<Record> records;
+    std::string bad = preamble();
+    bad[1] = 'X';
+    EXPECT_EQ(-1, parse(bad + record(PROGRESS_PRINT, "x"), &records, 1));
+
+    std::string version = preamble();
+    version[PROGRESS_MAGIC_SIZE] = PROGRESS_CHANNEL_VERSION + 1;
+    EXPECT_EQ(-1, parse(version + record(PROGRESS_PRINT, "x"), &records, 64));
+
+    // Text commands aren't records.
+    EXPECT_EQ(-1, parse("ui_print hello\n", &records, 64));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST(ProgressParserTest, UnknownType) {
+    std::vector<Record> records;
+    EXPECT_EQ(-1, parse(preamble() + record(0, ""), &records, 64));
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_TEXT + 1, "x"), &records, 64));
+    EXPECT_EQ(-1, parse(preamble() + record(0xff, "x"), &records, 64));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST(ProgressParserTest, WrongPayloadSize) {
+    std::vector<Record> records;
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_SHOW, u32(1)), &records, 64));
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_SET, u32(1) + u32(1)), &records, 64));
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_SET, ""), &records, 64));
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_WIPE_CACHE, "x"), &records, 64));
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_CLEAR_DISPLAY, "x"), &records, 64));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST(ProgressParserTest, Oversized) {
+    std::vector<Record> records;
+    std::string big(PROGRESS_MAX_PAYLOAD + 1, 'a');
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_PRINT, big), &records, 512));
+
+    // Refused on the header alone, without waiting for the payload.
+    std::string header = preamble() + record(PROGRESS_PRINT, big).substr(0, PROGRESS_HEADER_SIZE);
+    ProgressParser p;
+    progress_parser_init(&p);
+    EXPECT_EQ(-1, progress_parser_feed(&p, header.data(), header.size(), collect, &records));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST(ProgressParserTest, FractionOutOfRange) {
+    std::vector<Record> records;
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_SET, u32(PROGRESS_FRACTION_ONE + 1)),
+                        &records, 64));
+    EXPECT_EQ(-1, parse(preamble() + record(PROGRESS_SHOW, u32(0xffffffff) + u32(5)),
+                        &records, 64));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST(ProgressParserTest, Truncated) {
+    std::string stream = preamble() + record(PROGRESS_PRINT, "hello") +
+            record(PROGRESS_SHOW, u32(1) + u32(2));
+    for (size_t cut = 1; cut < stream.size(); ++cut) {
+        std::vector<Record> records;
+        bool boundary = cut == PROGRESS_PREAMBLE_SIZE ||
+                cut == PROGRESS_PREAMBLE_SIZE + PROGRESS_HEADER_SIZE + 5;
+        EXPECT_EQ(boundary ? 0 : -1, parse(stream.substr(0, cut), &records, 3))
+                << "cut at " << cut;
+    }
+}
+
+TEST(ProgressParserTest, ErrorSticks) {
+    std::vector<Record> records;
+    ProgressParser p;
+    progress_parser_init(&p);
+    std::string bad = preamble() + record(0x42, "");
+    EXPECT_EQ(-1, progress_parser_feed(&p, bad.data(), bad.size(), collect, &records));
+
+    // Valid records after it are ignored.
+    std::string good = record(PROGRESS_PRINT, "x");
+    EXPECT_EQ(-1, progress_parser_feed(&p, good.data(), good.size(), collect, &records));
+    EXPECT_EQ(-1, progress_parser_finish(&p));
+    EXPECT_TRUE(records.empty());
+}
+
+TEST(ProgressParserTest, RecordsBeforeErrorDelivered) {
+    std::vector<Record> records;
+    std::string stream = preamble() + record(PROGRESS_PRINT, "a") +
+            record(PROGRESS_WIPE_CACHE, "") + record(PROGRESS_SET, "xy");
+    EXPECT_EQ(-1, parse(stream, &records, stream.size()));
+    ASSERT_EQ(2U, records.size());
+    EXPECT_EQ(PROGRESS_PRINT, records[0].type);
+    EXPECT_EQ(PROGRESS_WIPE_CACHE, records[1].type);
+}
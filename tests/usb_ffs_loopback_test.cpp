@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// minadbd's FunctionFS transport against the kernel's own: the gadget
+// is put together in configfs on a dummy_hcd UDC, and the test drives
+// the host side of it through usbfs.  Needs root and a kernel with
+// configfs, FunctionFS and dummy_hcd; without them there's nothing to
+// test.
+
+#include <gtest/gtest.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/usb/ch9.h>
+#include <linux/usbdevice_fs.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// usb_linux_client.c is built into the test on its own, with what it
+// needs from the rest of minadbd.  adb.h can't be included: sysdeps.h
+// renames open(), read() and friends.
+extern "C" {
+typedef struct usb_handle usb_handle;
+void usb_init();
+int usb_write(usb_handle* h, const void* data, int len);
+int usb_read(usb_handle* h, void* data, int len);
+void usb_kick(usb_handle* h);
+
+int adb_trace_mask;
+pthread_mutex_t D_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t registered_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t registered_cond = PTHREAD_COND_INITIALIZER;
+static usb_handle* registered_handle;
+static int registered_count;
+
+void register_usb_transport(usb_handle* h, const char* serial, unsigned writeable) {
+    pthread_mutex_lock(&registered_lock);
+    registered_handle = h;
+    registered_count++;
+    pthread_cond_broadcast(&registered_cond);
+    pthread_mutex_unlock(&registered_lock);
+}
+
+void fatal(const char* fmt, ...) { abort(); }
+void fatal_errno(const char* fmt, ...) { abort(); }
+}
+
+// As in minadbd/adb.h.
+#define USB_FFS_ADB_PATH  "/dev/usb-ffs/adb/"
+#define USB_FFS_ADB_EP0   USB_FFS_ADB_PATH "ep0"
+#define USB_FFS_ADB_IN    USB_FFS_ADB_PATH "ep2"
+
+static const char kGadget[] = "/sys/kernel/config/usb_gadget/minadbd_test";
+static const char kVendor[] = "18d1";
+static const char kProduct[] = "d00d";
+
+static bool write_file(const std::string& path, const std::string& value) {
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) return false;
+    bool ok = write(fd, value.data(), value.size()) == (ssize_t)value.size();
+    close(fd);
+    return ok;
+}
+
+static std::string read_file(const std::string& path) {
+    char buf[256];
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return "";
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return "";
+    buf[n] = '\0';
+    return std::string(buf, strcspn(buf, "\n"));
+}
+
+// The first UDC there is, which is dummy_hcd's on a machine without
+// real gadget hardware.
+static std::string find_udc() {
+    DIR* d = opendir("/sys/class/udc");
+    if (d == NULL) return "";
+    std::string udc;
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] != '.') {
+            udc = de->d_name;
+            break;
+        }
+    }
+    closedir(d);
+    return udc;
+}
+
+static bool wait_for(bool (*ready)(), int ms) {
+    for (int i = 0; i < ms / 10; ++i) {
+        if (ready()) return true;
+        usleep(10000);
+    }
+    return ready();
+}
+
+static bool endpoints_open() {
+    return access(USB_FFS_ADB_IN, F_OK) == 0;
+}
+
+// The host's view of the gadget: its usbfs node, and the bulk
+// endpoints as the UDC numbered them.
+struct HostDevice {
+    int fd;
+    unsigned char ep_out;
+    unsigned char ep_in;
+};
+
+static bool find_device(HostDevice* dev) {
+    DIR* d = opendir("/sys/bus/usb/devices");
+    if (d == NULL) return false;
+    std::string found;
+    struct dirent* de;
+    while ((de = readdir(d)) != NULL) {
+        std::string base = std::string("/sys/bus/usb/devices/") + de->d_name;
+        if (read_file(base + "/idVendor") == kVendor &&
+            read_file(base + "/idProduct") == kProduct) {
+            found = base;
+            break;
+        }
+    }
+    closedir(d);
+    if (found.empty()) return false;
+
+    std::string node = "/dev/bus/usb/";
+    char num[16];
+    snprintf(num, sizeof(num), "%03d/", atoi(read_file(found + "/busnum").c_str()));
+    node += num;
+    snprintf(num, sizeof(num), "%03d", atoi(read_file(found + "/devnum").c_str()));
+    node += num;
+
+    std::string intf = found + "/" + found.substr(found.rfind('/') + 1) + ":1.0";
+    dev->ep_out = dev->ep_in = 0;
+    d = opendir(intf.c_str());
+    if (d == NULL) return false;
+    while ((de = readdir(d)) != NULL) {
+        unsigned addr;
+        if (sscanf(de->d_name, "ep_%x", &addr) != 1) continue;
+        if (addr & USB_DIR_IN) {
+            dev->ep_in = addr;
+        } else {
+            dev->ep_out = addr;
+        }
+    }
+    closedir(d);
+    if (dev->ep_out == 0 || dev->ep_in == 0) return false;
+
+    dev->fd = open(node.c_str(), O_RDWR);
+    if (dev->fd < 0) return false;
+    unsigned int interface = 0;
+    if (ioctl(dev->fd, USBDEVFS_CLAIMINTERFACE, &interface) != 0) {
+        close(dev->fd);
+        return false;
+    }
+    return true;
+}
+
+static int host_bulk(HostDevice* dev, unsigned char ep, void* data, size_t len) {
+    struct usbdevfs_bulktransfer bulk;
+    bulk.ep = ep;
+    bulk.len = len;
+    bulk.timeout = 5000;
+    bulk.data = data;
+    return ioctl(dev->fd, USBDEVFS_BULK, &bulk);
+}
+
+// Everything is set up once: minadbd's open thread runs for the rest of
+// the process, as it does in recovery.
+static bool available;
+static HostDevice host;
+
+static bool wait_registered(int count) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 10;
+    pthread_mutex_lock(&registered_lock);
+    while (registered_count < count) {
+        if (pthread_cond_timedwait(&registered_cond, &registered_lock, &deadline) != 0) break;
+    }
+    bool ok = registered_count >= count;
+    pthread_mutex_unlock(&registered_lock);
+    return ok;
+}
+
+// Binds the gadget once minadbd has written its descriptors, and finds
+// it on the host side.
+static bool connect_host() {
+    if (!wait_for(endpoints_open, 10000)) return false;
+    std::string udc = find_udc();
+    if (read_file(std::string(kGadget) + "/UDC").empty() &&
+        !write_file(std::string(kGadget) + "/UDC", udc)) {
+        return false;
+    }
+    for (int i = 0; i < 500; ++i) {
+        if (find_device(&host)) return true;
+        usleep(10000);
+    }
+    return false;
+}
+
+static bool set_up_gadget() {
+    if (getuid() != 0 || find_udc().empty()) return false;
+
+    std::string g = kGadget;
+    mkdir(g.c_str(), 0755);
+    mkdir((g + "/strings/0x409").c_str(), 0755);
+    mkdir((g + "/configs/c.1").c_str(), 0755);
+    mkdir((g + "/functions/ffs.adb").c_str(), 0755);
+    if (!write_file(g + "/idVendor", std::string("0x") + kVendor) ||
+        !write_file(g + "/idProduct", std::string("0x") + kProduct) ||
+        !write_file(g + "/strings/0x409/serialnumber", "minadbd_test")) {
+        return false;
+    }
+    symlink((g + "/functions/ffs.adb").c_str(), (g + "/configs/c.1/ffs.adb").c_str());
+
+    mkdir("/dev/usb-ffs", 0755);
+    mkdir(USB_FFS_ADB_PATH, 0755);
+    if (access(USB_FFS_ADB_EP0, F_OK) != 0 &&
+        mount("adb", USB_FFS_ADB_PATH, "functionfs", 0, NULL) != 0) {
+        return false;
+    }
+
+    usb_init();
+    return connect_host() && wait_registered(1);
+}
+
+// This gtest can't mark a test skipped, so each one says so itself
+// rather than passing quietly.
+#define SKIP_UNLESS_AVAILABLE()                                             \
+    do {                                                                    \
+        if (!available) {                                                   \
+            printf("[  SKIPPED ] %s: no FunctionFS gadget on a dummy_hcd UDC\n", \
+                   testing::UnitTest::GetInstance()->current_test_info()->name()); \
+            return;                                                         \
+        }                                                                   \
+    } while (0)
+
+class UsbFfsLoopbackTest : public testing::Test {
+  protected:
+    static void SetUpTestCase() {
+        available = set_up_gadget();
+    }
+
+    void Random(std::vector<char>* buf) {
+        for (size_t i = 0; i < buf->size(); ++i) {
+            (*buf)[i] = rand() >> 7;
+        }
+    }
+
+    // Host to device in transfers of 'step', which the device reads one
+    // at a time as it does adb messages.
+    void HostToDevice(size_t len, size_t step) {
+        std::vector<char> sent(len), got(len);
+        Random(&sent);
+
+        struct Writer {
+            std::vector<char>* data;
+            size_t step;
+            bool ok;
+            static void* run(void* cookie) {
+                Writer* w = reinterpret_cast<Writer*>(cookie);
+                size_t len = w->data->size();
+                w->ok = true;
+                for (size_t done = 0; done < len && w->ok; done += w->step) {
+                    size_t n = std::min(w->step, len - done);
+                    w->ok = host_bulk(&host, host.ep_out, &(*w->data)[done], n) == (int)n;
+                }
+                return NULL;
+            }
+        } writer = { &sent, step, false };
+        pthread_t thread;
+        pthread_create(&thread, NULL, Writer::run, &writer);
+
+        int result = 0;
+        for (size_t done = 0; done < len && result == 0; done += step) {
+            result = usb_read(registered_handle, &got[done], std::min(step, len - done));
+        }
+        pthread_join(thread, NULL);
+        ASSERT_TRUE(writer.ok);
+        ASSERT_EQ(0, result);
+        EXPECT_EQ(0, memcmp(&sent[0], &got[0], len));
+    }
+
+    // Device to host: several transfers' worth in one usb_write().
+    void DeviceToHost(size_t len) {
+        std::vector<char> sent(len), got(len);
+        Random(&sent);
+
+        struct Writer {
+            std::vector<char>* data;
+            int result;
+            static void* run(void* cookie) {
+                Writer* w = reinterpret_cast<Writer*>(cookie);
+                w->result = usb_write(registered_handle, &(*w->data)[0], w->data->size());
+                return NULL;
+            }
+        } writer = { &sent, -1 };
+        pthread_t thread;
+        pthread_create(&thread, NULL, Writer::run, &writer);
+
+        size_t done = 0;
+        while (done < len) {
+            int n = host_bulk(&host, host.ep_in, &got[done], len - done);
+            if (n <= 0) break;
+            done += n;
+        }
+        pthread_join(thread, NULL);
+        ASSERT_EQ(len, done);
+        EXPECT_EQ(0, writer.result);
+        EXPECT_EQ(0, memcmp(&sent[0], &got[0], len));
+    }
+};
+
+TEST_F(UsbFfsLoopbackTest, SmallPackets) {
+    SKIP_UNLESS_AVAILABLE();
+    // An adb message header and a short payload, as adbd sees them.
+    HostToDevice(24, 24);
+    HostToDevice(100, 100);
+    DeviceToHost(24);
+    DeviceToHost(511);
+}
+
+TEST_F(UsbFfsLoopbackTest, LargeStream) {
+    SKIP_UNLESS_AVAILABLE();
+    // Packets that end on a USB packet boundary, which the host doesn't
+    // mark, and ones bigger than all the transfers in flight at once.
+    HostToDevice(256 * 1024, 4096);
+    HostToDevice(256 * 1024 + 7, 128 * 1024 + 7);
+    DeviceToHost(256 * 1024 + 3);
+}
+
+TEST_F(UsbFfsLoopbackTest, KickThenReconnect) {
+    SKIP_UNLESS_AVAILABLE();
+    HostToDevice(4096, 4096);
+
+    // Whatever was queued for the old connection must not turn up on
+    // the new one.
+    usb_kick(registered_handle);
+    close(host.fd);
+    ASSERT_TRUE(connect_host());
+    ASSERT_TRUE(wait_registered(2));
+
+    HostToDevice(8192, 1024);
+    DeviceToHost(8192);
+}
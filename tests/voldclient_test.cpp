@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <cutils/sockets.h>
+
+#include "voldclient/voldclient.h"
+
+// voldclient logs errors through the recovery UI.
+extern "C" void ui_print(const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    vprintf(format, ap);
+    va_end(ap);
+}
+
+extern void vold_set_socket(const char* name, int ns);
+
+static const char kSocketName[] = "voldclient_test";
+
+// A stand-in for vold, answering one connection at a time.  Besides
+// "volume list" it understands:
+//   burst N   N rounds of hotplug broadcasts for every volume, then
+//             one for a volume that was never listed
+//   hold      no answer until "release"
+//   release   answers everything held, newest first, then itself
+//   fail      answers 400
+//   ignore    never answers
+//   drop      closes the connection
+static int vold_server = -1;
+
+static const int kVolumes = 16;
+
+static void reply(int fd, int code, int seq, const char* msg) {
+    char line[128];
+    int len = snprintf(line, sizeof(line), "%d %d %s", code, seq, msg) + 1;
+    send(fd, line, len, MSG_NOSIGNAL);
+}
+
+static void append(std::string* out, const char* format, ...) {
+    char line[128];
+    va_list ap;
+    va_start(ap, format);
+    int len = vsnprintf(line, sizeof(line), format, ap);
+    va_end(ap);
+    out->append(line, len + 1);
+}
+
+static void burst(int fd, int seq, int rounds) {
+    std::string out;
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < kVolumes; ++i) {
+            append(&out, "631 Volume usb%d /storage/usb%d disk removed (8:%d)", i, i, i);
+            append(&out, "630 Volume usb%d /storage/usb%d disk inserted (8:%d)", i, i, i);
+            append(&out, "605 Volume usb%d /storage/usb%d state changed from "
+                   "1 (Idle-Unmounted) to 4 (Mounted)", i, i);
+        }
+        send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+        out.clear();
+    }
+    append(&out, "630 Volume otg /storage/otg disk inserted (8:99)");
+    append(&out, "200 %d Burst done", seq);
+    send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+}
+
+static bool serve_command(int fd, char* line, std::vector<int>* held) {
+    int seq = atoi(line);
+    const char* cmd = strchr(line, ' ');
+    cmd = cmd ? cmd + 1 : "";
+
+    if (strcmp(cmd, "volume list") == 0) {
+        std::string out;
+        for (int i = 0; i < kVolumes; ++i) {
+            append(&out, "110 %d usb%d /storage/usb%d 1", seq, i, i);
+        }
+        append(&out, "200 %d Volumes listed.", seq);
+        send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+    } else if (strncmp(cmd, "burst ", 6) == 0) {
+        burst(fd, seq, atoi(cmd + 6));
+    } else if (strcmp(cmd, "hold") == 0) {
+        held->push_back(seq);
+    } else if (strcmp(cmd, "release") == 0) {
+        // All in one write, split mid-line, so the client has to
+        // reassemble responses across reads.
+        std::string out;
+        char line[64];
+        for (size_t i = held->size(); i-- > 0; ) {
+            int len = snprintf(line, sizeof(line), "200 %d Command succeeded", (*held)[i]);
+            out.append(line, len + 1);
+        }
+        int len = snprintf(line, sizeof(line), "200 %d Released", seq);
+        out.append(line, len + 1);
+        held->clear();
+
+        size_t half = out.size() / 2 + 3;
+        send(fd, out.data(), half, MSG_NOSIGNAL);
+        usleep(20000);
+        send(fd, out.data() + half, out.size() - half, MSG_NOSIGNAL);
+    } else if (strcmp(cmd, "fail") == 0) {
+        reply(fd, 400, seq, "Command failed");
+    } else if (strcmp(cmd, "drop") == 0) {
+        return false;
+    }
+    return true;
+}
+
+static void* vold_server_thread(void*) {
+    for (;;) {
+        int fd = accept(vold_server, NULL, NULL);
+        if (fd < 0) continue;
+
+        std::vector<int> held;
+        char buf[1024];
+        size_t filled = 0;
+        bool open = true;
+        while (open) {
+            ssize_t n = read(fd, buf + filled, sizeof(buf) - filled);
+            if (n <= 0) break;
+            filled += n;
+
+            size_t start = 0;
+            for (size_t i = 0; i < filled && open; ++i) {
+                if (buf[i] == '\0') {
+                    open = serve_command(fd, buf + start, &held);
+                    start = i + 1;
+                }
+            }
+            memmove(buf, buf + start, filled - start);
+            filled -= start;
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+class VoldClientTest : public testing::Test {
+  protected:
+    static void SetUpTestCase() {
+        static struct vold_callbacks callbacks = { NULL, NULL, NULL };
+        vold_server = socket_local_server(kSocketName, ANDROID_SOCKET_NAMESPACE_ABSTRACT,
+                                          SOCK_STREAM);
+        ASSERT_GE(vold_server, 0);
+        pthread_t t;
+        pthread_create(&t, NULL, vold_server_thread, NULL);
+
+        vold_set_socket(kSocketName, ANDROID_SOCKET_NAMESPACE_ABSTRACT);
+        vold_client_start(&callbacks, 0);
+    }
+};
+
+struct Results {
+    pthread_mutex_t lock;
+    std::vector<int> seqs;
+    std::vector<int> codes;
+};
+
+static void record(int seq, int code, void* cookie) {
+    Results* r = reinterpret_cast<Results*>(cookie);
+    pthread_mutex_lock(&r->lock);
+    r->seqs.push_back(seq);
+    r->codes.push_back(code);
+    pthread_mutex_unlock(&r->lock);
+}
+
+TEST_F(VoldClientTest, SynchronousCommands) {
+    const char* list[2] = { "volume", "list" };
+    EXPECT_EQ(0, vold_command(2, list, 1));
+    EXPECT_EQ(kVolumes, vold_get_num_volumes());
+
+    const char* fail[1] = { "fail" };
+    EXPECT_EQ(-1, vold_command(1, fail, 1));
+}
+
+TEST_F(VoldClientTest, ResponsesOutOfOrder) {
+    Results r;
+    pthread_mutex_init(&r.lock, NULL);
+
+    const char* hold[1] = { "hold" };
+    std::vector<int> sent;
+    for (int i = 0; i < 8; ++i) {
+        int seq = vold_command_async(1, hold, record, &r);
+        ASSERT_GE(seq, 0);
+        sent.push_back(seq);
+    }
+    int waited = vold_command_async(1, hold, NULL, NULL);
+    ASSERT_GE(waited, 0);
+
+    // Everything held was answered before "release" itself.
+    const char* release[1] = { "release" };
+    EXPECT_EQ(0, vold_command(1, release, 1));
+    EXPECT_EQ(200, vold_command_wait(waited, 1000));
+
+    pthread_mutex_lock(&r.lock);
+    ASSERT_EQ(8U, r.seqs.size());
+    for (size_t i = 0; i < 8; ++i) {
+        EXPECT_EQ(sent[7 - i], r.seqs[i]);
+        EXPECT_EQ(200, r.codes[i]);
+    }
+    pthread_mutex_unlock(&r.lock);
+}
+
+TEST_F(VoldClientTest, WaitTimesOut) {
+    const char* ignore[1] = { "ignore" };
+    int seq = vold_command_async(1, ignore, NULL, NULL);
+    ASSERT_GE(seq, 0);
+
+    double start = now_ms();
+    EXPECT_EQ(-1, vold_command_wait(seq, 100));
+    EXPECT_GE(now_ms() - start, 95);
+
+    // It's gone once waited for.
+    EXPECT_EQ(-1, vold_command_wait(seq, 0));
+}
+
+TEST_F(VoldClientTest, DisconnectFailsCommandsInFlight) {
+    Results r;
+    pthread_mutex_init(&r.lock, NULL);
+
+    const char* hold[1] = { "hold" };
+    int waited = vold_command_async(1, hold, NULL, NULL);
+    ASSERT_GE(waited, 0);
+    ASSERT_GE(vold_command_async(1, hold, record, &r), 0);
+
+    const char* drop[1] = { "drop" };
+    ASSERT_GE(vold_command_async(1, drop, record, &r), 0);
+    EXPECT_EQ(-1, vold_command_wait(waited, 5000));
+
+    // Callbacks run on the event thread, maybe just after the waiter wakes.
+    for (int i = 0; i < 100; ++i) {
+        pthread_mutex_lock(&r.lock);
+        size_t n = r.codes.size();
+        pthread_mutex_unlock(&r.lock);
+        if (n == 2) break;
+        usleep(10000);
+    }
+    pthread_mutex_lock(&r.lock);
+    ASSERT_EQ(2U, r.codes.size());
+    EXPECT_EQ(-1, r.codes[0]);
+    EXPECT_EQ(-1, r.codes[1]);
+    pthread_mutex_unlock(&r.lock);
+
+    // The client reconnects and carries on.
+    const char* list[2] = { "volume", "list" };
+    double deadline = now_ms() + 10000;
+    int result;
+    while ((result = vold_command(2, list, 1)) != 0 && now_ms() < deadline) {
+        usleep(100000);
+    }
+    EXPECT_EQ(0, result);
+}
+
+TEST_F(VoldClientTest, HotplugDeltas) {
+    const char* list[2] = { "volume", "list" };
+    ASSERT_EQ(0, vold_command(2, list, 1));
+    ASSERT_EQ(kVolumes, vold_get_num_volumes());
+
+    // Listing again changes nothing, so nothing needs redrawing.
+    unsigned int generation = vold_get_volumes_generation();
+    ASSERT_EQ(0, vold_command(2, list, 1));
+    EXPECT_EQ(generation, vold_get_volumes_generation());
+
+    const int kRounds = 500;
+    char rounds[16];
+    snprintf(rounds, sizeof(rounds), "%d", kRounds);
+    const char* burst[2] = { "burst", rounds };
+    double start = now_ms();
+    ASSERT_EQ(0, vold_command(2, burst, 1));
+    double deltas = now_ms() - start;
+
+    EXPECT_NE(generation, vold_get_volumes_generation());
+    EXPECT_EQ(kVolumes + 1, vold_get_num_volumes());
+    EXPECT_EQ(4, vold_get_volume_state("/storage/usb0"));
+    EXPECT_EQ(4, vold_get_volume_state("/storage/usb15"));
+    EXPECT_EQ(1, vold_get_volume_state("/storage/otg"));
+
+    // What a full rescan per event would have cost instead.
+    const int kLists = 200;
+    start = now_ms();
+    for (int i = 0; i < kLists; ++i) {
+        ASSERT_EQ(0, vold_command(2, list, 1));
+    }
+    double lists = now_ms() - start;
+
+    // The last list dropped the volume vold never reported.
+    EXPECT_EQ(kVolumes, vold_get_num_volumes());
+    EXPECT_EQ(0, vold_get_volume_state("/storage/otg"));
+    EXPECT_EQ(1, vold_get_volume_state("/storage/usb0"));
+
+    int events = kRounds * kVolumes * 3 + 1;
+    printf("%d hotplug events applied in %.1f ms (%.2f us each); "
+           "a full volume list takes %.1f us\n",
+           events, deltas, deltas * 1000 / events, lists * 1000 / kLists);
+}
@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -29,12 +31,15 @@
 #include <unistd.h>
 #include <poll.h>
 
+#include <linux/netlink.h>
+
 #include <cutils/android_reboot.h>
 #include <cutils/properties.h>
 
 #include "common.h"
 #include "roots.h"
 #include "device.h"
+#include "log_writer.h"
 #include "minui/minui.h"
 #include "screen_ui.h"
 #include "ui.h"
@@ -44,6 +49,9 @@
 #include "messagesocket.h"
 
 #define UI_WAIT_KEY_TIMEOUT_SEC    120
+// How often WaitKey() looks for keys and the USB state if it has no
+// way to be woken for them.
+#define UI_WAIT_KEY_POLL_MS        1000
 
 // There's only (at most) one of these objects, and global callbacks
 // (for pthread_create, and the input event system) need to find it,
@@ -144,7 +152,12 @@ RecoveryUI::RecoveryUI() :
     max_y_touch(0),
     mt_count(0) {
     pthread_mutex_init(&key_queue_mutex, NULL);
-    pthread_cond_init(&key_queue_cond, NULL);
+    v_changed = 0;
+    wait_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wait_fd < 0) {
+        printf("failed to create WaitKey eventfd: %s\n", strerror(errno));
+    }
+    uevent_fd = -1;
     self = this;
 }
 
@@ -153,6 +166,7 @@ void RecoveryUI::Init() {
     ev_init(input_callback, NULL);
     message_socket.ServerInit();
     ev_add_fd(message_socket.fd(), message_socket_listen_event, &message_socket);
+    open_uevent_socket();
     pthread_create(&input_t, NULL, input_thread, NULL);
 }
 
@@ -247,6 +261,7 @@ void RecoveryUI::process_key(int key_code, int updown) {
 
           case RecoveryUI::REBOOT:
             vold_unmount_all();
+            log_flush();
             android_reboot(ANDROID_RB_RESTART, 0, 0);
             break;
 
@@ -377,7 +392,7 @@ void RecoveryUI::EnqueueKey(int key_code) {
     const int queue_max = sizeof(key_queue) / sizeof(key_queue[0]);
     if (key_queue_len < queue_max) {
         key_queue[key_queue_len++] = key_code;
-        pthread_cond_signal(&key_queue_cond);
+        wake_waiter();
     }
     pthread_mutex_unlock(&key_queue_mutex);
 }
@@ -398,36 +413,58 @@ void RecoveryUI::CancelWaitKey()
     pthread_mutex_lock(&key_queue_mutex);
     key_queue[key_queue_len] = -2;
     key_queue_len++;
-    pthread_cond_signal(&key_queue_cond);
     pthread_mutex_unlock(&key_queue_mutex);
+    wake_waiter();
 }
 
-int RecoveryUI::WaitKey()
+// Wake WaitKey(): a key was queued, the volumes changed or the USB
+// state did.
+void RecoveryUI::wake_waiter()
 {
-    pthread_mutex_lock(&key_queue_mutex);
-    int timeouts = UI_WAIT_KEY_TIMEOUT_SEC;
+    uint64_t one = 1;
+    if (wait_fd >= 0) write(wait_fd, &one, sizeof(one));
+}
 
+int RecoveryUI::WaitKey()
+{
     // Time out after UI_WAIT_KEY_TIMEOUT_SEC, unless a USB cable is
     // plugged in.
-    do {
-        struct timeval now;
-        struct timespec timeout;
-        gettimeofday(&now, NULL);
-        timeout.tv_sec = now.tv_sec;
-        timeout.tv_nsec = now.tv_usec * 1000;
-        timeout.tv_sec += 1;
-
-        int rc = 0;
-        while (key_queue_len == 0 && rc != ETIMEDOUT) {
-            rc = pthread_cond_timedwait(&key_queue_cond, &key_queue_mutex,
-                                        &timeout);
-            if (VolumesChanged()) {
-                pthread_mutex_unlock(&key_queue_mutex);
-                return Device::kRefresh;
-            }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    time_t deadline = now.tv_sec + UI_WAIT_KEY_TIMEOUT_SEC;
+
+    pthread_mutex_lock(&key_queue_mutex);
+    while (key_queue_len == 0) {
+        if (v_changed) {
+            v_changed = 0;
+            pthread_mutex_unlock(&key_queue_mutex);
+            return Device::kRefresh;
+        }
+
+        // Sleep until something happens; past the deadline that is only
+        // a key, a volume change or the USB cable being unplugged.
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int timeout = -1;
+        if (now.tv_sec < deadline) {
+            timeout = (deadline - now.tv_sec) * 1000 - now.tv_nsec / 1000000;
+        } else if (!usb_connected()) {
+            break;
+        }
+        // Without the eventfd a key can't wake us, and without the
+        // uevent socket an unplug can't; look again every so often.
+        if ((wait_fd < 0 || (uevent_fd < 0 && timeout < 0)) &&
+            (timeout < 0 || timeout > UI_WAIT_KEY_POLL_MS)) {
+            timeout = UI_WAIT_KEY_POLL_MS;
         }
-        timeouts--;
-    } while ((timeouts || usb_connected()) && key_queue_len == 0);
+
+        pthread_mutex_unlock(&key_queue_mutex);
+        struct pollfd pfd = { wait_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout) > 0) {
+            uint64_t count;
+            read(wait_fd, &count, sizeof(count));
+        }
+        pthread_mutex_lock(&key_queue_mutex);
+    }
 
     int key = -1;
     if (key_queue_len > 0) {
@@ -438,6 +475,48 @@ int RecoveryUI::WaitKey()
     return key;
 }
 
+// Listen for kernel uevents, to hear about USB being plugged in or out
+// without polling sysfs.
+void RecoveryUI::open_uevent_socket()
+{
+    uevent_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                       NETLINK_KOBJECT_UEVENT);
+    if (uevent_fd < 0) {
+        printf("failed to open uevent socket: %s\n", strerror(errno));
+        return;
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 0xffffffff;
+    if (bind(uevent_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 ||
+        ev_add_fd(uevent_fd, uevent_callback, NULL) < 0) {
+        printf("failed to listen for uevents: %s\n", strerror(errno));
+        close(uevent_fd);
+        uevent_fd = -1;
+    }
+}
+
+int RecoveryUI::uevent_callback(int fd, short revents, void* data)
+{
+    if (!(revents & POLLIN)) return 0;
+
+    // "<action>@<devpath>\0KEY=value\0KEY=value\0..."
+    char buf[1024];
+    ssize_t len;
+    while ((len = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        buf[len] = '\0';
+        for (char* p = buf; p < buf + len; p += strlen(p) + 1) {
+            if (strcmp(p, "SUBSYSTEM=android_usb") == 0) {
+                self->wake_waiter();
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
 // Return true if USB is connected.
 bool RecoveryUI::usb_connected() {
     int fd = open("/sys/class/android_usb/android0/state", O_RDONLY);
@@ -515,12 +594,8 @@ void RecoveryUI::KeyLongPress(int key) {
 }
 
 void RecoveryUI::NotifyVolumesChanged() {
+    pthread_mutex_lock(&key_queue_mutex);
     v_changed = 1;
-}
-
-bool RecoveryUI::VolumesChanged() {
-    int ret = v_changed;
-    if (v_changed > 0)
-        v_changed = 0;
-    return ret == 1;
+    pthread_mutex_unlock(&key_queue_mutex);
+    wake_waiter();
 }
@@ -126,14 +126,16 @@ protected:
 private:
     // Key event input queue
     pthread_mutex_t key_queue_mutex;
-    pthread_cond_t key_queue_cond;
     int key_queue[256], key_queue_len;
     char key_pressed[KEY_MAX + 1];     // under key_queue_mutex
     int key_last_down;                 // under key_queue_mutex
     bool key_long_press;               // under key_queue_mutex
     int key_down_count;                // under key_queue_mutex
     int rel_sum;
-    int v_changed;
+    int v_changed;                     // under key_queue_mutex
+
+    int wait_fd;                       // eventfd WaitKey() sleeps on
+    int uevent_fd;                     // netlink socket for USB state
 
     int consecutive_power_keys;
     int consecutive_alternate_keys;
@@ -167,7 +169,9 @@ private:
     static int input_callback(int fd, short revents, void* data);
     void process_key(int key_code, int updown);
     bool usb_connected();
-    bool VolumesChanged();
+    void wake_waiter();
+    void open_uevent_socket();
+    static int uevent_callback(int fd, short revents, void* data);
 
     static void* time_key_helper(void* cookie);
     void time_key(int key_code, int count);
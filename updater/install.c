@@ -371,7 +371,7 @@ Value* ShowProgressFn(const char* name, State* state, int argc, Expr* argv[]) {
     int sec = strtol(sec_str, NULL, 10);
 
     UpdaterInfo* ui = (UpdaterInfo*)(state->cookie);
-    fprintf(ui->cmd_pipe, "progress %f %d\n", frac, sec);
+    UpdaterShowProgress(ui, frac, sec);
 
     free(sec_str);
     return StringValue(frac_str);
@@ -389,7 +389,7 @@ Value* SetProgressFn(const char* name, State* state, int argc, Expr* argv[]) {
     double frac = strtod(frac_str, NULL);
 
     UpdaterInfo* ui = (UpdaterInfo*)(state->cookie);
-    fprintf(ui->cmd_pipe, "set_progress %f\n", frac);
+    UpdaterSetProgress(ui, frac);
 
     return StringValue(frac_str);
 }
@@ -1079,12 +1079,10 @@ Value* ApplyPatchFn(const char* name, State* state, int argc, Expr* argv[]) {
     /* Skip files listed in the backup table */
     for (i=0; i<totalbaks; i++) {
         if (!strncmp(source_filename, bakfiles[i],PATH_MAX)) {
-            fprintf(((UpdaterInfo*)(state->cookie))->cmd_pipe,
-                "ui_print Skipping update of modified file %s\n", source_filename);
-            /* the command pipe tokenizes on \n, so issue an empty ui_print
-               to do the real line break */
-            fprintf(((UpdaterInfo*)(state->cookie))->cmd_pipe,
-                "ui_print\n");
+            char msg[PATH_MAX + 40];
+            snprintf(msg, sizeof(msg), "Skipping update of modified file %s",
+                     source_filename);
+            UpdaterPrint((UpdaterInfo*)(state->cookie), msg);
             return StringValue(strdup("t"));
         }
     }
@@ -1209,13 +1207,7 @@ Value* UIPrintFn(const char* name, State* state, int argc, Expr* argv[]) {
     free(args);
     buffer[size] = '\0';
 
-    char* line = strtok(buffer, "\n");
-    while (line) {
-        fprintf(((UpdaterInfo*)(state->cookie))->cmd_pipe,
-                "ui_print %s\n", line);
-        line = strtok(NULL, "\n");
-    }
-    fprintf(((UpdaterInfo*)(state->cookie))->cmd_pipe, "ui_print\n");
+    UpdaterPrint((UpdaterInfo*)(state->cookie), buffer);
 
     return StringValue(buffer);
 }
@@ -1224,7 +1216,7 @@ Value* WipeCacheFn(const char* name, State* state, int argc, Expr* argv[]) {
     if (argc != 0) {
         return ErrorAbort(state, "%s() expects no args, got %d", name, argc);
     }
-    fprintf(((UpdaterInfo*)(state->cookie))->cmd_pipe, "wipe_cache\n");
+    UpdaterWipeCache((UpdaterInfo*)(state->cookie));
     return StringValue(strdup("t"));
 }
 
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "progress_channel.h"
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+uint32_t progress_get_u32(const unsigned char* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t to_fraction(double fraction) {
+    if (!(fraction > 0)) return 0;
+    if (fraction >= 1) return PROGRESS_FRACTION_ONE;
+    return (uint32_t)(fraction * PROGRESS_FRACTION_ONE + 0.5);
+}
+
+void progress_writer_init(ProgressWriter* w, int fd) {
+    w->fd = fd;
+    w->error = 0;
+    memcpy(w->buf, PROGRESS_MAGIC, PROGRESS_MAGIC_SIZE);
+    w->buf[PROGRESS_MAGIC_SIZE] = PROGRESS_CHANNEL_VERSION;
+    w->len = PROGRESS_PREAMBLE_SIZE;
+}
+
+int progress_flush(ProgressWriter* w) {
+    if (w->error) return -1;
+
+    size_t done = 0;
+    while (done < w->len) {
+        ssize_t n = write(w->fd, w->buf + done, w->len - done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            w->error = 1;
+            return -1;
+        }
+        done += n;
+    }
+    w->len = 0;
+    return 0;
+}
+
+int progress_write(ProgressWriter* w, int type, const void* payload, size_t len) {
+    if (w->error || len > PROGRESS_MAX_PAYLOAD) return -1;
+
+    // The buffer holds at most the preamble and this one record.
+    unsigned char* p = w->buf + w->len;
+    p[0] = type;
+    p[1] = len;
+    p[2] = len >> 8;
+    if (len) memcpy(p + PROGRESS_HEADER_SIZE, payload, len);
+    w->len += PROGRESS_HEADER_SIZE + len;
+    return progress_flush(w);
+}
+
+int progress_show(ProgressWriter* w, double fraction, int seconds) {
+    unsigned char payload[8];
+    put_u32(payload, to_fraction(fraction));
+    put_u32(payload + 4, seconds > 0 ? seconds : 0);
+    return progress_write(w, PROGRESS_SHOW, payload, sizeof(payload));
+}
+
+int progress_set(ProgressWriter* w, double fraction) {
+    unsigned char payload[4];
+    put_u32(payload, to_fraction(fraction));
+    return progress_write(w, PROGRESS_SET, payload, sizeof(payload));
+}
+
+static int write_split(ProgressWriter* w, int type, const char* text, size_t len) {
+    do {
+        size_t chunk = len < PROGRESS_MAX_PAYLOAD ? len : PROGRESS_MAX_PAYLOAD;
+        if (progress_write(w, type, text, chunk) != 0) return -1;
+        text += chunk;
+        len -= chunk;
+    } while (len > 0);
+    return 0;
+}
+
+int progress_print(ProgressWriter* w, const char* text, size_t len) {
+    return write_split(w, PROGRESS_PRINT, text, len);
+}
+
+int progress_text(ProgressWriter* w, const char* text, size_t len) {
+    return write_split(w, PROGRESS_TEXT, text, len);
+}
+
+void progress_parser_init(ProgressParser* p) {
+    p->error = 0;
+    p->started = 0;
+    p->len = 0;
+}
+
+// Payload size each type must have: -1 for any, -2 for unknown types.
+static int payload_size(int type) {
+    switch (type) {
+        case PROGRESS_SHOW:          return 8;
+        case PROGRESS_SET:           return 4;
+        case PROGRESS_WIPE_CACHE:
+        case PROGRESS_CLEAR_DISPLAY: return 0;
+        case PROGRESS_PRINT:
+        case PROGRESS_TEXT:          return -1;
+        default:                     return -2;
+    }
+}
+
+int progress_parser_feed(ProgressParser* p, const void* data, size_t len,
+                         progress_record_fn fn, void* cookie) {
+    const unsigned char* in = (const unsigned char*)data;
+
+    while (len > 0 && !p->error) {
+        if (!p->started) {
+            size_t want = PROGRESS_PREAMBLE_SIZE - p->len;
+            size_t n = len < want ? len : want;
+            memcpy(p->buf + p->len, in, n);
+            p->len += n;
+            in += n;
+            len -= n;
+            if (p->len < PROGRESS_PREAMBLE_SIZE) break;
+
+            if (memcmp(p->buf, PROGRESS_MAGIC, PROGRESS_MAGIC_SIZE) != 0 ||
+                p->buf[PROGRESS_MAGIC_SIZE] != PROGRESS_CHANNEL_VERSION) {
+                p->error = 1;
+                break;
+            }
+            p->started = 1;
+            p->len = 0;
+            continue;
+        }
+
+        size_t want;
+        if (p->len < PROGRESS_HEADER_SIZE) {
+            want = PROGRESS_HEADER_SIZE - p->len;
+        } else {
+            want = PROGRESS_HEADER_SIZE + (p->buf[1] | (p->buf[2] << 8)) - p->len;
+        }
+        size_t n = len < want ? len : want;
+        memcpy(p->buf + p->len, in, n);
+        p->len += n;
+        in += n;
+        len -= n;
+        if (n < want) break;
+
+        int type = p->buf[0];
+        size_t size = p->buf[1] | (p->buf[2] << 8);
+        if (p->len == PROGRESS_HEADER_SIZE) {
+            // Check the header before waiting for the payload.
+            int expected = payload_size(type);
+            if (expected == -2 || size > PROGRESS_MAX_PAYLOAD ||
+                (expected >= 0 && (size_t)expected != size)) {
+                p->error = 1;
+                break;
+            }
+            if (size > 0) continue;
+        }
+
+        const unsigned char* payload = p->buf + PROGRESS_HEADER_SIZE;
+        if ((type == PROGRESS_SHOW || type == PROGRESS_SET) &&
+            progress_get_u32(payload) > PROGRESS_FRACTION_ONE) {
+            p->error = 1;
+            break;
+        }
+        p->len = 0;
+        fn(type, payload, size, cookie);
+    }
+    return p->error ? -1 : 0;
+}
+
+int progress_parser_finish(ProgressParser* p) {
+    if (p->error || p->len != 0) return -1;
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2014 The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UPDATER_PROGRESS_CHANNEL_H_
+#define _UPDATER_PROGRESS_CHANNEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Binary form of the update binary's command pipe.
+//
+// Recovery offers it by setting PROGRESS_CHANNEL_ENV to the version it
+// understands in the update binary's environment.  An update binary
+// that speaks that version starts its output with the 4-byte preamble
+// (PROGRESS_MAGIC followed by the version byte) and then writes only
+// records:
+//
+//     type     1 byte
+//     length   2 bytes, little endian, at most PROGRESS_MAX_PAYLOAD
+//     payload  'length' bytes
+//
+// Anything else is read as the old line-based text commands, so update
+// binaries that ignore the offer keep working.  The first byte of the
+// preamble can't start a text command.
+
+#define PROGRESS_CHANNEL_ENV      "UPDATER_PROGRESS_CHANNEL"
+#define PROGRESS_CHANNEL_VERSION  1
+
+#define PROGRESS_MAGIC            "\x7fUP"
+#define PROGRESS_MAGIC_SIZE       3
+#define PROGRESS_PREAMBLE_SIZE    (PROGRESS_MAGIC_SIZE + 1)
+#define PROGRESS_HEADER_SIZE      3
+#define PROGRESS_MAX_PAYLOAD      4096
+
+// Fractions travel as millionths.
+#define PROGRESS_FRACTION_ONE     1000000
+
+enum {
+    PROGRESS_SHOW = 1,           // u32 fraction, u32 seconds
+    PROGRESS_SET = 2,            // u32 fraction
+    PROGRESS_PRINT = 3,          // text for the screen, as is
+    PROGRESS_WIPE_CACHE = 4,     // empty
+    PROGRESS_CLEAR_DISPLAY = 5,  // empty
+    PROGRESS_TEXT = 6,           // a piece of the text command stream
+};
+
+// Writes records to the pipe, each as soon as it's added.  Nothing is
+// held back: recovery coalesces a burst of PROGRESS_SETs itself, and a
+// held one could sit there through a long step with nothing to send it.
+typedef struct {
+    int fd;
+    int error;
+    size_t len;
+    unsigned char buf[PROGRESS_PREAMBLE_SIZE + PROGRESS_HEADER_SIZE +
+                      PROGRESS_MAX_PAYLOAD];
+} ProgressWriter;
+
+// Start a channel on 'fd'; the preamble goes out with the first record,
+// or with progress_flush().
+void progress_writer_init(ProgressWriter* w, int fd);
+
+// Each returns 0, or -1 once a write to the pipe has failed.
+int progress_write(ProgressWriter* w, int type, const void* payload, size_t len);
+int progress_show(ProgressWriter* w, double fraction, int seconds);
+int progress_set(ProgressWriter* w, double fraction);
+int progress_print(ProgressWriter* w, const char* text, size_t len);
+int progress_text(ProgressWriter* w, const char* text, size_t len);
+
+// Write out anything not yet written (only ever the preamble).
+int progress_flush(ProgressWriter* w);
+
+// Called once per complete, valid record.
+typedef void (*progress_record_fn)(int type, const unsigned char* payload,
+                                   size_t len, void* cookie);
+
+// Splits the pipe's bytes, however they're chunked, back into records.
+// The first malformed byte (wrong preamble, unknown type, oversized
+// record, payload of the wrong size for its type, fraction above one)
+// stops it for good.
+typedef struct {
+    int error;
+    int started;                 // preamble seen
+    size_t len;
+    unsigned char buf[PROGRESS_HEADER_SIZE + PROGRESS_MAX_PAYLOAD];
+} ProgressParser;
+
+void progress_parser_init(ProgressParser* p);
+
+// Returns 0, or -1 if the stream is (or was already) malformed.
+int progress_parser_feed(ProgressParser* p, const void* data, size_t len,
+                         progress_record_fn fn, void* cookie);
+
+// At end of stream: returns -1 if it was malformed or a record was cut
+// short.
+int progress_parser_finish(ProgressParser* p);
+
+uint32_t progress_get_u32(const unsigned char* payload);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "edify/expr.h"
 #include "updater.h"
@@ -34,6 +35,87 @@
 
 struct selabel_handle *sehandle;
 
+// The binary command channel, if recovery offered one we speak.
+static ProgressWriter progress_writer;
+static int use_progress = 0;
+
+static void flush_progress(void) {
+    progress_flush(&progress_writer);
+}
+
+// cmd_pipe, for anything still writing text commands to it (device
+// extensions, mostly), wraps what it's given in PROGRESS_TEXT records.
+#ifdef __BIONIC__
+static int write_text(void* cookie, const char* buf, int size) {
+    return progress_text((ProgressWriter*)cookie, buf, size) == 0 ? size : -1;
+}
+#else
+static ssize_t write_text(void* cookie, const char* buf, size_t size) {
+    return progress_text((ProgressWriter*)cookie, buf, size) == 0 ? (ssize_t)size : -1;
+}
+#endif
+
+static FILE* open_text_stream(ProgressWriter* w) {
+#ifdef __BIONIC__
+    return funopen(w, NULL, write_text, NULL, NULL);
+#else
+    cookie_io_functions_t io = { NULL, write_text, NULL, NULL };
+    return fopencookie(w, "w", io);
+#endif
+}
+
+// Show 'text' followed by a line break.  The text commands carry a
+// line each, so there each line is sent on its own; the binary
+// channel gets all of it as one record.
+void UpdaterPrint(UpdaterInfo* ui, const char* text) {
+    if (ui->progress) {
+        size_t len = strlen(text);
+        char* joined = malloc(len + 1);
+        size_t n = 0;
+        size_t i;
+        for (i = 0; i < len; ++i) {
+            if (text[i] != '\n') joined[n++] = text[i];
+        }
+        joined[n++] = '\n';
+        progress_print(ui->progress, joined, n);
+        free(joined);
+        return;
+    }
+
+    char* copy = strdup(text);
+    char* line = strtok(copy, "\n");
+    while (line) {
+        fprintf(ui->cmd_pipe, "ui_print %s\n", line);
+        line = strtok(NULL, "\n");
+    }
+    fprintf(ui->cmd_pipe, "ui_print\n");
+    free(copy);
+}
+
+void UpdaterShowProgress(UpdaterInfo* ui, double frac, int sec) {
+    if (ui->progress) {
+        progress_show(ui->progress, frac, sec);
+    } else {
+        fprintf(ui->cmd_pipe, "progress %f %d\n", frac, sec);
+    }
+}
+
+void UpdaterSetProgress(UpdaterInfo* ui, double frac) {
+    if (ui->progress) {
+        progress_set(ui->progress, frac);
+    } else {
+        fprintf(ui->cmd_pipe, "set_progress %f\n", frac);
+    }
+}
+
+void UpdaterWipeCache(UpdaterInfo* ui) {
+    if (ui->progress) {
+        progress_write(ui->progress, PROGRESS_WIPE_CACHE, NULL, 0);
+    } else {
+        fprintf(ui->cmd_pipe, "wipe_cache\n");
+    }
+}
+
 int main(int argc, char** argv) {
     // Various things log information to stdout or stderr more or less
     // at random (though we've tried to standardize on stdout).  The
@@ -60,7 +142,20 @@ int main(int argc, char** argv) {
     // Set up the pipe for sending commands back to the parent process.
 
     int fd = atoi(argv[2]);
-    FILE* cmd_pipe = fdopen(fd, "wb");
+    FILE* cmd_pipe = NULL;
+    const char* channel = getenv(PROGRESS_CHANNEL_ENV);
+    if (channel != NULL && atoi(channel) == PROGRESS_CHANNEL_VERSION) {
+        progress_writer_init(&progress_writer, fd);
+        cmd_pipe = open_text_stream(&progress_writer);
+        if (cmd_pipe != NULL) {
+            use_progress = 1;
+            atexit(flush_progress);
+        }
+    }
+    unsetenv(PROGRESS_CHANNEL_ENV);
+    if (cmd_pipe == NULL) {
+        cmd_pipe = fdopen(fd, "wb");
+    }
     setlinebuf(cmd_pipe);
 
     // Extract the script from the package.
@@ -122,6 +217,7 @@ int main(int argc, char** argv) {
     updater_info.cmd_pipe = cmd_pipe;
     updater_info.package_zip = &za;
     updater_info.version = atoi(version);
+    updater_info.progress = use_progress ? &progress_writer : NULL;
 
     State state;
     state.cookie = &updater_info;
@@ -135,12 +231,7 @@ int main(int argc, char** argv) {
             fprintf(cmd_pipe, "ui_print script aborted (no error message)\n");
         } else {
             printf("script aborted: %s\n", state.errmsg);
-            char* line = strtok(state.errmsg, "\n");
-            while (line) {
-                fprintf(cmd_pipe, "ui_print %s\n", line);
-                line = strtok(NULL, "\n");
-            }
-            fprintf(cmd_pipe, "ui_print\n");
+            UpdaterPrint(&updater_info, state.errmsg);
         }
         free(state.errmsg);
         return 7;
@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include "minzip/Zip.h"
+#include "progress_channel.h"
 
 #include <selinux/selinux.h>
 #include <selinux/label.h>
@@ -27,8 +28,17 @@ typedef struct {
     FILE* cmd_pipe;
     ZipArchive* package_zip;
     int version;
+    // Set when recovery took the binary channel; cmd_pipe then still
+    // takes text commands, wrapped in PROGRESS_TEXT records.
+    ProgressWriter* progress;
 } UpdaterInfo;
 
+// Commands for recovery, in whichever form it asked for.
+void UpdaterPrint(UpdaterInfo* ui, const char* text);
+void UpdaterShowProgress(UpdaterInfo* ui, double frac, int sec);
+void UpdaterSetProgress(UpdaterInfo* ui, double frac);
+void UpdaterWipeCache(UpdaterInfo* ui);
+
 extern struct selabel_handle *sehandle;
 
 #endif
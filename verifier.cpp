@@ -111,7 +111,8 @@ static bool read_pkcs7(uint8_t* pkcs7_der, size_t pkcs7_der_len, uint8_t** sig_d
 // Return VERIFY_SUCCESS, VERIFY_FAILURE (if any error is encountered
 // or no key matches the signature).
 
-int verify_file(const char* path, const Certificate* pKeys, unsigned int numKeys) {
+int verify_file(const char* path, const Certificate* pKeys, unsigned int numKeys,
+                const PackageDigest* digest) {
     ui->SetProgress(0.0);
 
     FILE* f = fopen(path, "rb");
@@ -214,53 +215,65 @@ int verify_file(const char* path, const Certificate* pKeys, unsigned int numKeys
         }
     }
 
-#define BUFFER_SIZE 4096
-
-    bool need_sha1 = false;
-    bool need_sha256 = false;
-    for (i = 0; i < numKeys; ++i) {
-        switch (pKeys[i].hash_len) {
-            case SHA_DIGEST_SIZE: need_sha1 = true; break;
-            case SHA256_DIGEST_SIZE: need_sha256 = true; break;
-        }
-    }
-
+    const uint8_t* sha1;
+    const uint8_t* sha256;
     SHA_CTX sha1_ctx;
     SHA256_CTX sha256_ctx;
-    SHA_init(&sha1_ctx);
-    SHA256_init(&sha256_ctx);
-    unsigned char* buffer = (unsigned char*)malloc(BUFFER_SIZE);
-    if (buffer == NULL) {
-        LOGE("failed to alloc memory for sha1 buffer\n");
+
+    if (digest != NULL && digest->signed_len == signed_len &&
+        digest->so_far == signed_len) {
+        LOGI("using digests computed while copying\n");
         fclose(f);
-        return VERIFY_FAILURE;
-    }
+        sha1 = digest->sha1;
+        sha256 = digest->sha256;
+        ui->SetProgress(1.0);
+    } else {
+#define BUFFER_SIZE 4096
+
+        bool need_sha1 = false;
+        bool need_sha256 = false;
+        for (i = 0; i < numKeys; ++i) {
+            switch (pKeys[i].hash_len) {
+                case SHA_DIGEST_SIZE: need_sha1 = true; break;
+                case SHA256_DIGEST_SIZE: need_sha256 = true; break;
+            }
+        }
 
-    double frac = -1.0;
-    size_t so_far = 0;
-    fseek(f, 0, SEEK_SET);
-    while (so_far < signed_len) {
-        size_t size = BUFFER_SIZE;
-        if (signed_len - so_far < size) size = signed_len - so_far;
-        if (fread(buffer, 1, size, f) != size) {
-            LOGE("failed to read data from %s (%s)\n", path, strerror(errno));
+        SHA_init(&sha1_ctx);
+        SHA256_init(&sha256_ctx);
+        unsigned char* buffer = (unsigned char*)malloc(BUFFER_SIZE);
+        if (buffer == NULL) {
+            LOGE("failed to alloc memory for sha1 buffer\n");
             fclose(f);
             return VERIFY_FAILURE;
         }
-        if (need_sha1) SHA_update(&sha1_ctx, buffer, size);
-        if (need_sha256) SHA256_update(&sha256_ctx, buffer, size);
-        so_far += size;
-        double f = so_far / (double)signed_len;
-        if (f > frac + 0.02 || size == so_far) {
-            ui->SetProgress(f);
-            frac = f;
+
+        double frac = -1.0;
+        size_t so_far = 0;
+        fseek(f, 0, SEEK_SET);
+        while (so_far < signed_len) {
+            size_t size = BUFFER_SIZE;
+            if (signed_len - so_far < size) size = signed_len - so_far;
+            if (fread(buffer, 1, size, f) != size) {
+                LOGE("failed to read data from %s (%s)\n", path, strerror(errno));
+                fclose(f);
+                return VERIFY_FAILURE;
+            }
+            if (need_sha1) SHA_update(&sha1_ctx, buffer, size);
+            if (need_sha256) SHA256_update(&sha256_ctx, buffer, size);
+            so_far += size;
+            double f = so_far / (double)signed_len;
+            if (f > frac + 0.02 || size == so_far) {
+                ui->SetProgress(f);
+                frac = f;
+            }
         }
-    }
-    fclose(f);
-    free(buffer);
+        fclose(f);
+        free(buffer);
 
-    const uint8_t* sha1 = SHA_final(&sha1_ctx);
-    const uint8_t* sha256 = SHA256_final(&sha256_ctx);
+        sha1 = SHA_final(&sha1_ctx);
+        sha256 = SHA256_final(&sha256_ctx);
+    }
 
     uint8_t* sig_der = NULL;
     size_t sig_der_length = 0;
@@ -333,6 +346,46 @@ int verify_file(const char* path, const Certificate* pKeys, unsigned int numKeys
     return VERIFY_FAILURE;
 }
 
+int package_digest_init(PackageDigest* digest, size_t file_size,
+                        const unsigned char* footer) {
+    memset(digest, 0, sizeof(*digest));
+
+    // The same footer verify_file reads; the signature covers all but
+    // the comment and its length.
+    size_t comment_size = footer[4] + (footer[5] << 8);
+    if (footer[2] != 0xff || footer[3] != 0xff ||
+        file_size < comment_size + EOCD_HEADER_SIZE) {
+        return -1;
+    }
+    digest->signed_len = file_size - comment_size - 2;
+
+    SHA_init(&digest->sha1_ctx);
+    SHA256_init(&digest->sha256_ctx);
+    return 0;
+}
+
+void package_digest_update(PackageDigest* digest, const void* data, size_t len) {
+    if (digest->signed_len - digest->so_far < len) {
+        len = digest->signed_len - digest->so_far;
+    }
+    if (len == 0) return;
+
+    // Which keys will be tried isn't known yet, so keep both.
+    SHA_update(&digest->sha1_ctx, data, len);
+    SHA256_update(&digest->sha256_ctx, data, len);
+    digest->so_far += len;
+}
+
+int package_digest_final(PackageDigest* digest) {
+    if (digest->signed_len == 0 || digest->so_far != digest->signed_len) {
+        digest->signed_len = 0;
+        return -1;
+    }
+    memcpy(digest->sha1, SHA_final(&digest->sha1_ctx), SHA_DIGEST_SIZE);
+    memcpy(digest->sha256, SHA256_final(&digest->sha256_ctx), SHA256_DIGEST_SIZE);
+    return 0;
+}
+
 // Reads a file containing one or more public keys as produced by
 // DumpPublicKey:  this is an RSAPublicKey struct as it would appear
 // as a C source literal, eg:
@@ -17,8 +17,13 @@
 #ifndef _RECOVERY_VERIFIER_H
 #define _RECOVERY_VERIFIER_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "mincrypt/p256.h"
 #include "mincrypt/rsa.h"
+#include "mincrypt/sha.h"
+#include "mincrypt/sha256.h"
 
 typedef struct {
     p256_int x;
@@ -37,10 +42,37 @@ typedef struct {
     ECPublicKey* ec;
 } Certificate;
 
+/* The hashes of everything a package's signature covers, worked out
+ * by whatever last streamed the whole package (a copy, say), so that
+ * verifying it doesn't mean reading it all again.
+ */
+typedef struct PackageDigest {
+    size_t signed_len;
+    size_t so_far;
+    SHA_CTX sha1_ctx;
+    SHA256_CTX sha256_ctx;
+    uint8_t sha1[SHA_DIGEST_SIZE];
+    uint8_t sha256[SHA256_DIGEST_SIZE];
+} PackageDigest;
+
+/* Start hashing a package of file_size bytes whose last six bytes are
+ * footer.  Returns -1 if it can't be a signed package.
+ */
+int package_digest_init(PackageDigest* digest, size_t file_size,
+                        const unsigned char* footer);
+
+/* Feed the package through, in order and from the start. */
+void package_digest_update(PackageDigest* digest, const void* data, size_t len);
+
+/* Returns 0 once everything signed has been hashed. */
+int package_digest_final(PackageDigest* digest);
+
 /* Look in the file for a signature footer, and verify that it
  * matches one of the given keys.  Return one of the constants below.
+ * If digest covers this file it is used instead of reading it again.
  */
-int verify_file(const char* path, const Certificate *pKeys, unsigned int numKeys);
+int verify_file(const char* path, const Certificate *pKeys, unsigned int numKeys,
+                const PackageDigest* digest = NULL);
 
 Certificate* load_keys(const char* filename, int* numKeys);
 
@@ -35,14 +35,23 @@ struct volume_node {
     const char *label;
     const char *path;
     int state;
-    struct volume_node *next;
+    bool listed;                    // seen in the current volume list
+    struct volume_node *next;       // in list order
+    struct volume_node *hash_next;  // in its index bucket
 };
 
 static struct volume_node *volume_head = NULL;
 static struct volume_node *volume_tail = NULL;
 
+// volumes by path, so events and lookups don't walk the list
+#define VOLUME_INDEX_SIZE 64
+static struct volume_node *volume_index[VOLUME_INDEX_SIZE];
+
 static int num_volumes = 0;
 
+// bumped whenever a volume appears, goes or changes state
+static unsigned int volume_generation = 0;
+
 static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
 
 void vold_set_callbacks(struct vold_callbacks* ev_callbacks) {
@@ -53,33 +62,173 @@ void vold_set_automount(int automount) {
     should_automount = automount;
 }
 
-void vold_mount_all() {
+struct volume_snapshot {
+    char *path;
+    int state;
+};
+
+// Copies out every volume's path and state.  The commands issued for
+// them wait on the event thread, which takes the write lock to apply
+// their state changes, so none may be sent with rwlock held.
+static struct volume_snapshot *snapshot_volumes(int *count) {
 
     struct volume_node *node;
+    struct volume_snapshot *snap;
+    int n = 0;
 
     pthread_rwlock_rdlock(&rwlock);
-    for (node = volume_head; node; node = node->next) {
-        if (node->state == Volume::State_Idle) {
-            vold_mount_volume(node->path, false);
+    snap = (struct volume_snapshot *)malloc((num_volumes + 1) * sizeof(*snap));
+    if (snap) {
+        for (node = volume_head; node; node = node->next) {
+            snap[n].path = strdup(node->path);
+            snap[n].state = node->state;
+            if (snap[n].path)
+                n++;
         }
     }
     pthread_rwlock_unlock(&rwlock);
+
+    *count = n;
+    return snap;
+}
+
+static void free_snapshot(struct volume_snapshot *snap, int count) {
+
+    int i;
+
+    for (i = 0; i < count; i++)
+        free(snap[i].path);
+    free(snap);
+}
+
+void vold_mount_all() {
+
+    struct volume_snapshot *snap;
+    int i, count;
+
+    snap = snapshot_volumes(&count);
+    if (snap == NULL)
+        return;
+    for (i = 0; i < count; i++) {
+        if (snap[i].state == Volume::State_Idle) {
+            vold_mount_volume(snap[i].path, false);
+        }
+    }
+    free_snapshot(snap, count);
 }
 
 void vold_unmount_all() {
 
+    struct volume_snapshot *snap;
+    int *seqs;
+    int i, count, n = 0;
+
+    snap = snapshot_volumes(&count);
+    if (snap == NULL)
+        return;
+    seqs = (int *)malloc((count + 1) * sizeof(int));
+    for (i = 0; i < count; i++) {
+        if (snap[i].state >= Volume::State_Shared) {
+            vold_unshare_volume(snap[i].path, false);
+        }
+        if (snap[i].state == Volume::State_Mounted) {
+            const char *cmd[4] = { "volume", "unmount", snap[i].path, "force" };
+            int seq = seqs ? vold_command_async(4, cmd, NULL, NULL) : -1;
+            if (seq >= 0)
+                seqs[n++] = seq;
+            else
+                vold_unmount_volume(snap[i].path, true, true);
+        }
+    }
+
+    // the unmounts run in vold back to back; collect their results
+    for (i = 0; i < n; i++) {
+        vold_command_wait(seqs[i], -1);
+    }
+    free(seqs);
+    free_snapshot(snap, count);
+}
+
+static unsigned int path_hash(const char *path) {
+
+    unsigned int h = 5381;
+    while (*path)
+        h = h * 33 + (unsigned char)*path++;
+    return h % VOLUME_INDEX_SIZE;
+}
+
+static struct volume_node *find_volume_locked(const char *path) {
+
     struct volume_node *node;
 
-    pthread_rwlock_rdlock(&rwlock);
-    for (node = volume_head; node; node = node->next) {
-        if (node->state >= Volume::State_Shared) {
-            vold_unshare_volume(node->path, false);
+    for (node = volume_index[path_hash(path)]; node; node = node->hash_next) {
+        if (strcmp(path, node->path) == 0)
+            return node;
+    }
+    return NULL;
+}
+
+static void changed_locked() {
+    __atomic_add_fetch(&volume_generation, 1, __ATOMIC_RELEASE);
+}
+
+static struct volume_node *add_volume_locked(const char *label, const char *path, int state) {
+
+    struct volume_node *node;
+    unsigned int h = path_hash(path);
+
+    node = (struct volume_node *)calloc(1, sizeof(struct volume_node));
+    node->label = strdup(label);
+    node->path = strdup(path);
+    node->state = state;
+
+    if (volume_head == NULL)
+        volume_head = volume_tail = node;
+    else {
+        volume_tail->next = node;
+        volume_tail = node;
+    }
+    node->hash_next = volume_index[h];
+    volume_index[h] = node;
+
+    num_volumes++;
+    changed_locked();
+    return node;
+}
+
+static void remove_volume_locked(struct volume_node *node) {
+
+    struct volume_node **p;
+
+    for (p = &volume_index[path_hash(node->path)]; *p; p = &(*p)->hash_next) {
+        if (*p == node) {
+            *p = node->hash_next;
+            break;
         }
-        if (node->state == Volume::State_Mounted) {
-            vold_unmount_volume(node->path, true, true);
+    }
+    for (p = &volume_head, volume_tail = NULL; *p; p = &(*p)->next) {
+        if (*p == node) {
+            *p = node->next;
+            if (*p == NULL)
+                break;
         }
+        volume_tail = *p;
+    }
+
+    free((void *)node->path);
+    free((void *)node->label);
+    free(node);
+
+    num_volumes--;
+    changed_locked();
+}
+
+static void set_state_locked(struct volume_node *node, int state) {
+
+    if (node->state != state) {
+        node->state = state;
+        changed_locked();
     }
-    pthread_rwlock_unlock(&rwlock);
 }
 
 int vold_get_volume_state(const char *path) {
@@ -88,12 +237,9 @@ int vold_get_volume_state(const char *path) {
     struct volume_node *node;
 
     pthread_rwlock_rdlock(&rwlock);
-    for (node = volume_head; node; node = node->next) {
-        if (strcmp(path, node->path) == 0) {
-            ret = node->state;
-            break;
-        }
-    }
+    node = find_volume_locked(path);
+    if (node)
+        ret = node->state;
     pthread_rwlock_unlock(&rwlock);
     return ret;
 }
@@ -102,59 +248,68 @@ int vold_get_num_volumes() {
     return num_volumes;
 }
 
-int vold_is_volume_available(const char *path) {
-    return vold_get_volume_state(path) > 0;
+unsigned int vold_get_volumes_generation() {
+    return __atomic_load_n(&volume_generation, __ATOMIC_ACQUIRE);
 }
 
-static void free_volume_list_locked() {
-
-    struct volume_node *node;
-
-    node = volume_head;
-    while (node) {
-        struct volume_node *next = node->next;
-        free((void *)node->path);
-        free((void *)node->label);
-        free(node);
-        node = next;
-    }
-    volume_head = volume_tail = NULL;
+int vold_is_volume_available(const char *path) {
+    return vold_get_volume_state(path) > 0;
 }
 
+// A "volume list" is merged into what we have: volumes that are new or
+// changed are updated in place, and ones it no longer mentions removed
+// once it ends.  Readers keep a complete list throughout.
 static int is_listing_volumes = 0;
+static int listing_seq = -1;
 
-static void vold_handle_volume_list(const char* label, const char* path, int state) {
+static void vold_handle_volume_list(int seq, const char* label, const char* path, int state) {
 
     struct volume_node *node;
 
     pthread_rwlock_wrlock(&rwlock);
     if (is_listing_volumes == 0) {
-        free_volume_list_locked();
-        num_volumes = 0;
+        for (node = volume_head; node; node = node->next)
+            node->listed = false;
         is_listing_volumes = 1;
+        listing_seq = seq;
     }
 
-    node = (struct volume_node *)malloc(sizeof(struct volume_node));
-    node->label = strdup(label);
-    node->path = strdup(path);
-    node->state = state;
-    node->next = NULL;
-
-    if (volume_head == NULL)
-        volume_head = volume_tail = node;
-    else {
-        volume_tail->next = node;
-        volume_tail = node;
+    node = find_volume_locked(path);
+    if (node == NULL) {
+        node = add_volume_locked(label, path, state);
+    } else {
+        if (strcmp(node->label, label) != 0) {
+            free((void *)node->label);
+            node->label = strdup(label);
+            changed_locked();
+        }
+        set_state_locked(node, state);
     }
-
-    num_volumes++;
+    node->listed = true;
     pthread_rwlock_unlock(&rwlock);
 }
 
 static void vold_handle_volume_list_done() {
 
+    struct volume_node *node, *next;
+
+    pthread_rwlock_wrlock(&rwlock);
+    for (node = volume_head; node; node = next) {
+        next = node->next;
+        if (!node->listed)
+            remove_volume_locked(node);
+    }
+    is_listing_volumes = 0;
+    pthread_rwlock_unlock(&rwlock);
+}
+
+// The connection to vold is gone, and with it any list in progress; its
+// terminating response will never come.
+void vold_dispatch_reset() {
+
     pthread_rwlock_wrlock(&rwlock);
     is_listing_volumes = 0;
+    listing_seq = -1;
     pthread_rwlock_unlock(&rwlock);
 }
 
@@ -162,13 +317,10 @@ static void set_volume_state(char* path, int state) {
 
     struct volume_node *node;
 
-    pthread_rwlock_rdlock(&rwlock);
-    for (node = volume_head; node; node = node->next) {
-        if (strcmp(node->path, path) == 0) {
-            node->state = state;
-            break;
-        }
-    }
+    pthread_rwlock_wrlock(&rwlock);
+    node = find_volume_locked(path);
+    if (node)
+        set_state_locked(node, state);
     pthread_rwlock_unlock(&rwlock);
 }
 
@@ -182,7 +334,16 @@ static void vold_handle_volume_state_change(char* label, char* path, int state)
 
 static void vold_handle_volume_inserted(char* label, char* path) {
 
-    set_volume_state(path, Volume::State_Idle);
+    struct volume_node *node;
+
+    // a volume vold hadn't listed yet is added straight away
+    pthread_rwlock_wrlock(&rwlock);
+    node = find_volume_locked(path);
+    if (node)
+        set_state_locked(node, Volume::State_Idle);
+    else
+        add_volume_locked(label, path, Volume::State_Idle);
+    pthread_rwlock_unlock(&rwlock);
 
     if (callbacks != NULL && callbacks->disk_added != NULL)
         callbacks->disk_added(label, path);
@@ -206,7 +367,7 @@ int vold_dispatch(int code, char** tokens, int len) {
 
     if (code == ResponseCode::VolumeListResult) {
         // <code> <seq> <label> <path> <state>
-        vold_handle_volume_list(tokens[2], tokens[3], atoi(tokens[4]));
+        vold_handle_volume_list(atoi(tokens[1]), tokens[2], tokens[3], atoi(tokens[4]));
 
     } else if (code == ResponseCode::VolumeStateChange) {
         // <code> "Volume <label> <path> state changed from <old_#> (<old_str>) to <new_#> (<new_str>)"
@@ -220,7 +381,8 @@ int vold_dispatch(int code, char** tokens, int len) {
         // <code> Volume <label> <path> disk removed (<blk_id>)"
         vold_handle_volume_removed(tokens[2], tokens[3]);
 
-    } else if (code == ResponseCode::CommandOkay && is_listing_volumes) {
+    } else if (code == ResponseCode::CommandOkay && is_listing_volumes &&
+               atoi(tokens[1]) == listing_seq) {
         vold_handle_volume_list_done();
 
     } else {
@@ -28,6 +28,7 @@
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/un.h>
 
@@ -42,32 +43,63 @@
 static pthread_mutex_t mutex      = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  completion = PTHREAD_COND_INITIALIZER;
 
-// command result status, read with mutex held
-static int cmd_result = 0;
-
-// commands currently in flight
-static int cmd_inflight = 0;
+// A command sent to vold and not yet answered.  Commands carry their
+// own sequence number, so any number of them can be in flight and the
+// responses matched up in whatever order they arrive.
+struct pending_command {
+    int seq;
+    int code;                   // final response code, once done
+    bool done;
+    vold_command_cb callback;   // NULL if someone will wait for it
+    void* cookie;
+    struct pending_command* next;
+};
+
+// commands in flight and the next sequence number, read with mutex held
+static struct pending_command* pending = NULL;
+static int next_seq = 1;
 
 // socket fd
 static int sock = -1;
 
+// where vold listens; tests point this at a fake
+static const char* socket_name = "vold";
+static int socket_namespace = ANDROID_SOCKET_NAMESPACE_RESERVED;
+
+void vold_set_socket(const char* name, int ns) {
+    socket_name = name;
+    socket_namespace = ns;
+}
 
 static int vold_connect() {
 
     int retries = 5;
     int ret = -1;
-    if (sock > 0) {
+    int fd;
+
+    pthread_mutex_lock(&mutex);
+    fd = sock;
+    pthread_mutex_unlock(&mutex);
+    if (fd >= 0) {
         return 1;
     }
 
-    // socket connection to vold
+    // socket connection to vold; whoever connects first (the event
+    // thread or a command) gets to keep it
     while (retries > 0) { 
-        if ((sock = socket_local_client("vold",
-                                         ANDROID_SOCKET_NAMESPACE_RESERVED,
-                                         SOCK_STREAM)) < 0) {
+        if ((fd = socket_local_client(socket_name,
+                                      socket_namespace,
+                                      SOCK_STREAM)) < 0) {
             LOGE("Error connecting to Vold! (%s)\n", strerror(errno));
         } else {
-            LOGI("Connected to Vold..\n");
+            pthread_mutex_lock(&mutex);
+            if (sock < 0) {
+                sock = fd;
+                LOGI("Connected to Vold..\n");
+            } else {
+                close(fd);
+            }
+            pthread_mutex_unlock(&mutex);
             ret = 1;
             break;
         }
@@ -77,14 +109,14 @@ static int vold_connect() {
     return ret;
 }
 
-static int split(char *str, char **splitstr) {
+static int split(char *str, char **splitstr, int max) {
 
     char *p;
     int i = 0;
 
     p = strtok(str, " ");
 
-    while(p != NULL) {
+    while(p != NULL && i < max) {
         splitstr[i] = (char *)malloc(strlen(p) + 1);
         if (splitstr[i])
             strcpy(splitstr[i], p);
@@ -96,32 +128,128 @@ static int split(char *str, char **splitstr) {
 }
 
 extern int vold_dispatch(int code, char** tokens, int len);
+extern void vold_dispatch_reset();
 
-static int handle_response(char* response) {
+// Dispatches one line from vold.  Returns its code, and the sequence
+// number it answers in *seq (-1 for broadcasts, which have none).
+static int handle_response(char* response, int* seq) {
 
     int code = 0, len = 0, i = 0;
     char *tokens[32] = { NULL };
 
-    len = split(response, tokens);
+    *seq = -1;
+    len = split(response, tokens, 32);
+    if (!len)
+        return 0;
+
     code = atoi(tokens[0]);
+    if (code >= 100 && code < 600 && len > 1)
+        *seq = atoi(tokens[1]);
 
-    if (len) {
-        vold_dispatch(code, tokens, len);
+    vold_dispatch(code, tokens, len);
 
-        for (i = 0; i < len; i++)
-            free(tokens[i]);
-    }
+    for (i = 0; i < len; i++)
+        free(tokens[i]);
 
     return code;
 }
 
+static void unlink_command_locked(struct pending_command* cmd) {
+
+    struct pending_command** p;
+
+    for (p = &pending; *p; p = &(*p)->next) {
+        if (*p == cmd) {
+            *p = cmd->next;
+            break;
+        }
+    }
+}
+
+static void complete_command(int seq, int code) {
+
+    struct pending_command* cmd;
+
+    pthread_mutex_lock(&mutex);
+    for (cmd = pending; cmd; cmd = cmd->next) {
+        if (cmd->seq == seq && !cmd->done)
+            break;
+    }
+    if (cmd == NULL) {
+        pthread_mutex_unlock(&mutex);
+        LOGW("Response %d for unknown command %d\n", code, seq);
+        return;
+    }
+
+    cmd->code = code;
+    cmd->done = true;
+    if (cmd->callback == NULL) {
+        pthread_cond_broadcast(&completion);
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+
+    unlink_command_locked(cmd);
+    pthread_mutex_unlock(&mutex);
+    cmd->callback(seq, code, cmd->cookie);
+    free(cmd);
+}
+
+// The connection is gone: every command in flight fails with -1.
+static void disconnect() {
+
+    struct pending_command* failed = NULL;
+    struct pending_command** p;
+
+    pthread_mutex_lock(&mutex);
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+    p = &pending;
+    while (*p) {
+        struct pending_command* cmd = *p;
+        if (cmd->callback != NULL) {
+            *p = cmd->next;
+            cmd->next = failed;
+            failed = cmd;
+            continue;
+        }
+        if (!cmd->done) {
+            cmd->code = -1;
+            cmd->done = true;
+        }
+        p = &cmd->next;
+    }
+    pthread_cond_broadcast(&completion);
+    pthread_mutex_unlock(&mutex);
+
+    while (failed) {
+        struct pending_command* next = failed->next;
+        failed->callback(failed->seq, -1, failed->cookie);
+        free(failed);
+        failed = next;
+    }
+
+    vold_dispatch_reset();
+}
+
 static int monitor_started = 0;
 
+#define MONITOR_BUFFER_SIZE 4096
+
 // wait for events and signal waiters when appropriate
 static int monitor() {
 
-    char *buffer = (char *)malloc(4096);
+    char *buffer = (char *)malloc(MONITOR_BUFFER_SIZE);
+    int filled = 0;
     int code = 0;
+    int fd;
+
+    // only disconnect() replaces the socket, once this returns
+    pthread_mutex_lock(&mutex);
+    fd = sock;
+    pthread_mutex_unlock(&mutex);
 
     while(1) {
         fd_set read_fds;
@@ -132,59 +260,63 @@ static int monitor() {
         to.tv_usec = 0;
 
         FD_ZERO(&read_fds);
-        FD_SET(sock, &read_fds);
+        FD_SET(fd, &read_fds);
 
         if (!monitor_started) {
             pthread_mutex_lock(&mutex);
             monitor_started = 1;
-            pthread_cond_signal(&completion);
+            pthread_cond_broadcast(&completion);
             pthread_mutex_unlock(&mutex);
         }
 
-        if ((rc = select(sock +1, &read_fds, NULL, NULL, &to)) < 0) {
+        if ((rc = select(fd + 1, &read_fds, NULL, NULL, &to)) < 0) {
+            if (errno == EINTR)
+                continue;
             LOGE("Error in select (%s)\n", strerror(errno));
             goto out;
 
         } else if (!rc) {
             continue;
 
-        } else if (FD_ISSET(sock, &read_fds)) {
-            memset(buffer, 0, 4096);
-            if ((rc = read(sock, buffer, 4096)) <= 0) {
+        } else if (FD_ISSET(fd, &read_fds)) {
+            if (filled == MONITOR_BUFFER_SIZE) {
+                LOGE("Response from Vold too long, dropped\n");
+                filled = 0;
+            }
+            if ((rc = read(fd, buffer + filled, MONITOR_BUFFER_SIZE - filled)) <= 0) {
                 if (rc == 0)
                     LOGE("Lost connection to Vold - did it crash?\n");
                 else
                     LOGE("Error reading data (%s)\n", strerror(errno));
                 if (rc == 0)
-                    return ECONNRESET;
+                    code = ECONNRESET;
                 goto out;
             }
+            filled += rc;
 
             int offset = 0;
             int i = 0;
 
-            // dispatch each line of the response
-            for (i = 0; i < rc; i++) {
+            // dispatch each complete line; keep any partial one for
+            // the next read
+            for (i = 0; i < filled; i++) {
                 if (buffer[i] == '\0') {
+                    int seq;
 
                     LOGI("%s\n", buffer + offset);
-                    code = handle_response(strdup(buffer + offset));
-
-                    if (code >= 200 && code < 600) {
-                        pthread_mutex_lock(&mutex);
-                        cmd_result = code;
-                        cmd_inflight--;
-                        pthread_cond_signal(&completion);
-                        pthread_mutex_unlock(&mutex);
-                    }
+                    code = handle_response(buffer + offset, &seq);
+
+                    if (code >= 200 && code < 600)
+                        complete_command(seq, code);
                     offset = i + 1;
                 }
             }
+            filled -= offset;
+            memmove(buffer, buffer + offset, filled);
         }
     }
 out:
     free(buffer);
-    pthread_mutex_unlock(&mutex);
     return code;
 }
 
@@ -193,11 +325,9 @@ static void *event_thread_func(void* v) {
     // if monitor() returns, it means we lost the connection to vold
     while (1) {
 
-        if (vold_connect()) {
+        if (vold_connect() > 0) {
             monitor();
-
-            if (sock)
-                close(sock);
+            disconnect();
         }
         sleep(3);
     }
@@ -210,17 +340,18 @@ extern void vold_set_automount(int automount);
 // start the client thread
 void vold_client_start(struct vold_callbacks* callbacks, int automount) {
 
-    if (sock > 0) {
+    pthread_mutex_lock(&mutex);
+    if (monitor_started) {
+        pthread_mutex_unlock(&mutex);
         return;
     }
 
-    pthread_mutex_lock(&mutex);
-
     vold_set_callbacks(callbacks);
 
     pthread_t vold_event_thread;
     pthread_create(&vold_event_thread, NULL, &event_thread_func, NULL);
-    pthread_cond_wait(&completion, &mutex);
+    while (!monitor_started)
+        pthread_cond_wait(&completion, &mutex);
     pthread_mutex_unlock(&mutex);
 
     vold_update_volumes();
@@ -231,19 +362,13 @@ void vold_client_start(struct vold_callbacks* callbacks, int automount) {
     vold_set_automount(automount);
 }
 
-// send a command to vold. waits for completion and returns result
-// code if wait is 1, otherwise returns zero immediately.
-int vold_command(int len, const char** command, int wait) {
+// Builds "<seq> <args...>", quoting arguments that contain spaces.
+static int build_command(int seq, int len, const char** command, char* out, size_t size) {
 
-    char final_cmd[255] = "0 "; /* 0 is a (now required) sequence number */
     int i;
     size_t sz;
-    int ret = 0;
-
-    if (!vold_connect()) {
-        return -1;
-    }
 
+    snprintf(out, size, "%d ", seq);
     for (i = 0; i < len; i++) {
         char *cmp;
 
@@ -252,32 +377,122 @@ int vold_command(int len, const char** command, int wait) {
         else
             asprintf(&cmp, "\"%s\"%s", command[i], (i == (len -1)) ? "" : " ");
 
-        sz = strlcat(final_cmd, cmp, sizeof(final_cmd));
+        sz = strlcat(out, cmp, size);
+        free(cmp);
 
-        if (sz >= sizeof(final_cmd)) {
-            LOGE("command syntax error  sz=%d size=%d", sz, sizeof(final_cmd));
-            free(cmp);
+        if (sz >= size) {
+            LOGE("command syntax error  sz=%zu size=%zu", sz, size);
             return -1;
         }
-        free(cmp);
     }
+    return 0;
+}
+
+// send a command to vold without waiting for it. returns its sequence
+// number, or -1 if it couldn't be sent.
+int vold_command_async(int len, const char** command, vold_command_cb callback, void* cookie) {
+
+    char final_cmd[255];
+    struct pending_command* cmd;
+    int seq;
+
+    if (vold_connect() < 0) {
+        return -1;
+    }
+
+    cmd = (struct pending_command*)calloc(1, sizeof(*cmd));
+    if (cmd == NULL) {
+        return -1;
+    }
+    cmd->callback = callback;
+    cmd->cookie = cookie;
 
     // only one writer at a time
     pthread_mutex_lock(&mutex);
-    if (write(sock, final_cmd, strlen(final_cmd) + 1) < 0) {
+    seq = next_seq++;
+    if (build_command(seq, len, command, final_cmd, sizeof(final_cmd)) < 0) {
+        pthread_mutex_unlock(&mutex);
+        free(cmd);
+        return -1;
+    }
+    cmd->seq = seq;
+    cmd->next = pending;
+    pending = cmd;
+
+    // MSG_NOSIGNAL: a dead connection is reported by the event thread,
+    // not with SIGPIPE
+    if (sock < 0 || send(sock, final_cmd, strlen(final_cmd) + 1, MSG_NOSIGNAL) < 0) {
         LOGE("Unable to send command to vold!\n");
-        ret = -1;
+        unlink_command_locked(cmd);
+        pthread_mutex_unlock(&mutex);
+        free(cmd);
+        return -1;
+    }
+    pthread_mutex_unlock(&mutex);
+
+    return seq;
+}
+
+// wait for a command sent without a callback. returns its response
+// code, or -1 if vold went away or timeout_ms (unless negative) passed.
+int vold_command_wait(int seq, int timeout_ms) {
+
+    struct pending_command* cmd;
+    struct timespec deadline;
+    int ret = -1;
+
+    if (timeout_ms >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&mutex);
+    for (cmd = pending; cmd; cmd = cmd->next) {
+        if (cmd->seq == seq && cmd->callback == NULL)
+            break;
+    }
+    if (cmd == NULL) {
+        pthread_mutex_unlock(&mutex);
+        return -1;
     }
-    cmd_inflight++;
 
-    if (wait) {
-        while (cmd_inflight) {
-            // wait for completion
+    while (!cmd->done) {
+        if (timeout_ms < 0) {
             pthread_cond_wait(&completion, &mutex);
-            ret = cmd_result;
+        } else if (pthread_cond_timedwait(&completion, &mutex, &deadline) == ETIMEDOUT) {
+            LOGE("Vold command %d timed out\n", seq);
+            break;
         }
     }
+    if (cmd->done)
+        ret = cmd->code;
+
+    unlink_command_locked(cmd);
     pthread_mutex_unlock(&mutex);
+    free(cmd);
 
-    return ret == ResponseCode::CommandOkay ? 0 : -1;
+    return ret;
+}
+
+static void discard_result(int seq, int code, void* cookie) {
+}
+
+// send a command to vold. waits for completion and returns result
+// code if wait is 1, otherwise returns zero immediately.
+int vold_command(int len, const char** command, int wait) {
+
+    int seq = vold_command_async(len, command, wait ? NULL : discard_result, NULL);
+
+    if (seq < 0) {
+        return -1;
+    }
+    if (!wait) {
+        return 0;
+    }
+    return vold_command_wait(seq, -1) == ResponseCode::CommandOkay ? 0 : -1;
 }
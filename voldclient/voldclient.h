@@ -34,6 +34,9 @@ int vold_get_volume_state(const char* path);
 
 int vold_update_volumes();
 int vold_get_num_volumes();
+// Changes whenever a volume appears, goes away or changes state, so
+// callers can skip rebuilding anything derived from the volumes.
+unsigned int vold_get_volumes_generation();
 void vold_mount_all();
 void vold_unmount_all();
 
@@ -47,6 +50,15 @@ void vold_client_start(struct vold_callbacks* callbacks, int automount);
 void vold_set_automount(int enabled);
 int vold_command(int len, const char** command, int wait);
 
+// Pipelined commands: each is sent with its own sequence number, so any
+// number can be in flight.  With a callback, it is called on the event
+// thread with the final response code; without one, the caller collects
+// the result with vold_command_wait().  Either way the code is -1 if the
+// connection to vold is lost first.
+typedef void (*vold_command_cb)(int seq, int code, void* cookie);
+int vold_command_async(int len, const char** command, vold_command_cb callback, void* cookie);
+int vold_command_wait(int seq, int timeout_ms);
+
 const char* volume_state_to_string(int state);
 
 #endif